@@ -1,4 +1,7 @@
 #include "basic.h"
+#include "nodes.h"
+#include "pool.h"
+#include "output.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,15 +10,6 @@
 //////////////////////////////////////////////////////////////////////
 // Literal
 
-// Representation for a Literal expression, derived from Expr.
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  /** Literal value of this expression. */
-  char *val;
-} LiteralExpr;
-
 // Function to evaluate a literal expression.
 static char *evalLiteral( Expr *expr, Context *ctxt )
 {
@@ -23,9 +17,32 @@ static char *evalLiteral( Expr *expr, Context *ctxt )
   LiteralExpr *this = (LiteralExpr *)expr;
 
   // Make and return a copy of the value we contain.
-  char *result = (char *) malloc( strlen( this->val ) + 1 );
-  strcpy( result, this->val );
-  return result;
+  return copyString( this->val );
+}
+
+// Function to evaluate a literal expression as a condition.
+static bool condLiteral( Expr *expr, Context *ctxt )
+{
+  // Cast the this pointer to a more specific type.
+  LiteralExpr *this = (LiteralExpr *)expr;
+
+  // Just look at the value, no need to copy it.
+  return this->len != 0;
+}
+
+// Function to write a literal expression's value to a buffer.
+static void evalToLiteral( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  // Cast the this pointer to a more specific type.
+  LiteralExpr *this = (LiteralExpr *)expr;
+
+  // Just append the value, no need to copy it first.
+  appendBuffer( dest, this->val, this->len );
+}
+
+// Function to execute a literal expression, which has nothing to do.
+static void execLiteral( Expr *expr, Context *ctxt )
+{
 }
 
 // Function to free a literal expression.
@@ -47,9 +64,16 @@ Expr *makeLiteral( char *val )
   // Remember our virutal functions.
   this->eval = evalLiteral;
   this->destroy = destroyLiteral;
+  this->kind = EXPR_LITERAL;
+  this->evalCond = condLiteral;
+  this->exec = execLiteral;
+  this->evalTo = evalToLiteral;
 
-  // Remember the literal string we contain.
+  // Remember the literal string we contain.  We hash it now, so
+  // comparisons never have to store anything in the node.
   this->val = val;
+  this->len = strlen( val );
+  this->hash = hashString( val, this->len );
 
   // Return the result, as an instance of the base.
   return (Expr *) this;
@@ -58,15 +82,6 @@ Expr *makeLiteral( char *val )
 //////////////////////////////////////////////////////////////////////
 // print
 
-// Representation for a print expression, derived from Expr.
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  /** Argument expression we're supposed to evaluate and print. */
-  Expr *arg;
-} PrintExpr;
-
 // Function to evaluate a print expression.
 static char *evalPrint( Expr *expr, Context *ctxt )
 {
@@ -75,13 +90,33 @@ static char *evalPrint( Expr *expr, Context *ctxt )
 
   // Evaluate our argument and print the result.
   char *result = this->arg->eval( this->arg, ctxt );
-  printf( "%s", result );
+  writeOutput( contextOutput( ctxt ), result, strlen( result ) );
   
   // The print expression evaluates to the thing it printed (clever, then
   // we don't have to do an unnecessary malloc/free.
   return result;
 }
 
+// Function to write a print expression's value to a buffer.
+static void evalToPrint( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  // Cast the this pointer to a more specific type.
+  PrintExpr *this = (PrintExpr *)expr;
+
+  // Write our argument's value to the buffer, then print the part we wrote.
+  int start = dest->len;
+  this->arg->evalTo( this->arg, ctxt, dest );
+  writeOutput( contextOutput( ctxt ), dest->data + start, dest->len - start );
+}
+
+// Function to execute a print expression, printing its argument from
+// a scratch buffer.
+static void execPrint( Expr *expr, Context *ctxt )
+{
+  evalToPrint( expr, ctxt, pushBuffer( ctxt ) );
+  popBuffer( ctxt );
+}
+
 // Function to free a print expression.
 static void destroyPrint( Expr *expr )
 {
@@ -101,6 +136,10 @@ Expr *makePrint( Expr *arg )
   // Remember our virutal functions.
   this->eval = evalPrint;
   this->destroy = destroyPrint;
+  this->kind = EXPR_PRINT;
+  this->evalCond = defaultEvalCond;
+  this->exec = execPrint;
+  this->evalTo = evalToPrint;
 
   // Remember our argument subexpression.
   this->arg = arg;
@@ -112,38 +151,60 @@ Expr *makePrint( Expr *arg )
 //////////////////////////////////////////////////////////////////////
 // Compound
 
-// Representation for a compound expression, derived from Expr.
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
+// Function to evaluate a compound expression.
+static char *evalCompound( Expr *expr, Context *ctxt )
+{
+  // Cast the this pointer to a more specific type.
+  CompoundExpr *this = (CompoundExpr *)expr;
 
-  /** List of subexpressions in the compound. */
-  Expr **eList;
+  // Execute everything but the last subexpression, we don't need
+  // their values.
+  for ( int i = 0; i + 1 < this->len; i++ )
+    this->eList[ i ]->exec( this->eList[ i ], ctxt );
 
-  /** Number of subexpressions in the compound. */
-  int len;
-} CompoundExpr;
+  // Return the value of the last subexpression.
+  Expr *last = this->eList[ this->len - 1 ];
+  return last->eval( last, ctxt );
+}
 
-// Function to evaluate a compound expression.
-static char *evalCompound( Expr *expr, Context *ctxt )
+// Function to evaluate a compound expression as a condition.
+static bool condCompound( Expr *expr, Context *ctxt )
 {
   // Cast the this pointer to a more specific type.
   CompoundExpr *this = (CompoundExpr *)expr;
 
-  // Evaluate the sequence of expressions in this compound
-  for ( int i = 0; i < this->len; i++ ) {
-    char *result = this->eList[ i ]->eval( this->eList[ i ], ctxt );
-    
-    // Return the value of the last subexpression.
-    if ( i + 1 >= this->len )
-      return result;
-    
-    // Or free it, if we don't need it.
-    free( result );
-  }
-  
-  // Never reached.
-  return NULL;
+  // Execute everything but the last subexpression as usual.
+  for ( int i = 0; i + 1 < this->len; i++ )
+    this->eList[ i ]->exec( this->eList[ i ], ctxt );
+
+  // Then the last one as a condition.
+  Expr *last = this->eList[ this->len - 1 ];
+  return last->evalCond( last, ctxt );
+}
+
+// Function to write a compound expression's value to a buffer.
+static void evalToCompound( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  // Cast the this pointer to a more specific type.
+  CompoundExpr *this = (CompoundExpr *)expr;
+
+  // Execute everything but the last subexpression, then write its value.
+  for ( int i = 0; i + 1 < this->len; i++ )
+    this->eList[ i ]->exec( this->eList[ i ], ctxt );
+
+  Expr *last = this->eList[ this->len - 1 ];
+  last->evalTo( last, ctxt, dest );
+}
+
+// Function to execute a compound expression, where we don't need the
+// value of any of the subexpressions.
+static void execCompound( Expr *expr, Context *ctxt )
+{
+  // Cast the this pointer to a more specific type.
+  CompoundExpr *this = (CompoundExpr *)expr;
+
+  for ( int i = 0; i < this->len; i++ )
+    this->eList[ i ]->exec( this->eList[ i ], ctxt );
 }
 
 // Function to free a compound expression.
@@ -167,11 +228,10 @@ Expr *makeCompound( Expr **eList, int len )
   // Remember our virutal functions.
   this->eval = evalCompound;
   this->destroy = destroyCompound;
-
-  if ( len <= 0 ) {
-    fprintf( stderr, "line %d: empty compound expression\n", linesRead() );
-    exit( EXIT_FAILURE );
-  }
+  this->kind = EXPR_COMPOUND;
+  this->evalCond = condCompound;
+  this->exec = execCompound;
+  this->evalTo = evalToCompound;
 
   // Remember our list of subexpressions.
   this->eList = eList;
@@ -27,7 +27,7 @@ Expr *makePrint( Expr *arg );
 /** Make a compound expression, representing the sequence of expressions 
     @param eList list of subexpressions to evaluate.  The compound expression
     will be responsible for freeing this list and the subexpressions it contains.
-    @param len number of expressions in eList.
+    @param len number of expressions in eList, at least one.
     @return a new expression that evaluates all the expressions in eList.
  */
 Expr *makeCompound( Expr **eList, int len );
@@ -1,8 +1,15 @@
+// For the lock on the table of variable names.
+#define _POSIX_C_SOURCE 200809L
+
 #include "core.h"
+#include "pool.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <pthread.h>
 
 // Maximum variable length
 #define MAX_VAR 20
@@ -12,6 +19,109 @@
 #define RIGHT_BRACKET 125
 #define POUND 35
 
+//////////////////////////////////////////////////////////////////////
+// Buffer
+
+// Initial capacity for a buffer, when it first needs storage.
+#define BUFFER_START 32
+
+// Values at least this long are moved from a buffer rather than
+// copied.  Shorter ones are cheap to copy, and copying lets the buffer
+// and the destination keep the storage they have.
+#define MOVE_LENGTH 256
+
+void initBuffer( Buffer *buf )
+{
+  buf->data = allocString( BUFFER_START );
+  buf->data[ 0 ] = '\0';
+  buf->len = 0;
+  buf->cap = stringCapacity( buf->data );
+}
+
+void appendBuffer( Buffer *buf, char const *str, int len )
+{
+  // Grow the buffer by doubling, so appends are constant time on average.
+  if ( buf->len + len + 1 > buf->cap ) {
+    int cap = buf->cap;
+    while ( buf->len + len + 1 > cap )
+      cap *= 2;
+    buf->data = resizeString( buf->data, cap );
+    buf->cap = stringCapacity( buf->data );
+  }
+
+  memcpy( buf->data + buf->len, str, len );
+  buf->len += len;
+  buf->data[ buf->len ] = '\0';
+}
+
+void appendString( Buffer *buf, char const *str )
+{
+  appendBuffer( buf, str, strlen( str ) );
+}
+
+void truncateBuffer( Buffer *buf, int len )
+{
+  buf->len = len;
+  buf->data[ len ] = '\0';
+}
+
+char *releaseBuffer( Buffer *buf )
+{
+  char *data = buf->data;
+  initBuffer( buf );
+  return data;
+}
+
+void freeBuffer( Buffer *buf )
+{
+  freeString( buf->data );
+  buf->data = NULL;
+  buf->len = buf->cap = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Str
+
+Str bufferStr( Buffer const *buf )
+{
+  return (Str){ buf->data, buf->len, NULL };
+}
+
+unsigned hashString( char const *data, int len )
+{
+  // FNV-1a, which is simple and spreads out short strings well.
+  unsigned hash = 2166136261u;
+  for ( int i = 0; i < len; i++ ) {
+    hash ^= (unsigned char) data[ i ];
+    hash *= 16777619u;
+  }
+
+  // Zero means we haven't computed it, so never return that.
+  return hash ? hash : 1;
+}
+
+/** Return the hash of a string that has a place to cache it,
+    computing it the first time. */
+static unsigned cachedHash( Str str )
+{
+  if ( *str.hash == 0 )
+    *str.hash = hashString( str.data, str.len );
+  return *str.hash;
+}
+
+bool strEqual( Str a, Str b )
+{
+  if ( a.len != b.len )
+    return false;
+
+  // Computing a hash takes as long as comparing the characters, so
+  // it only pays off if both strings can keep theirs for next time.
+  if ( a.hash && b.hash && cachedHash( a ) != cachedHash( b ) )
+    return false;
+
+  return memcmp( a.data, b.data, a.len ) == 0;
+}
+
 // Node for building our linked list.
 struct NodeTag {
   
@@ -19,6 +129,15 @@ struct NodeTag {
   char* name;
   // Value in this node.
   char* value;
+  // Length of the value.
+  int len;
+  // Number of bytes allocated for value.
+  int cap;
+  // Hash of the value, or zero if we haven't needed it yet.
+  unsigned hash;
+
+  // Number of times a value has been stored in this node.
+  unsigned long version;
 
   // Pointer to the next node.
   struct NodeTag *next;
@@ -30,9 +149,12 @@ typedef struct NodeTag Node;
 Node *makeList(){
   Node *n = (Node *)malloc( sizeof( Node ) );
   n->name = (char *) malloc( sizeof( char ) );
-  n->value = (char *) malloc( sizeof( char ) );
+  n->value = copyString( "" );
   n->name[0] = '\0';
-  n->value[0] = '\0';
+  n->len = 0;
+  n->cap = stringCapacity( n->value );
+  n->hash = 0;
+  n->version = 0;
   n->next = NULL;
   return n;
 }
@@ -44,20 +166,78 @@ Node *makeList(){
 struct ContextTag {
   // Head of the linked list.
   Node *head; 
+
+  // Epoch for this context, so cached entries from some other
+  // context are never mistaken for ours.
+  unsigned long epoch;
+
+  // Entry for each variable number we've been asked about (see
+  // initVarCache()), or NULL if we haven't looked it up yet.
+  Node **slots;
+  int slotCap;
+
+  // Stack of scratch buffers for pushBuffer(), the number in use,
+  // the number we've made and the capacity of the stack.  Each buffer
+  // is allocated separately so it doesn't move when the stack grows.
+  Buffer **stack;
+  int depth;
+  int height;
+  int stackCap;
+
+  // Streams for the program's output and error messages.
+  FILE *out;
+  FILE *err;
+
+  // Where to go after a runtime error, or NULL to exit.
+  jmp_buf *onError;
+
+  // Steps taken so far, the step count when the hook is due next, the
+  // number of steps between calls and the hook itself.
+  long steps;
+  long nextHook;
+  long quantum;
+  void (*hook)( Context *ctxt );
 };
 
+// Last epoch handed out to a context.
+static unsigned long lastEpoch = 0;
+
 Context *makeContext()
 {
    // Get in a generic instance of Context
   Context *this = (Context *) malloc( sizeof( Context ) );
   // Fill in our nodes with null.
   this->head = makeList();
+  // Nodes never move once they're in the list, so we only need a new
+  // epoch when the context is created.  Contexts can be made on
+  // several threads at once.
+  this->epoch = __atomic_add_fetch( &lastEpoch, 1, __ATOMIC_RELAXED );
+  // We'll find entries for inline caches as they're used.
+  this->slots = NULL;
+  this->slotCap = 0;
+  // We'll make scratch buffers as they're needed.
+  this->stack = NULL;
+  this->depth = 0;
+  this->height = 0;
+  this->stackCap = 0;
+  // Until we're told otherwise, the program uses the standard streams
+  // and errors just exit.
+  this->out = stdout;
+  this->err = stderr;
+  this->onError = NULL;
+  // Nobody's counting steps yet.
+  this->steps = 0;
+  setStepHook( this, 0, NULL );
   // Return the context
   return (Context *) this;
 }
 
-  
-char const *getVariable( Context *ctxt, char const *name )
+unsigned long contextEpoch( Context *ctxt )
+{
+  return ctxt->epoch;
+}
+
+VarSlot *lookupSlot( Context *ctxt, char const *name )
 {
   Node *m = ctxt->head;
   while(m != NULL && strcmp(m->name, name) != 0){
@@ -72,66 +252,282 @@ char const *getVariable( Context *ctxt, char const *name )
     n->name = (char *) malloc( len + 1 );
     strcpy(n->name, name);
     n->name[len] = '\0';
-    n->value = (char *) malloc( 1 );
-    n->value[0] = '\0';
+    n->value = copyString( "" );
+    n->len = 0;
+    n->cap = stringCapacity( n->value );
+    n->hash = 0;
+    n->version = 0;
     // Link it to the start of the list.
     n->next = ctxt->head;
     ctxt->head = n;
 
-    // Return empty string.
-    return n->value;
-    
+    return n;
   } else {
-    
-    // If the variable is in the list, return its value.
-    return m->value;
-    
+    return m;
+  }
+}
+
+// Initial capacity for the table of variable names, and for a
+// context's table of entries.
+#define INITIAL_NAMES 16
+
+// Initial capacity for the stack of scratch buffers.
+#define INITIAL_BUFFERS 16
+
+// Every variable name an expression has used, indexed by the number
+// initVarCache() gave it, with an open-addressed table of those
+// numbers for finding names.  Programs can be parsed on several
+// threads at once, so these are only used with nameLock held.
+static char **varNames = NULL;
+static int varCount = 0;
+static int *nameTable = NULL;
+static int nameCap = 0;
+static pthread_mutex_t nameLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Return the slot in nameTable where the given name is, or where it
+    belongs if it's not there. */
+static int nameSlot( char const *name )
+{
+  unsigned h = hashString( name, strlen( name ) ) % nameCap;
+  while ( nameTable[ h ] >= 0 && strcmp( varNames[ nameTable[ h ] ], name ) != 0 )
+    h = ( h + 1 ) % nameCap;
+  return h;
+}
+
+void initVarCache( VarCache *cache, char const *name )
+{
+  pthread_mutex_lock( &nameLock );
+
+  // Grow the table if it's getting full.
+  if ( 2 * ( varCount + 1 ) > nameCap ) {
+    int oldCap = nameCap;
+    int *oldTable = nameTable;
+    nameCap = oldCap ? oldCap * 2 : INITIAL_NAMES;
+    nameTable = (int *) malloc( nameCap * sizeof( int ) );
+    for ( int i = 0; i < nameCap; i++ )
+      nameTable[ i ] = -1;
+    for ( int i = 0; i < oldCap; i++ )
+      if ( oldTable[ i ] >= 0 )
+        nameTable[ nameSlot( varNames[ oldTable[ i ] ] ) ] = oldTable[ i ];
+    free( oldTable );
+    varNames = (char **) realloc( varNames, nameCap * sizeof( char * ) );
+  }
+
+  int h = nameSlot( name );
+  if ( nameTable[ h ] < 0 ) {
+    varNames[ varCount ] = (char *) malloc( strlen( name ) + 1 );
+    strcpy( varNames[ varCount ], name );
+    nameTable[ h ] = varCount++;
+  }
+  cache->id = nameTable[ h ];
+
+  pthread_mutex_unlock( &nameLock );
+}
+
+/** Look up the entry for a variable number we don't have yet, and
+    remember it in the context. */
+static VarSlot *fillSlot( Context *ctxt, char const *name, int id )
+{
+  if ( id >= ctxt->slotCap ) {
+    int oldCap = ctxt->slotCap;
+    int cap = oldCap ? oldCap : INITIAL_NAMES;
+    while ( id >= cap )
+      cap *= 2;
+    ctxt->slots = (Node **) realloc( ctxt->slots, cap * sizeof( Node * ) );
+    memset( ctxt->slots + oldCap, 0, ( cap - oldCap ) * sizeof( Node * ) );
+    ctxt->slotCap = cap;
+  }
+
+  ctxt->slots[ id ] = lookupSlot( ctxt, name );
+  return ctxt->slots[ id ];
+}
+
+VarSlot *cachedSlot( Context *ctxt, char const *name, VarCache const *cache )
+{
+  // Only search the first time this context sees the variable.
+  if ( cache->id < ctxt->slotCap && ctxt->slots[ cache->id ] )
+    return ctxt->slots[ cache->id ];
+  return fillSlot( ctxt, name, cache->id );
+}
+
+char const *slotValue( VarSlot *slot )
+{
+  return slot->value;
+}
+
+Str slotStr( VarSlot *slot )
+{
+  return (Str){ slot->value, slot->len, &slot->hash };
+}
+
+unsigned long slotVersion( VarSlot *slot )
+{
+  return slot->version;
+}
+
+void setSlotValue( VarSlot *slot, char const *value, int len )
+{
+  slot->version++;
+  slot->len = len;
+  slot->hash = 0;
+
+  // Keep the storage we have if the new value fits.  The value could
+  // be part of our old one, so it may overlap.
+  if ( len + 1 <= slot->cap ) {
+    memmove( slot->value, value, len );
+    slot->value[ len ] = '\0';
+    return;
+  }
+
+  char *copy = allocString( len + 1 );
+  memcpy( copy, value, len );
+  copy[ len ] = '\0';
+  freeString( slot->value );
+  slot->value = copy;
+  slot->cap = stringCapacity( copy );
+}
+
+void moveSlotValue( VarSlot *slot, char *value, int len )
+{
+  slot->version++;
+  slot->len = len;
+  slot->hash = 0;
+
+  freeString( slot->value );
+  slot->value = value;
+  slot->cap = stringCapacity( value );
+}
+
+void setSlotFromBuffer( VarSlot *slot, Buffer *buf )
+{
+  if ( buf->len < MOVE_LENGTH && buf->len + 1 <= slot->cap ) {
+    setSlotValue( slot, buf->data, buf->len );
+  } else {
+    // Trade storage with the buffer, so neither of us has to allocate.
+    char *old = slot->value;
+    int cap = slot->cap;
+    slot->version++;
+    slot->len = buf->len;
+    slot->hash = 0;
+    slot->value = buf->data;
+    slot->cap = buf->cap;
+    buf->data = old;
+    buf->cap = cap;
   }
+
+  truncateBuffer( buf, 0 );
+}
+
+char const *getVariable( Context *ctxt, char const *name )
+{
+  // Return the variable's value, making an empty one if it's not in the list.
+  return lookupSlot( ctxt, name )->value;
 }
  
 
 void setVariable( Context *ctxt, char const *name, char *value )
 {
-  Node *m = ctxt->head;
-  while(m != NULL && strcmp(m->name, name) != 0){
-    m = m->next;
+  setSlotValue( lookupSlot( ctxt, name ), value, strlen( value ) );
+}
+
+void moveVariable( Context *ctxt, char const *name, char *value )
+{
+  moveSlotValue( lookupSlot( ctxt, name ), value, strlen( value ) );
+}
+
+Buffer *pushBuffer( Context *ctxt )
+{
+  // Make a new buffer if we're deeper than we've been before.
+  if ( ctxt->depth >= ctxt->height ) {
+    if ( ctxt->height >= ctxt->stackCap ) {
+      ctxt->stackCap = ctxt->stackCap ? ctxt->stackCap * 2 : INITIAL_BUFFERS;
+      ctxt->stack = (Buffer **) realloc( ctxt->stack,
+                                         ctxt->stackCap * sizeof( Buffer * ) );
+    }
+    Buffer *buf = (Buffer *) malloc( sizeof( Buffer ) );
+    initBuffer( buf );
+    ctxt->stack[ ctxt->height++ ] = buf;
   }
-  
-  if(m == NULL){
-    // If the variable is not in the list, then make a new node.
-    Node *n = (Node *)malloc( sizeof( Node ) );
 
-    // Save fields.
-    int len = strlen( name );
-    n->name = (char *) malloc( len + 1 );
-    strcpy(n->name, name);
-    n->name[len] = '\0';
-    len = strlen( value );
-    n->value = (char *) malloc( len + 1 );
-    strcpy(n->value, value);
-    n->value[len] = '\0';
+  Buffer *buf = ctxt->stack[ ctxt->depth++ ];
+  truncateBuffer( buf, 0 );
+  return buf;
+}
 
-    // Link it to the start of the list.
-    n->next = ctxt->head;
-    ctxt->head = n;
-    
-  } else {
-    free(m->value);
-  
-    int len = strlen( value );
-    m->value = (char *) malloc( len + 1 );
-    strcpy(m->value, value);
-    m->value[len] = '\0';
+void popBuffer( Context *ctxt )
+{
+  ctxt->depth--;
+}
+
+void setContextStreams( Context *ctxt, FILE *out, FILE *err )
+{
+  ctxt->out = out;
+  ctxt->err = err;
+}
+
+FILE *contextOutput( Context *ctxt )
+{
+  return ctxt->out;
+}
+
+void setErrorHandler( Context *ctxt, jmp_buf *onError )
+{
+  ctxt->onError = onError;
+}
+
+void setStepHook( Context *ctxt, long quantum, void (*hook)( Context *ctxt ) )
+{
+  ctxt->quantum = quantum;
+  ctxt->hook = hook;
+  ctxt->nextHook = hook ? ctxt->steps + quantum : LONG_MAX;
+}
+
+bool countingSteps( Context *ctxt )
+{
+  return ctxt->hook != NULL;
+}
+
+void countStep( Context *ctxt )
+{
+  // Without a hook, nextHook is too far off to ever reach.
+  if ( ++ctxt->steps == ctxt->nextHook ) {
+    ctxt->nextHook += ctxt->quantum;
+    ctxt->hook( ctxt );
   }
 }
 
+long contextSteps( Context *ctxt )
+{
+  return ctxt->steps;
+}
+
+jmp_buf *contextErrorHandler( Context *ctxt )
+{
+  return ctxt->onError;
+}
+
+void runtimeError( Context *ctxt, char const *msg )
+{
+  fprintf( ctxt->err, "Runtime Error: %s\n", msg );
+  if ( ctxt->onError )
+    longjmp( *ctxt->onError, 1 );
+  exit( EXIT_FAILURE );
+}
+
 void freeContext( Context *ctxt )
 {
+  for ( int i = 0; i < ctxt->height; i++ ) {
+    freeBuffer( ctxt->stack[ i ] );
+    free( ctxt->stack[ i ] );
+  }
+  free( ctxt->stack );
+  free( ctxt->slots );
+
   Node *m = ctxt->head;
   while(m != NULL){
     ctxt->head = ctxt->head->next;
     free(m->name);
-    free(m->value);
+    freeString(m->value);
     free(m);
     m = ctxt->head;
   }
@@ -141,22 +537,69 @@ void freeContext( Context *ctxt )
 //////////////////////////////////////////////////////////////////////
 // Input tokenization
 
-// Current line we're parsing, starting from 1 like most editors.
-static int lineCount = 1;
+void initSource( Source *src, FILE *fp, FILE *err )
+{
+  src->fp = fp;
+  src->text = NULL;
+  src->len = src->pos = 0;
+  src->line = 1;
+  src->err = err;
+  src->onError = NULL;
+}
+
+void initTextSource( Source *src, char const *text, long len, FILE *err )
+{
+  initSource( src, NULL, err );
+  src->text = text;
+  src->len = len;
+}
+
+/** Read the next character from a source, or EOF at the end. */
+static int readChar( Source *src )
+{
+  if ( src->fp )
+    return fgetc( src->fp );
+  if ( src->pos >= src->len )
+    return EOF;
+  return (unsigned char) src->text[ src->pos++ ];
+}
 
-bool nextToken( char *token, FILE *fp )
+/** Put back the last character read from a source. */
+static void unreadChar( int ch, Source *src )
+{
+  if ( src->fp )
+    ungetc( ch, src->fp );
+  else
+    src->pos--;
+}
+
+void syntaxError( Source *src, char const *format, ... )
+{
+  fprintf( src->err, "line %d: ", src->line );
+  va_list args;
+  va_start( args, format );
+  vfprintf( src->err, format, args );
+  va_end( args );
+  fprintf( src->err, "\n" );
+
+  if ( src->onError )
+    longjmp( *src->onError, 1 );
+  exit( EXIT_FAILURE );
+}
+
+bool nextToken( char *token, Source *src )
 {
   int ch;
 
   // Skip whitespace and comments.
-  while ( isspace( ch = fgetc( fp ) ) || ch == '#' ) {
+  while ( isspace( ch = readChar( src ) ) || ch == '#' ) {
     // If we hit the comment characer, skip the whole line.
     if ( ch == '#' )
-      while ( ( ch = fgetc( fp ) ) != EOF && ch != '\n' )
+      while ( ( ch = readChar( src ) ) != EOF && ch != '\n' )
         ;
 
     if ( ch == '\n' )
-      lineCount++;
+      src->line++;
   }
     
   if ( ch == EOF )
@@ -174,12 +617,11 @@ bool nextToken( char *token, FILE *fp )
 
   // Handle non-quoted words.
   if ( ch != '"' ) {
-    while ( ( ch = fgetc( fp ) ) != EOF && !isspace( ch ) &&
+    while ( ( ch = readChar( src ) ) != EOF && !isspace( ch ) &&
             ch != '{' && ch != '}' && ch != '"' && ch != '#' ) {
       // Complain if the token is too long.
       if ( len >= MAX_TOKEN ) {
-        fprintf( stderr, "line %d: token too long\n", linesRead() );
-        exit( EXIT_FAILURE );
+        syntaxError( src, "token too long" );
       }
 
       token[ len++ ] = ch;
@@ -188,7 +630,7 @@ bool nextToken( char *token, FILE *fp )
     // We had to read one character too far to find the end of the token.
     // put it back.
     if ( ch != EOF )
-      ungetc( ch, fp );
+      unreadChar( ch, src );
 
     token[ len++ ] = '\0';
     return true;
@@ -200,12 +642,11 @@ bool nextToken( char *token, FILE *fp )
   bool escape = false;
 
   // Keep reading until we hit the matching close quote.
-  while ( ( ch = fgetc( fp ) ) != '"' || escape ) {
+  while ( ( ch = readChar( src ) ) != '"' || escape ) {
     // Error conditions
     if ( ch == EOF || ch == '\n' ) {
-      fprintf( stderr, "line %d: %s while reading parsing string literal.\n",
-               linesRead(), ch == EOF ? "EOF" : "newline" );
-      exit( EXIT_FAILURE );
+      syntaxError( src, "%s while reading parsing string literal.",
+                   ch == EOF ? "EOF" : "newline" );
     }
       
     // On a backslash, we just enable escape mode.
@@ -228,17 +669,14 @@ bool nextToken( char *token, FILE *fp )
           ch = '\\';
           break;
         default:
-          fprintf( stderr, "line %d: Invalid escape sequence \"\\%c\"\n",
-                   linesRead(), ch );
-          exit( EXIT_FAILURE );
+          syntaxError( src, "Invalid escape sequence \"\\%c\"", ch );
         }
         escape = false;
       }
 
       // Complain if this string, with the eventual close quote, is too long.
       if ( len + 1 >= MAX_TOKEN ) {
-        fprintf( stderr, "line %d: token too long\n", linesRead() );
-        exit( EXIT_FAILURE );
+        syntaxError( src, "token too long" );
       }
       token[ len++ ] = ch;
     }
@@ -250,8 +688,49 @@ bool nextToken( char *token, FILE *fp )
   return token;
 }
 
-int linesRead()
+int linesRead( Source *src )
 {
-  return lineCount;
+  return src->line;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Expr
+
+bool defaultEvalCond( Expr *expr, Context *ctxt )
+{
+  Buffer *val = pushBuffer( ctxt );
+  expr->evalTo( expr, ctxt, val );
+  bool result = ( val->len > 0 );
+  popBuffer( ctxt );
+  return result;
+}
+
+void defaultExec( Expr *expr, Context *ctxt )
+{
+  expr->evalCond( expr, ctxt );
+}
+
+void defaultEvalTo( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  char *val = expr->eval( expr, ctxt );
+  appendString( dest, val );
+  freeString( val );
+}
+
+char *bufferEval( Expr *expr, Context *ctxt )
+{
+  Buffer *val = pushBuffer( ctxt );
+  expr->evalTo( expr, ctxt, val );
+
+  // Hand over a long value's storage, rather than copying it.
+  char *result;
+  if ( val->len >= MOVE_LENGTH ) {
+    result = releaseBuffer( val );
+  } else {
+    result = allocString( val->len + 1 );
+    memcpy( result, val->data, val->len + 1 );
+  }
+
+  popBuffer( ctxt );
+  return result;
+}
@@ -11,6 +11,110 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <setjmp.h>
+
+//////////////////////////////////////////////////////////////////////
+// Buffer
+
+/** Growable string an expression can write its value into, rather
+    than returning a new string.  A buffer keeps its storage when it's
+    cleared, so reusing one doesn't allocate once it's big enough.  Its
+    storage comes from allocString() (see pool.h), so a long value can
+    be handed off as a string or to a variable without copying it.
+*/
+typedef struct {
+  /** Contents of the buffer, always null terminated. */
+  char *data;
+
+  /** Length of the contents, not counting the null terminator. */
+  int len;
+
+  /** Number of bytes allocated for data. */
+  int cap;
+} Buffer;
+
+/** Initialize an empty buffer.
+    @param buf buffer to initialize.
+*/
+void initBuffer( Buffer *buf );
+
+/** Append some characters to a buffer, making room if needed.
+    @param buf buffer to append to.
+    @param str characters to append.
+    @param len number of characters to append.
+*/
+void appendBuffer( Buffer *buf, char const *str, int len );
+
+/** Append a null terminated string to a buffer.
+    @param buf buffer to append to.
+    @param str string to append.
+*/
+void appendString( Buffer *buf, char const *str );
+
+/** Shorten a buffer, discarding everything after the given length.
+    @param buf buffer to shorten.
+    @param len new length, no more than the current one.
+*/
+void truncateBuffer( Buffer *buf, int len );
+
+/** Take the storage out of a buffer, leaving the buffer empty with
+    new storage of its own.
+    @param buf buffer to take the contents of.
+    @return the buffer's contents, to be freed with freeString().
+*/
+char *releaseBuffer( Buffer *buf );
+
+/** Free the storage for a buffer.
+    @param buf buffer to free.
+*/
+void freeBuffer( Buffer *buf );
+
+//////////////////////////////////////////////////////////////////////
+// Str
+
+/** A string value we can look at in place, along with its length, so
+    operators don't have to scan for the end of it.  The characters
+    can include nulls, the length says where the string ends.  Values
+    that stick around, like a variable's value or a literal, also have
+    somewhere to cache their hash, so comparing them can usually
+    reject a mismatch without looking at the characters.
+*/
+typedef struct {
+  /** Characters of the string. */
+  char const *data;
+
+  /** Number of characters in the string. */
+  int len;
+
+  /** Where this string's hash is cached, or NULL if it doesn't have
+      anywhere to keep one.  A cached hash of zero means it hasn't
+      been computed yet. */
+  unsigned *hash;
+} Str;
+
+/** Return a Str for the contents of a buffer.  A buffer's contents
+    change too often to be worth caching a hash for.
+    @param buf buffer to look at.
+    @return the buffer's contents, good until the buffer changes.
+*/
+Str bufferStr( Buffer const *buf );
+
+/** Compute the hash of a string.  This is never zero, so zero can
+    mean "not computed yet" in a cache.
+    @param data characters of the string.
+    @param len number of characters.
+    @return hash of the string.
+*/
+unsigned hashString( char const *data, int len );
+
+/** Report whether two strings have the same characters.  Strings of
+    different lengths, or with different hashes if both of them can
+    cache one, are rejected without comparing characters.
+    @param a first string to compare.
+    @param b second string to compare.
+    @return true if they're equal.
+*/
+bool strEqual( Str a, Str b );
 
 //////////////////////////////////////////////////////////////////////
 // Context
@@ -34,10 +138,12 @@ Context *makeContext();
 
 /** Return the value of the variable with the given name.  If the
     variable isn't defined, this function returns the empty string.
+    This just borrows the value, it doesn't copy it.
     @param ctxt context object in which to lookup the variable name.
     @param new value for the variable name.
     @return the variable's value.  This is a pointer into the context's
-    representation and should not be directly freed or modified by the caller.
+    representation and should not be directly freed or modified by the
+    caller.  It's good until the variable is assigned.
 */
 char const *getVariable( Context *ctxt, char const *name );
 
@@ -51,6 +157,198 @@ char const *getVariable( Context *ctxt, char const *name );
 */
 void setVariable( Context *ctxt, char const *name, char *value );
 
+/** Like setVariable(), but the context takes ownership of the given
+    value instead of copying it.
+    @param ctxt context in which to store the variable name / value.
+    @param name of the variable to set the value for.
+    @param value new value for this variable, from allocString() (see
+    pool.h).  The caller must not use or free it afterward.
+*/
+void moveVariable( Context *ctxt, char const *name, char *value );
+
+/** Short typename for a variable's entry in a context.  Like the
+    Context, its definition isn't visible to client code.  An entry stays
+    at the same address for as long as the context's epoch (see
+    contextEpoch()) doesn't change, so expressions can hang on to it
+    rather than looking up their variable every time they're evaluated.
+*/
+typedef struct NodeTag VarSlot;
+
+/** Inline cache an expression can keep for the variable it uses.  It
+    holds a number for the variable's name, the same in every context,
+    and each context keeps the entry it found for each number.  The
+    expression never has to change its cache after it's built, so one
+    program can run in several contexts at once, on different threads.
+*/
+typedef struct {
+  /** Number for the variable's name, from initVarCache(). */
+  int id;
+} VarCache;
+
+/** Fill in the inline cache for an expression that uses the named
+    variable.  This is safe to call from several threads at once.
+    @param cache inline cache to fill in.
+    @param name name of the variable the expression uses.
+*/
+void initVarCache( VarCache *cache, char const *name );
+
+/** Return the epoch of the given context.  Every context gets a
+    different epoch, and a context's epoch changes if its entries ever
+    move, so a VarSlot is still good as long as the epoch it was found
+    with matches.
+    @param ctxt context to get the epoch for.
+    @return the context's current epoch.
+*/
+unsigned long contextEpoch( Context *ctxt );
+
+/** Return the entry for the variable with the given name, creating
+    one holding the empty string if the variable isn't defined yet.
+    @param ctxt context object in which to lookup the variable name.
+    @param name name of the variable to find.
+    @return the variable's entry.
+*/
+VarSlot *lookupSlot( Context *ctxt, char const *name );
+
+/** Return the entry for the named variable, using the given cache so
+    repeated lookups of the same variable in the same context don't
+    have to search for it.
+    @param ctxt context object in which to lookup the variable name.
+    @param name name of the variable to find.
+    @param cache inline cache for this lookup.
+    @return the variable's entry.
+*/
+VarSlot *cachedSlot( Context *ctxt, char const *name, VarCache const *cache );
+
+/** Return the value stored in a variable's entry.
+    @param slot entry for the variable.
+    @return the variable's value.  This is a pointer into the context's
+    representation and should not be directly freed or modified by the caller.
+*/
+char const *slotValue( VarSlot *slot );
+
+/** Return the value stored in a variable's entry, with its length and
+    the entry's hash cache.
+    @param slot entry for the variable.
+    @return the variable's value, good until the variable is assigned.
+*/
+Str slotStr( VarSlot *slot );
+
+/** Store a copy of the given value in a variable's entry.  The entry
+    reuses its storage if the value fits.
+    @param slot entry for the variable.
+    @param value new value for this variable.
+    @param len length of the value.
+*/
+void setSlotValue( VarSlot *slot, char const *value, int len );
+
+/** Store the given value in a variable's entry, taking ownership of it
+    rather than copying it.
+    @param slot entry for the variable.
+    @param value new value, from allocString().  The caller must not use
+    or free it afterward.
+    @param len length of the value.
+*/
+void moveSlotValue( VarSlot *slot, char *value, int len );
+
+/** Store the whole contents of a buffer in a variable's entry.  Long
+    values are moved, trading the buffer's storage for the entry's old
+    storage, so they don't have to be copied.
+    @param slot entry for the variable.
+    @param buf buffer holding the new value.  This is left empty.
+*/
+void setSlotFromBuffer( VarSlot *slot, Buffer *buf );
+
+/** Return the write version of a variable's entry.  This starts at
+    zero and goes up by one every time a value is stored in the entry,
+    so it tells whether the variable has been assigned since some
+    earlier point.
+    @param slot entry for the variable.
+    @return the entry's write version.
+*/
+unsigned long slotVersion( VarSlot *slot );
+
+/** Return an empty scratch buffer for evaluating an operand into.
+    Buffers are handed out like a stack, one for each level of nesting,
+    and each one keeps its storage between uses, so evaluating the same
+    expression over and over doesn't have to allocate.  The buffer
+    stays at the same address until it's popped.
+    @param ctxt context that owns the buffers.
+    @return a cleared buffer, good until the matching popBuffer().
+*/
+Buffer *pushBuffer( Context *ctxt );
+
+/** Give back the buffer from the most recent pushBuffer().
+    @param ctxt context that owns the buffers.
+*/
+void popBuffer( Context *ctxt );
+
+/** Send the output and error messages for the program running in
+    this context to the given streams.  A new context uses stdout and
+    stderr.
+    @param ctxt context to set the streams for.
+    @param out stream for the program's output.
+    @param err stream for error messages.
+*/
+void setContextStreams( Context *ctxt, FILE *out, FILE *err );
+
+/** Return the stream for the program's output.
+    @param ctxt context running the program.
+    @return the stream its output goes to.
+*/
+FILE *contextOutput( Context *ctxt );
+
+/** Say where to go after a runtime error, rather than exiting.
+    @param ctxt context running the program.
+    @param onError where runtimeError() will longjmp() to, or NULL to
+    just exit.
+*/
+void setErrorHandler( Context *ctxt, jmp_buf *onError );
+
+/** Return where the context goes after a runtime error.
+    @param ctxt context running the program.
+    @return the error handler given to setErrorHandler(), or NULL if
+    runtime errors just exit.
+*/
+jmp_buf *contextErrorHandler( Context *ctxt );
+
+/** Report a runtime error in the program running in this context,
+    then longjmp() to its error handler, or exit unsuccessfully if it
+    doesn't have one.  This doesn't return.
+    @param ctxt context running the program.
+    @param msg description of the error.
+*/
+void runtimeError( Context *ctxt, char const *msg );
+
+/** Call the given function every so many steps of the program running
+    in this context, so a scheduler can let something else run.
+    @param ctxt context running the program.
+    @param quantum number of steps between calls.
+    @param hook function to call, or NULL to stop calling it.
+*/
+void setStepHook( Context *ctxt, long quantum, void (*hook)( Context *ctxt ) );
+
+/** Return true if the context has a step hook, so the program needs
+    to count its steps.  Loops check this once before they start.
+    @param ctxt context running the program.
+    @return true if steps should be counted.
+*/
+bool countingSteps( Context *ctxt );
+
+/** Count one step of the program running in this context.  Every trip
+    through a loop is a step, so a program can't run for long without
+    taking them.  This calls the context's step hook at the end of
+    each quantum.
+    @param ctxt context running the program.
+*/
+void countStep( Context *ctxt );
+
+/** Return the number of steps the program running in this context has
+    taken while it had a step hook.
+    @param ctxt context running the program.
+    @return number of steps.
+*/
+long contextSteps( Context *ctxt );
+
 /** Free all the memory associated with this context.
     @param ctxt context to free memory for.
 */
@@ -62,21 +360,74 @@ void freeContext( Context *ctxt );
 // Maximum length of a token in the source file.
 #define MAX_TOKEN 1023
 
-/** Read and the next token from the given file, a space-delimtied
+/** A program source being tokenized: the file (or text) it comes
+    from, the line we're on and what to do about errors in it.
+    Everything about reading one program is kept here, so several can
+    be read at once.
+*/
+typedef struct {
+  /** File tokens are read from. */
+  FILE *fp;
+
+  /** Or, if fp is NULL, text tokens are read from, its length and the
+      position of the next character. */
+  char const *text;
+  long len;
+  long pos;
+
+  /** Current line we're parsing, starting from 1 like most editors. */
+  int line;
+
+  /** Stream for error messages. */
+  FILE *err;
+
+  /** Where syntaxError() goes after reporting an error, or NULL to
+      just exit. */
+  jmp_buf *onError;
+} Source;
+
+/** Initialize a source for reading tokens from the start of a file.
+    @param src source to initialize.
+    @param fp file to read tokens from.
+    @param err stream for error messages.
+*/
+void initSource( Source *src, FILE *fp, FILE *err );
+
+/** Initialize a source for reading tokens from text in memory.  This
+    is much faster than reading the same text through fmemopen().
+    @param src source to initialize.
+    @param text text to read tokens from, which doesn't need a null
+    terminator.
+    @param len length of the text.
+    @param err stream for error messages.
+*/
+void initTextSource( Source *src, char const *text, long len, FILE *err );
+
+/** Read and the next token from the given source, a space-delimtied
     word, a double quoted string or either of the curly brackets.
     @param tok storage for the token, with room for a string of up to
      MAX_TOKEN characters.
-    @param fp file to read tokens from.
+    @param src source to read tokens from.
     @return true if the token is successfully read.
-    @sideeffect increments a global line count as it
+    @sideeffect increments the source's line count as it
     parses newlines.
 */
-bool nextToken( char *tok, FILE *fp );
+bool nextToken( char *tok, Source *src );
 
 /** Return the number of lines read so far.  This is maintained by nextToken.
+    @param src source being read.
     @return the number of lines read so far.
 */
-int linesRead();
+int linesRead( Source *src );
+
+/** Report an error in a program's source, with the current line
+    number, then longjmp() to the source's error handler or exit
+    unsuccessfully if it doesn't have one.  This doesn't return.
+    @param src source with the error.
+    @param format printf-style format for the message, followed by
+    its arguments.
+*/
+void syntaxError( Source *src, char const *format, ... );
 
 //////////////////////////////////////////////////////////////////////
 // Expr
@@ -84,11 +435,76 @@ int linesRead();
 /** A short name to use for the expression interface. */
 typedef struct ExprTag Expr;
 
+/** Every kind of expression node.  Each node records its kind so
+    passes that inspect or rewrite the tree (see optimize.h) can tell
+    what they're looking at and get to its representation in nodes.h.
+*/
+typedef enum {
+  // Nodes built by the parser.
+  EXPR_LITERAL,
+  EXPR_PRINT,
+  EXPR_COMPOUND,
+  EXPR_VARIABLE,
+  EXPR_SET,
+  EXPR_ADD,
+  EXPR_SUB,
+  EXPR_MUL,
+  EXPR_DIV,
+  EXPR_EQUAL,
+  EXPR_LESS,
+  EXPR_NOT,
+  EXPR_AND,
+  EXPR_OR,
+  EXPR_IF,
+  EXPR_WHILE,
+  EXPR_CONCAT,
+  EXPR_SUBSTR,
+
+  // Type-specialized nodes substituted by the optimizer (see typed.h).
+  EXPR_INT_LITERAL,
+  EXPR_INT_VARIABLE,
+  EXPR_INT_SET,
+  EXPR_INT_ADD,
+  EXPR_INT_SUB,
+  EXPR_INT_MUL,
+  EXPR_INT_DIV,
+  EXPR_INT_WHILE,
+  EXPR_COUNTED_LOOP,
+  EXPR_INT_ADD_CONST,
+  EXPR_INT_MUL_CONST,
+  EXPR_INT_SHIFT,
+  EXPR_INT_DIV_CONST,
+  EXPR_INT_LESS,
+  EXPR_INT_EQUAL,
+  EXPR_BOOL_EQUAL,
+  EXPR_BOOL_NOT,
+  EXPR_BOOL_AND,
+  EXPR_BOOL_OR,
+  EXPR_BOOL_IF,
+
+  // Fused nodes for common statements (see typed.h).
+  EXPR_INCREMENT,
+  EXPR_SET_LITERAL,
+  EXPR_INT_SET_LITERAL,
+  EXPR_IF_LESS,
+
+  // Memoized subexpressions (see memo.h).
+  EXPR_MEMO,
+  EXPR_INT_MEMO
+} ExprKind;
+
 /** Representation for an Expr interface.  Classes implementing this
-    have these two fields as their first members.  They will set eval
+    have these six fields as their first members.  They will set eval
     to point to appropriate functions to evaluate the type of
-    expression their class represents, and they will set destroy to
-    point to a function that frees memory for their type of expresson.
+    expression their class represents, they will set destroy to
+    point to a function that frees memory for their type of expresson,
+    they will set kind to say what type of expression they are and
+    they will set evalCond to a function that evaluates the expression
+    as a condition, exec to a function that evaluates it just for
+    its side effects and evalTo to a function that writes its value
+    into a buffer (defaultEvalCond(), defaultExec() and defaultEvalTo()
+    if they don't have anything better).  Classes with a good evalTo
+    can use bufferEval() as their eval.
 */
 struct ExprTag {
   /** Pointer to a function to evaluate the given expression and
@@ -96,7 +512,7 @@ struct ExprTag {
       @param expr expression to be evaluated.
       @param ctxt current values of all variables.
       @return string respresentation of the result. The caller is responsible
-      for freeing this.
+      for freeing this, with freeString() (see pool.h).
    */
   char *(*eval)( Expr *expr, Context *ctxt );
 
@@ -105,6 +521,73 @@ struct ExprTag {
       @param expr expression to free.
   */
   void (*destroy)( Expr *expr );
+
+  /** What type of expression this is. */
+  ExprKind kind;
+
+  /** Pointer to a function to evaluate the given expression as a
+      condition, just reporting whether its value would be true
+      (anything but the empty string).  This has the same effects as
+      eval, but nodes that can tell the answer without building a
+      string don't have to allocate one.
+      @param expr expression to be evaluated.
+      @param ctxt current values of all variables.
+      @return true if the expression's value is not the empty string.
+   */
+  bool (*evalCond)( Expr *expr, Context *ctxt );
+
+  /** Pointer to a function to evaluate the given expression in a
+      context where its value isn't used, like a statement in the
+      middle of a compound or the body of a loop.  This has the same
+      effects as eval, but doesn't return a value at all.
+      @param expr expression to be evaluated.
+      @param ctxt current values of all variables.
+   */
+  void (*exec)( Expr *expr, Context *ctxt );
+
+  /** Pointer to a function to evaluate the given expression and
+      append its value to a buffer supplied by the caller.  This has
+      the same effects as eval, but it doesn't need a new string for
+      the result.
+      @param expr expression to be evaluated.
+      @param ctxt current values of all variables.
+      @param dest buffer to append the value to.
+   */
+  void (*evalTo)( Expr *expr, Context *ctxt, Buffer *dest );
 };
 
+/** Default evalCond for expressions that don't have a faster way:
+    evaluate the expression and check the first character of its value.
+    @param expr expression to be evaluated.
+    @param ctxt current values of all variables.
+    @return true if the expression's value is not the empty string.
+*/
+bool defaultEvalCond( Expr *expr, Context *ctxt );
+
+/** Default exec for expressions that don't have a faster way:
+    evaluate the expression as a condition and ignore the answer,
+    since evalCond is never more work than eval.
+    @param expr expression to be evaluated.
+    @param ctxt current values of all variables.
+*/
+void defaultExec( Expr *expr, Context *ctxt );
+
+/** Default evalTo for expressions that don't have a faster way:
+    evaluate the expression and append the resulting string.
+    @param expr expression to be evaluated.
+    @param ctxt current values of all variables.
+    @param dest buffer to append the value to.
+*/
+void defaultEvalTo( Expr *expr, Context *ctxt, Buffer *dest );
+
+/** Eval function for expressions that have their own evalTo: write
+    the value to a scratch buffer and return a copy of it.  An
+    expression can't use this along with defaultEvalTo().
+    @param expr expression to be evaluated.
+    @param ctxt current values of all variables.
+    @return the expression's value.  The caller is responsible for
+    freeing this with freeString().
+*/
+char *bufferEval( Expr *expr, Context *ctxt );
+
 #endif
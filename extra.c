@@ -1,4 +1,7 @@
 #include "extra.h"
+#include "nodes.h"
+#include "pool.h"
+#include "number.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,17 +23,6 @@
 //////////////////////////////////////////////////////////////////////
 // Variable expressions
 
-/** Representation for an arbitrary variable operator.  The eval
-    pointer decides what it computes. */
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  // One operand expressions.
-  char *op1;
-} VariableExpr;
-
-
 /** Free memory for any type of VariableExpr instance. */
 static void destroyVariable( Expr *expr )
 {
@@ -41,17 +33,43 @@ static void destroyVariable( Expr *expr )
   free( this );
 }
 
+/** For VariableExpr, evaluating as a condition just looks at the
+    variable's value, without copying it. */
+static bool condVariable( Expr *expr, Context *ctxt )
+{
+  VariableExpr *this = (VariableExpr *)expr;
+  return slotStr( cachedSlot( ctxt, this->op1, &this->cache ) ).len != 0;
+}
+
+/** For VariableExpr, evalTo just appends the variable's value. */
+static void evalToVariable( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  VariableExpr *this = (VariableExpr *)expr;
+  Str val = slotStr( cachedSlot( ctxt, this->op1, &this->cache ) );
+  appendBuffer( dest, val.data, val.len );
+}
+
+/** Reading a variable has no effects, so there's nothing to do if we
+    don't need its value. */
+static void execVariable( Expr *expr, Context *ctxt )
+{
+}
+
 /** Construct a VariableExpr representation and fill in the parts
     that are common to all SetExpr instances. */
 static VariableExpr *buildVariableExpr( char const *op1 )
 {
   VariableExpr *this = (VariableExpr *) malloc( sizeof( VariableExpr ) );
   this->destroy = destroyVariable;
+  this->evalCond = condVariable;
+  this->exec = execVariable;
+  this->evalTo = evalToVariable;
 
   int len = strlen(op1);
   this->op1 = (char *)malloc( len + 1 );
   strcpy(this->op1, op1);
   this->op1[len] = '\0';
+  initVarCache( &this->cache, this->op1 );
 
   return this;
 }
@@ -60,18 +78,6 @@ static VariableExpr *buildVariableExpr( char const *op1 )
 //////////////////////////////////////////////////////////////////////
 // Set expressions
 
-/** Representation for an arbitrary set operator.  The eval
-    pointer decides what it computes. */
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  // Two operand expressions.
-  char *op1;
-  Expr *op2;
-} SetExpr;
-
-
 /** Free memory for any type of SetExpr instance. */
 static void destroySet( Expr *expr )
 {
@@ -91,12 +97,16 @@ static SetExpr *buildSetExpr( char const *op1, Expr *op2 )
 {
   SetExpr *this = (SetExpr *) malloc( sizeof( SetExpr ) );
   this->destroy = destroySet;
+  this->evalCond = defaultEvalCond;
+  this->exec = defaultExec;
+  this->evalTo = defaultEvalTo;
 
   int len = strlen(op1);
   this->op1 = (char *)malloc( len + 1 );
   strcpy(this->op1, op1);
   this->op1[len] = '\0';
   this->op2 = op2;
+  initVarCache( &this->cache, this->op1 );
 
   return this;
 }
@@ -105,17 +115,6 @@ static SetExpr *buildSetExpr( char const *op1, Expr *op2 )
 //////////////////////////////////////////////////////////////////////
 // Unary expressions
 
-/** Representation for an arbitrary unary operator.  The eval
-    pointer decides what it computes. */
-typedef struct {
-  char *(*eval)( Expr *expr, Context *ctxt );
-  void (*destroy)( Expr *expr );
-
-  // One operand expression.
-  Expr *op;
-} UnaryExpr;
-
-
 /** Free memory for any type of UnaryExpr instance. */
 static void destroyUnary( Expr *expr )
 {
@@ -135,6 +134,9 @@ static UnaryExpr *buildUnaryExpr( Expr *op)
 {
   UnaryExpr *this = (UnaryExpr *) malloc( sizeof( UnaryExpr ) );
   this->destroy = destroyUnary;
+  this->evalCond = defaultEvalCond;
+  this->exec = defaultExec;
+  this->evalTo = defaultEvalTo;
 
   this->op = op;
 
@@ -145,17 +147,6 @@ static UnaryExpr *buildUnaryExpr( Expr *op)
 //////////////////////////////////////////////////////////////////////
 // Binary expressions
 
-/** Representation for an arbitrary binary operator.  The eval
-    pointer decides what it computes. */
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  // Two operand expressions.
-  Expr *op1, *op2;
-} BinaryExpr;
-
-
 /** Free memory for any type of BinaryExpr instance. */
 static void destroyBinary( Expr *expr )
 {
@@ -175,6 +166,9 @@ static BinaryExpr *buildBinaryExpr( Expr *op1, Expr *op2 )
 {
   BinaryExpr *this = (BinaryExpr *) malloc( sizeof( BinaryExpr ) );
   this->destroy = destroyBinary;
+  this->evalCond = defaultEvalCond;
+  this->exec = defaultExec;
+  this->evalTo = defaultEvalTo;
 
   this->op1 = op1;
   this->op2 = op2;
@@ -186,17 +180,6 @@ static BinaryExpr *buildBinaryExpr( Expr *op1, Expr *op2 )
 //////////////////////////////////////////////////////////////////////
 // Trinary expressions
 
-/** Representation for an arbitrary trinary operator.  The eval
-    pointer decides what it computes. */
-typedef struct {
-  char *(*eval)( Expr *oper, Context *ctxt );
-  void (*destroy)( Expr *oper );
-
-  // Three operand expressions.
-  Expr *op1, *op2, *op3;
-} TrinaryExpr;
-
-
 /** Free memory for any type of TrinaryExpr instance. */
 static void destroyTrinary( Expr *expr )
 {
@@ -217,6 +200,9 @@ static TrinaryExpr *buildTrinaryExpr( Expr *op1, Expr *op2, Expr *op3 )
 {
   TrinaryExpr *this = (TrinaryExpr *) malloc( sizeof( TrinaryExpr ) );
   this->destroy = destroyTrinary;
+  this->evalCond = defaultEvalCond;
+  this->exec = defaultExec;
+  this->evalTo = defaultEvalTo;
 
   this->op1 = op1;
   this->op2 = op2;
@@ -233,568 +219,576 @@ static char *evalVariable( Expr *expr, Context *ctxt )
   // Get a pointer to the more specific type this function works with.
   VariableExpr *this = (VariableExpr *)expr;
 
-  // Evaluate our operand
-  int len = strlen(this->op1);
-  char *only = (char *)malloc( len + 1 );
-  strcpy(only, this->op1);
-  only[len] = '\0';
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  len = strlen(getVariable(ctxt, only));
-  char *result = (char *)malloc( len + 1 );
-  strcpy(result, getVariable(ctxt, only));
-  result[len] = '\0';
-  
-  // We're done with the value returned by our subexpression.
-  free( only ); 
+  // Find our variable, usually without having to search for it.
+  Str val = slotStr( cachedSlot( ctxt, this->op1, &this->cache ) );
+
+  // Return a copy of its value to the caller.  We already know how
+  // long it is.
+  char *result = allocString( val.len + 1 );
+  memcpy( result, val.data, val.len );
+  result[ val.len ] = '\0';
   return result;
 }
 
 
 /** For instances of SetExpr that sets variables, this
-    is the funciton they call for eval. */
-static char *evalSet( Expr *expr, Context *ctxt )
+    is the funciton they call for evalTo. */
+static void evalToSet( Expr *expr, Context *ctxt, Buffer *dest )
 {
   // Get a pointer to the more specific type this function works with.
   SetExpr *this = (SetExpr *)expr;
 
-  // Evaluate our two operands
-  int len = strlen(this->op1);
-  char *left = (char *)malloc( len + 1 );
-  strcpy(left, this->op1);
-  left[len] = '\0';
-  
-  char *right = this->op2->eval( this->op2, ctxt );
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  len = strlen(right);
-  char *result = (char *)malloc( len + 1 );
-  strcpy(result, right);
-  result[len] = '\0';
-  
-  setVariable(ctxt, left, right);
-  
-  // We're done with the values returned by our two subexpressions.
-  free( left );
-  free( right );
-  
-  return result;
+  // Our value is the value we assign, so we can write it straight to
+  // the destination and store it from there.
+  int start = dest->len;
+  this->op2->evalTo( this->op2, ctxt, dest );
+  setSlotValue( cachedSlot( ctxt, this->op1, &this->cache ), dest->data + start,
+                dest->len - start );
 }
 
-
-/** For instances of BinaryExpr that do addition, this
-    is the funciton they call for eval. */
-static char *evalAdd( Expr *expr, Context *ctxt )
+/** Exec for SetExpr.  Nothing else needs the value, so the variable
+    can take it straight from the scratch buffer. */
+static void execSet( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
+  SetExpr *this = (SetExpr *)expr;
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
+  Buffer *val = pushBuffer( ctxt );
+  this->op2->evalTo( this->op2, ctxt, val );
+  setSlotFromBuffer( cachedSlot( ctxt, this->op1, &this->cache ), val );
+  popBuffer( ctxt );
+}
 
-  // Parse the left and right operands as long ints.  Set them
-  // to zero if they don't parse correctly.
-  long a, b;
-  if ( sscanf( left, "%ld", &a ) != 1 )
-    a = 0;
 
-  if ( sscanf( right, "%ld", &b ) != 1 )
-    b = 0;
+//////////////////////////////////////////////////////////////////////
+// Arithmetic, comparison and concat operators
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as long ints.
-  free( left );
-  free( right );
+// These all evaluate both operands and then compute their value from
+// the two operand strings.  Each one is listed once in BINARY_OPS,
+// with a write function for appending its value to a buffer and a
+// test function for computing whether that value would be true.  The
+// evalTo and evalCond functions for each operator are generated from
+// that list, one for general operands and one for each of the common
+// operand shapes where we can read the operands in place: a variable
+// and a literal, two variables, or a literal and a variable.  Their
+// eval is just bufferEval().  To add a new operator, just add it to
+// the list and write its write and test functions.
+#define BINARY_OPS( X )   \
+  X( Add, EXPR_ADD )      \
+  X( Sub, EXPR_SUB )      \
+  X( Mul, EXPR_MUL )      \
+  X( Div, EXPR_DIV )      \
+  X( Equal, EXPR_EQUAL )  \
+  X( Less, EXPR_LESS )    \
+  X( Concat, EXPR_CONCAT )
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%ld", a + b );
-  return result;
+/** Append the given long to a buffer. */
+static void writeNumber( Buffer *dest, long val )
+{
+  char buffer[ MAX_NUMBER + 1 ];
+  appendBuffer( dest, buffer, formatNumber( buffer, val ) );
 }
 
+/** Append "true" to a buffer, or nothing for false. */
+static void writeTruth( Buffer *dest, bool val )
+{
+  if ( val )
+    appendString( dest, "true" );
+}
 
-/** For instances of BinaryExpr that do subtraction, this
-    is the funciton they call for eval. */
-static char *evalSub( Expr *expr, Context *ctxt )
+/** Write function for add. */
+static void writeAdd( Context *ctxt, Str left, Str right, Buffer *dest )
 {
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
+  writeNumber( dest, parseNumber( left.data ) + parseNumber( right.data ) );
+}
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
+/** Write function for sub. */
+static void writeSub( Context *ctxt, Str left, Str right, Buffer *dest )
+{
+  writeNumber( dest, parseNumber( left.data ) - parseNumber( right.data ) );
+}
 
-  // Parse the left and right operands as long ints.  Set them
-  // to zero if they don't parse correctly.
-  long a, b;
-  if ( sscanf( left, "%ld", &a ) != 1 )
-    a = 0;
+/** Write function for mul. */
+static void writeMul( Context *ctxt, Str left, Str right, Buffer *dest )
+{
+  writeNumber( dest, parseNumber( left.data ) * parseNumber( right.data ) );
+}
 
-  if ( sscanf( right, "%ld", &b ) != 1 )
-    b = 0;
+/** Parse the divisor for div, failing if it's zero. */
+static long parseDivisor( Context *ctxt, Str right )
+{
+  long b = parseNumber( right.data );
+  if (b == 0)
+    runtimeError( ctxt, "divide by zero" );
+  return b;
+}
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as long ints.
-  free( left );
-  free( right );
+/** Write function for div, which fails if we divide by zero. */
+static void writeDiv( Context *ctxt, Str left, Str right, Buffer *dest )
+{
+  long a = parseNumber( left.data );
+  long b = parseDivisor( ctxt, right );
+  writeNumber( dest, a / b );
+}
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%ld", a - b );
-  return result;
+/** Test function for the arithmetic operators.  Their values are
+    never empty, so there's nothing to compute. */
+static bool testNumber( Context *ctxt, Str left, Str right )
+{
+  return true;
 }
 
+// The test functions for add, sub and mul.
+#define testAdd testNumber
+#define testSub testNumber
+#define testMul testNumber
 
-/** For instances of BinaryExpr that do multiplication, this
-    is the funciton they call for eval. */
-static char *evalMul( Expr *expr, Context *ctxt )
+/** Test function for div, which still has to check the divisor. */
+static bool testDiv( Context *ctxt, Str left, Str right )
 {
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
-
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
+  parseDivisor( ctxt, right );
+  return true;
+}
 
-  // Parse the left and right operands as long ints.  Set them
-  // to zero if they don't parse correctly.
-  long a, b;
-  if ( sscanf( left, "%ld", &a ) != 1 )
-    a = 0;
+/** Test function for equal, comparing operands as strings.  This can
+    usually reject different strings just from their lengths or hashes. */
+static bool testEqual( Context *ctxt, Str left, Str right )
+{
+  return strEqual( left, right );
+}
 
-  if ( sscanf( right, "%ld", &b ) != 1 )
-    b = 0;
+/** Write function for equal. */
+static void writeEqual( Context *ctxt, Str left, Str right, Buffer *dest )
+{
+  writeTruth( dest, testEqual( ctxt, left, right ) );
+}
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as long ints.
-  free( left );
-  free( right );
+/** Test function for less, comparing operands as long ints. */
+static bool testLess( Context *ctxt, Str left, Str right )
+{
+  return parseNumber( left.data ) < parseNumber( right.data );
+}
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%ld", a * b );
-  return result;
+/** Write function for less. */
+static void writeLess( Context *ctxt, Str left, Str right, Buffer *dest )
+{
+  writeTruth( dest, testLess( ctxt, left, right ) );
 }
 
+/** Write function for concat, appending both operands. */
+static void writeConcat( Context *ctxt, Str left, Str right, Buffer *dest )
+{
+  appendBuffer( dest, left.data, left.len );
+  appendBuffer( dest, right.data, right.len );
+}
 
-/** For instances of BinaryExpr that do division, this
-    is the funciton they call for eval. */
-static char *evalDiv( Expr *expr, Context *ctxt )
+/** Test function for concat, true if either operand is non-empty. */
+static bool testConcat( Context *ctxt, Str left, Str right )
 {
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
+  return left.len != 0 || right.len != 0;
+}
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
+/** Append the part of str from start up to end, for substr. */
+static void writeSubstr( Str str, Str start, Str end, Buffer *dest )
+{
+  // Parse the start and end as long ints.  Set them to zero if they
+  // don't parse correctly.
+  long a = parseNumber( start.data );
+  long b = parseNumber( end.data );
 
-  // Parse the left and right operands as long ints.  Set them
-  // to zero if they don't parse correctly.
-  long a, b;
-  if ( sscanf( left, "%ld", &a ) != 1 )
+  //Clamp both indices to the string, so we never copy anything
+  //outside it.
+  if ( a < 0 )
     a = 0;
-
-  if ( sscanf( right, "%ld", &b ) != 1 )
-    b = 0;
-
-  if (b == 0){
-    fprintf(stderr, "Runtime Error: divide by zero\n");
-    exit( EXIT_FAILURE );
+  if ( a > str.len )
+    a = str.len;
+  if ( b > str.len )
+    b = str.len;
+
+  // Append the part of the string between them, if there is any.
+  if ( b > a )
+    appendBuffer( dest, str.data + a, b - a );
+}
+
+/** Return the current value of a variable operand, without copying it. */
+static Str variableOperand( Expr *expr, Context *ctxt )
+{
+  VariableExpr *var = (VariableExpr *)expr;
+  return slotStr( cachedSlot( ctxt, var->op1, &var->cache ) );
+}
+
+/** Return the text of a literal operand, without copying it. */
+static Str literalOperand( Expr *expr )
+{
+  LiteralExpr *lit = (LiteralExpr *)expr;
+  return (Str){ lit->val, lit->len, &lit->hash };
+}
+
+/** Define the evalTo functions for one operator: evalTo<Name> for
+    any operands, which evaluates them into scratch buffers, then
+    versions for the var-literal, var-var and literal-var operand
+    shapes, which read the operands in place. */
+#define DEFINE_WRITES( NAME )                                           \
+  static void evalTo##NAME( Expr *expr, Context *ctxt, Buffer *dest )   \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    Buffer *left = pushBuffer( ctxt );                                  \
+    this->op1->evalTo( this->op1, ctxt, left );                         \
+    Buffer *right = pushBuffer( ctxt );                                 \
+    this->op2->evalTo( this->op2, ctxt, right );                        \
+    write##NAME( ctxt, bufferStr( left ), bufferStr( right ), dest );   \
+    popBuffer( ctxt );                                                  \
+    popBuffer( ctxt );                                                  \
+  }                                                                     \
+                                                                        \
+  static void evalTo##NAME##VarLit( Expr *expr, Context *ctxt, Buffer *dest ) \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    write##NAME( ctxt, variableOperand( this->op1, ctxt ),              \
+                 literalOperand( this->op2 ), dest );                   \
+  }                                                                     \
+                                                                        \
+  static void evalTo##NAME##VarVar( Expr *expr, Context *ctxt, Buffer *dest ) \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    write##NAME( ctxt, variableOperand( this->op1, ctxt ),              \
+                 variableOperand( this->op2, ctxt ), dest );            \
+  }                                                                     \
+                                                                        \
+  static void evalTo##NAME##LitVar( Expr *expr, Context *ctxt, Buffer *dest ) \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    write##NAME( ctxt, literalOperand( this->op1 ),                     \
+                 variableOperand( this->op2, ctxt ), dest );            \
   }
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as long ints.
-  free( left );
-  free( right );
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%ld", a / b );
-  return result;
-}
 
+/** Define the evalCond functions for one operator, the same way. */
+#define DEFINE_TESTS( NAME )                                            \
+  static bool cond##NAME( Expr *expr, Context *ctxt )                   \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    Buffer *left = pushBuffer( ctxt );                                  \
+    this->op1->evalTo( this->op1, ctxt, left );                         \
+    Buffer *right = pushBuffer( ctxt );                                 \
+    this->op2->evalTo( this->op2, ctxt, right );                        \
+    bool result = test##NAME( ctxt, bufferStr( left ),                  \
+                              bufferStr( right ) );                     \
+    popBuffer( ctxt );                                                  \
+    popBuffer( ctxt );                                                  \
+    return result;                                                      \
+  }                                                                     \
+                                                                        \
+  static bool cond##NAME##VarLit( Expr *expr, Context *ctxt )           \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    return test##NAME( ctxt, variableOperand( this->op1, ctxt ),        \
+                       literalOperand( this->op2 ) );                   \
+  }                                                                     \
+                                                                        \
+  static bool cond##NAME##VarVar( Expr *expr, Context *ctxt )           \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    return test##NAME( ctxt, variableOperand( this->op1, ctxt ),        \
+                       variableOperand( this->op2, ctxt ) );            \
+  }                                                                     \
+                                                                        \
+  static bool cond##NAME##LitVar( Expr *expr, Context *ctxt )           \
+  {                                                                     \
+    BinaryExpr *this = (BinaryExpr *)expr;                              \
+    return test##NAME( ctxt, literalOperand( this->op1 ),               \
+                       variableOperand( this->op2, ctxt ) );            \
+  }
 
-/** For instances of BinaryExpr that check equivalency, this
-    is the funciton they call for eval. */
-static char *evalEqual( Expr *expr, Context *ctxt )
-{
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
-
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
+/** Define the evalTo and evalCond functions for one operator. */
+#define DEFINE_EVALS( NAME, KIND ) \
+  DEFINE_WRITES( NAME )            \
+  DEFINE_TESTS( NAME )
 
+BINARY_OPS( DEFINE_EVALS )
 
+/** Evaluation functions for one of the operators in BINARY_OPS. */
+typedef struct {
+  /** Kind of node for this operator. */
+  ExprKind kind;
+
+  /** EvalTo for general operands, and for each operand shape. */
+  void (*general)( Expr *expr, Context *ctxt, Buffer *dest );
+  void (*varLit)( Expr *expr, Context *ctxt, Buffer *dest );
+  void (*varVar)( Expr *expr, Context *ctxt, Buffer *dest );
+  void (*litVar)( Expr *expr, Context *ctxt, Buffer *dest );
+
+  /** The same, for evalCond. */
+  bool (*condGeneral)( Expr *expr, Context *ctxt );
+  bool (*condVarLit)( Expr *expr, Context *ctxt );
+  bool (*condVarVar)( Expr *expr, Context *ctxt );
+  bool (*condLitVar)( Expr *expr, Context *ctxt );
+} BinaryOp;
+
+/** Table entry for one operator. */
+#define OP_ENTRY( NAME, KIND )                                          \
+  { KIND, evalTo##NAME, evalTo##NAME##VarLit, evalTo##NAME##VarVar,     \
+    evalTo##NAME##LitVar,                                               \
+    cond##NAME, cond##NAME##VarLit, cond##NAME##VarVar, cond##NAME##LitVar },
+
+/** Table of all the operators in BINARY_OPS. */
+static BinaryOp const binaryOps[] = {
+  BINARY_OPS( OP_ENTRY )
+};
+
+void chooseOperandShape( Expr *expr )
+{
+  // Find the operator, if it's one of ours.
+  int count = sizeof( binaryOps ) / sizeof( binaryOps[ 0 ] );
+  BinaryOp const *op = NULL;
+  for ( int i = 0; i < count; i++ )
+    if ( binaryOps[ i ].kind == expr->kind )
+      op = &binaryOps[ i ];
+  if ( op == NULL )
+    return;
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if(strcmp( left, right ) == 0){ 
-    sprintf( result, "true");
+  BinaryExpr *this = (BinaryExpr *)expr;
+  bool var1 = this->op1->kind == EXPR_VARIABLE;
+  bool var2 = this->op2->kind == EXPR_VARIABLE;
+  bool lit1 = this->op1->kind == EXPR_LITERAL;
+  bool lit2 = this->op2->kind == EXPR_LITERAL;
+
+  if ( var1 && lit2 ) {
+    this->evalTo = op->varLit;
+    this->evalCond = op->condVarLit;
+  } else if ( var1 && var2 ) {
+    this->evalTo = op->varVar;
+    this->evalCond = op->condVarVar;
+  } else if ( lit1 && var2 ) {
+    this->evalTo = op->litVar;
+    this->evalCond = op->condLitVar;
   } else {
-    result[0] = '\0';
+    this->evalTo = op->general;
+    this->evalCond = op->condGeneral;
   }
-  
-  // We're done with the two subexpressions
-  free( left );
-  free( right );
-  
-  return result;
 }
 
+/** Case for one operator in writeOperator(). */
+#define WRITE_CASE( NAME, KIND )                  \
+  case KIND:                                      \
+    write##NAME( ctxt, ops[ 0 ], ops[ 1 ], dest ); \
+    break;
 
-/** For instances of BinaryExpr that check less than, this
-    is the funciton they call for eval. */
-static char *evalLess( Expr *expr, Context *ctxt )
+void writeOperator( ExprKind kind, Context *ctxt, Str const *ops, Buffer *dest )
 {
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
-
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
-
-  // Parse the left and right operands as long ints.  Set them
-  // to zero if they don't parse correctly.
-  long a, b;
-  if ( sscanf( left, "%ld", &a ) != 1 )
-    a = 0;
+  switch ( kind ) {
+    BINARY_OPS( WRITE_CASE )
+  case EXPR_SUBSTR:
+    writeSubstr( ops[ 0 ], ops[ 1 ], ops[ 2 ], dest );
+    break;
+  default:
+    break;
+  }
+}
 
-  if ( sscanf( right, "%ld", &b ) != 1 )
-    b = 0;
+/** Make a node for one of the operators in BINARY_OPS, with the
+    evalTo and evalCond functions for the shape of its operands. */
+static Expr *makeBinaryOp( ExprKind kind, Expr *op1, Expr *op2 )
+{
+  // Get in a generic instance of BinaryExpr
+  BinaryExpr *this = buildBinaryExpr( op1, op2 );
 
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as long ints.
-  free( left );
-  free( right );
+  this->eval = bufferEval;
+  this->kind = kind;
+  chooseOperandShape( (Expr *) this );
 
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if(a < b){ 
-    sprintf( result, "true");
-  } else {
-    result[0] = '\0';
-  }
-  return result;
+  // Return the instance as if it's an Expr (which it sort of is)
+  return (Expr *) this;
 }
 
 
 /** For instances of BinaryExpr that check if, this
-    is the funciton they call for eval. */
-static char *evalIf( Expr *expr, Context *ctxt )
+    is the funciton they call for evalTo. */
+static void evalToIf( Expr *expr, Context *ctxt, Buffer *dest )
 {
   // Get a pointer to the more specific type this function works with.
   BinaryExpr *this = (BinaryExpr *)expr;
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  if(left[0] != '\0'){
-    //If left is true then we evaluate right.
-    char *right = this->op2->eval( this->op2, ctxt );
-    free(right);
+  // Our value is the value of our condition, so we can write that
+  // straight to the destination.
+  int start = dest->len;
+  this->op1->evalTo( this->op1, ctxt, dest );
+  if ( dest->len > start ){
+    //If left is true then we execute right, we don't need its value.
+    this->op2->exec( this->op2, ctxt );
   }
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  int len = strlen(left);
-  char *result = (char *)malloc( len + 1 );
-  strcpy( result, left);
-  result[len] = '\0';
-  
-  // We're done with the our left subexpression.
-  free( left );
-  
-  return result;
 }
 
-
-/** For instances of BinaryExpr that check while, this
-    is the funciton they call for eval. */
-static char *evalWhile( Expr *expr, Context *ctxt )
+/** Evaluating if as a condition gives the truth of its own
+    condition, so we never need that as a string. */
+static bool condIf( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
   BinaryExpr *this = (BinaryExpr *)expr;
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  
+  bool left = this->op1->evalCond( this->op1, ctxt );
+  if ( left )
+    this->op2->exec( this->op2, ctxt );
+
+  return left;
+}
+
+/** Executing an if only needs its condition as a bool, too. */
+static void execIf( Expr *expr, Context *ctxt )
+{
+  condIf( expr, ctxt );
+}
+
+
+/** Run the loop for a while expression, returning the number of
+    times the body is evaluated. */
+static long runWhile( BinaryExpr *this, Context *ctxt )
+{
   //Declare count for times the body is evaluated.
   long count = 0;
   
-  while(strcmp(left, "") != 0){
-    //If left is true then we evaluate right.
-    char *right = this->op2->eval( this->op2, ctxt );
-    free(right);
-    //We continually evaluate left until it is no longer true.
-    left = this->op1->eval( this->op1, ctxt );
+  bool counting = countingSteps( ctxt );
+
+  //We continually evaluate left until it is no longer true.
+  while ( this->op1->evalCond( this->op1, ctxt ) ) {
+    this->op2->exec( this->op2, ctxt );
     count++;
+    if ( counting )
+      countStep( ctxt );
   }
-  
-  // We're done with the our left subexpression.
-  free( left );
-  
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  sprintf( result, "%ld", count);
-  
-  return result;
+
+  return count;
 }
 
+/** For instances of BinaryExpr that check while, this
+    is the funciton they call for evalTo. */
+static void evalToWhile( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  writeNumber( dest, runWhile( (BinaryExpr *)expr, ctxt ) );
+}
 
-/** For instances of BinaryExpr that check and, this
-    is the funciton they call for eval. */
-static char *evalAnd( Expr *expr, Context *ctxt )
+/** The value of a while loop is its iteration count, which always
+    prints as a non-empty string. */
+static bool condWhile( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
-  BinaryExpr *this = (BinaryExpr *)expr;
+  runWhile( (BinaryExpr *)expr, ctxt );
+  return true;
+}
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = (char *)malloc( MAX_NUMBER + 1 );
-  
-  if(left[0] != '\0'){
-    free(right);
-    right = this->op2->eval( this->op2, ctxt );
-  }
-  
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if(left[0] != '\0' && right[0] != '\0'){
-    sprintf(result, "true");
-  } else {
-    result[0] = '\0';
-  }
-  
-  // We're done with the values returned by our two subexpressions.
-  free( left );
-  free( right );
-  
-  return result;
+/** Exec for while, which doesn't need the count at all. */
+static void execWhile( Expr *expr, Context *ctxt )
+{
+  runWhile( (BinaryExpr *)expr, ctxt );
 }
 
 
-/** For instances of BinaryExpr that check or, this
-    is the funciton they call for eval. */
-static char *evalOr( Expr *expr, Context *ctxt )
+/** For instances of BinaryExpr that check and, this is the function
+    they call for evalCond.  Like the language's and, this only
+    evaluates the right operand if the left one is true. */
+static bool condAnd( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
   BinaryExpr *this = (BinaryExpr *)expr;
+  return this->op1->evalCond( this->op1, ctxt ) &&
+    this->op2->evalCond( this->op2, ctxt );
+}
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = (char *)malloc( MAX_NUMBER + 1 );
-   
-  if(left[0] == '\0'){   
-    free(right);  
-    right = this->op2->eval( this->op2, ctxt );
-  }
-  
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if(left[0] != '\0' || right[0] != '\0'){
-    sprintf(result, "true");
-  } else {
-    result[0] = '\0';
-  }
-  
-  // We're done with the values returned by our two subexpressions.
-  free( left );
-  free( right );
-  
-  return result;
+/** For instances of BinaryExpr that check and, this
+    is the funciton they call for evalTo. */
+static void evalToAnd( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  writeTruth( dest, condAnd( expr, ctxt ) );
 }
 
 
-/** For instances of BinaryExpr that do concatenation, this
-    is the funciton they call for eval. */
-static char *evalConcat( Expr *expr, Context *ctxt )
+/** For instances of BinaryExpr that check or, this is the function
+    they call for evalCond, evaluating the right operand only if the
+    left one is false. */
+static bool condOr( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
   BinaryExpr *this = (BinaryExpr *)expr;
+  return this->op1->evalCond( this->op1, ctxt ) ||
+    this->op2->evalCond( this->op2, ctxt );
+}
 
-  // Evaluate our two operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *right = this->op2->eval( this->op2, ctxt );
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  int len = strlen(left) + strlen(right);
-  char *result = (char *)malloc( len + 1 );
-  
-  strcpy(result, left);
-  strcat(result, right);
-  result[len] = '\0';
-  
-  // We're done with the values returned by our two subexpressions.
-  free( left );
-  free( right );
-  
-  return result;
+/** For instances of BinaryExpr that check or, this
+    is the funciton they call for evalTo. */
+static void evalToOr( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  writeTruth( dest, condOr( expr, ctxt ) );
 }
 
 
 /** For instances of TrinaryExpr that create substrings, this
-    is the funciton they call for eval. */
-static char *evalSubstr( Expr *expr, Context *ctxt )
+    is the funciton they call for evalTo. */
+static void evalToSubstr( Expr *expr, Context *ctxt, Buffer *dest )
 {
   // Get a pointer to the more specific type this function works with.
   TrinaryExpr *this = (TrinaryExpr *)expr;
 
-  // Evaluate our three operands
-  char *left = this->op1->eval( this->op1, ctxt );
-  char *middle = this->op2->eval( this->op2, ctxt );
-  char *right = this->op3->eval( this->op3, ctxt );
+  // Evaluate our three operands into scratch buffers.
+  Buffer *left = pushBuffer( ctxt );
+  this->op1->evalTo( this->op1, ctxt, left );
+  Buffer *middle = pushBuffer( ctxt );
+  this->op2->evalTo( this->op2, ctxt, middle );
+  Buffer *right = pushBuffer( ctxt );
+  this->op3->evalTo( this->op3, ctxt, right );
 
-  // Parse the middle and right operands as long ints.  Set them
-  // to zero if they don't parse correctly.
-  long a, b;
-  if ( sscanf( middle, "%ld", &a ) != 1 )
-    a = 0;
+  writeSubstr( bufferStr( left ), bufferStr( middle ), bufferStr( right ),
+               dest );
 
-  if ( sscanf( right, "%ld", &b ) != 1 )
-    b = 0;
-  
-  //If either index is negative, set it to zero.
-  if(a < 0){
-    a = 0;
-  }
-  if(b < 0){
-    b = 0;
-  }
-  
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  int len = b - a;
-  if(len < 0){
-    len = 0;
-  }
-  char *result = (char *)malloc( len + 1 );
-  
-  strncpy(result, left + a, len);
-  result[len] = '\0';
-  
-  // We're done with the values returned by our two subexpressions.
-  free( left );
-  free( middle );
-  free( right );
-  
-  return result;
+  // We're done with the values of our three subexpressions.
+  popBuffer( ctxt );
+  popBuffer( ctxt );
+  popBuffer( ctxt );
 }
 
 
-/** For instances of UnaryExpr that check not, this
-    is the funciton they call for eval. */
-static char *evalNot( Expr *expr, Context *ctxt )
+/** For instances of UnaryExpr that check not, this is the function
+    they call for evalCond. */
+static bool condNot( Expr *expr, Context *ctxt )
 {
-  // Get a pointer to the more specific type this function works with.
   UnaryExpr *this = (UnaryExpr *)expr;
+  return ! this->op->evalCond( this->op, ctxt );
+}
 
-  // Evaluate our operand
-  char *only = this->op->eval( this->op, ctxt );
-
-  // Compute the result, store it in a dynamically allocated string
-  // and return it to the caller.
-  char *result = (char *)malloc( MAX_NUMBER + 1 );
-  if(only[0] == '\0'){ 
-    sprintf( result, "true");
-  } else {
-    result[0] = '\0';
-  }
-  
-  // We're done with the values returned by our two subexpressions,
-  // We just needed to get them as long ints.
-  free( only );
-  
-  return result;
+/** For instances of UnaryExpr that check not, this
+    is the funciton they call for evalTo. */
+static void evalToNot( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  writeTruth( dest, condNot( expr, ctxt ) );
 }
 
 
 Expr *makeAdd( Expr *op1, Expr *op2 )
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to do adding.
-  this->eval = evalAdd;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_ADD, op1, op2 );
 }
 
 
 Expr *makeSub( Expr *op1, Expr *op2 )
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to do subtracting.
-  this->eval = evalSub;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_SUB, op1, op2 );
 }
 
 
 Expr *makeMul( Expr *op1, Expr *op2 )
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to do multiplication.
-  this->eval = evalMul;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_MUL, op1, op2 );
 }
 
 
 Expr *makeDiv( Expr *op1, Expr *op2 )
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to do division.
-  this->eval = evalDiv;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_DIV, op1, op2 );
 }
 
 
 Expr *makeEqual( Expr *op1, Expr *op2 )
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to check equivalency.
-  this->eval = evalEqual;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_EQUAL, op1, op2 );
 }
 
 
 Expr *makeLess( Expr *op1, Expr *op2 )
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to do check less than.
-  this->eval = evalLess;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_LESS, op1, op2 );
 }
 
 
@@ -804,7 +798,10 @@ Expr *makeNot( Expr *op)
   UnaryExpr *this = buildUnaryExpr( op );
 
   // Fill in our function to do check less than.
-  this->eval = evalNot;
+  this->eval = bufferEval;
+  this->evalTo = evalToNot;
+  this->evalCond = condNot;
+  this->kind = EXPR_NOT;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -818,6 +815,7 @@ Expr *makeVariable( char const *name)
 
   // Fill in our function to do check while.
   this->eval = evalVariable;
+  this->kind = EXPR_VARIABLE;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -830,7 +828,10 @@ Expr *makeSet( char const *name, Expr *expr)
   SetExpr *this = buildSetExpr( name, expr );
   
   // Fill in our function to do check while.
-  this->eval = evalSet;
+  this->eval = bufferEval;
+  this->evalTo = evalToSet;
+  this->exec = execSet;
+  this->kind = EXPR_SET;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -843,7 +844,11 @@ Expr *makeIf( Expr *cond, Expr *body)
   BinaryExpr *this = buildBinaryExpr( cond, body );
 
   // Fill in our function to do check less than.
-  this->eval = evalIf;
+  this->eval = bufferEval;
+  this->evalTo = evalToIf;
+  this->evalCond = condIf;
+  this->exec = execIf;
+  this->kind = EXPR_IF;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -856,7 +861,11 @@ Expr *makeWhile( Expr *cond, Expr *body)
   BinaryExpr *this = buildBinaryExpr( cond, body );
 
   // Fill in our function to do check while.
-  this->eval = evalWhile;
+  this->eval = bufferEval;
+  this->evalTo = evalToWhile;
+  this->evalCond = condWhile;
+  this->exec = execWhile;
+  this->kind = EXPR_WHILE;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -869,7 +878,10 @@ Expr *makeAnd( Expr *op1, Expr *op2)
   BinaryExpr *this = buildBinaryExpr( op1, op2 );
 
   // Fill in our function to do check and.
-  this->eval = evalAnd;
+  this->eval = bufferEval;
+  this->evalTo = evalToAnd;
+  this->evalCond = condAnd;
+  this->kind = EXPR_AND;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -882,7 +894,10 @@ Expr *makeOr( Expr *op1, Expr *op2)
   BinaryExpr *this = buildBinaryExpr( op1, op2 );
 
   // Fill in our function to do check or.
-  this->eval = evalOr;
+  this->eval = bufferEval;
+  this->evalTo = evalToOr;
+  this->evalCond = condOr;
+  this->kind = EXPR_OR;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
@@ -891,14 +906,7 @@ Expr *makeOr( Expr *op1, Expr *op2)
 
 Expr *makeConcat( Expr *op1, Expr *op2)
 {
-  // Get in a generic instance of BinaryExpr
-  BinaryExpr *this = buildBinaryExpr( op1, op2 );
-
-  // Fill in our function to do concatenation.
-  this->eval = evalConcat;
-
-  // Return the instance as if it's an Expr (which it sort of is)
-  return (Expr *) this;
+  return makeBinaryOp( EXPR_CONCAT, op1, op2 );
 }
 
 
@@ -908,7 +916,9 @@ Expr *makeSubstr( Expr *op1, Expr *op2, Expr *op3)
   TrinaryExpr *this = buildTrinaryExpr( op1, op2, op3 );
 
   // Fill in our function to create substring.
-  this->eval = evalSubstr;
+  this->eval = bufferEval;
+  this->evalTo = evalToSubstr;
+  this->kind = EXPR_SUBSTR;
 
   // Return the instance as if it's an Expr (which it sort of is)
   return (Expr *) this;
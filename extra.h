@@ -164,4 +164,25 @@ Expr *makeConcat( Expr *op1, Expr *op2);
  */
 Expr *makeSubstr( Expr *op1, Expr *op2, Expr *op3);
 
+
+/** Pick the evaluation functions for an add, sub, mul, div, equal, less or
+    concat node based on the kinds of its operands, so operands that
+    are just a variable or a literal are read in place.  The makers
+    above do this when they build the node, but anything that replaces
+    one of the node's operands later has to call this again.  For other
+    kinds of nodes, this does nothing.
+    @param expr node to choose evaluation functions for.
+ */
+void chooseOperandShape( Expr *expr );
+
+/** Append the value of an add, sub, mul, div, equal, less, concat or
+    substr node, given the values of its operands.  This is for an
+    evaluator that evaluates the operands itself.
+    @param kind kind of node.
+    @param ctxt context the node is evaluated in, for runtime errors.
+    @param ops values of the node's operands, in order.
+    @param dest buffer to append the value to.
+ */
+void writeOperator( ExprKind kind, Context *ctxt, Str const *ops, Buffer *dest );
+
  #endif
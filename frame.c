@@ -0,0 +1,84 @@
+// For read() and write().
+#define _POSIX_C_SOURCE 200809L
+
+#include "frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Size of a frame header, the type and the length.
+#define HEADER_SIZE 5
+
+/** Write all of the given bytes, retrying short writes. */
+static bool writeAll( int fd, char const *data, int len )
+{
+  while ( len > 0 ) {
+    ssize_t n = write( fd, data, len );
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+/** Read exactly the given number of bytes, retrying short reads. */
+static bool readAll( int fd, char *data, int len )
+{
+  while ( len > 0 ) {
+    ssize_t n = read( fd, data, len );
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool writeFrame( int fd, char type, char const *data, int len )
+{
+  unsigned char header[ HEADER_SIZE ] = {
+    type, len >> 24, len >> 16, len >> 8, len
+  };
+
+  // Small frames go out in one write with their header.
+  if ( len <= 256 ) {
+    char frame[ HEADER_SIZE + 256 ];
+    memcpy( frame, header, HEADER_SIZE );
+    memcpy( frame + HEADER_SIZE, data, len );
+    return writeAll( fd, frame, HEADER_SIZE + len );
+  }
+
+  return writeAll( fd, (char *) header, HEADER_SIZE ) &&
+    writeAll( fd, data, len );
+}
+
+bool readFrame( int fd, char *type, char **data, int *len )
+{
+  unsigned char header[ HEADER_SIZE ];
+  if ( !readAll( fd, (char *) header, HEADER_SIZE ) )
+    return false;
+
+  unsigned long size = (unsigned long) header[ 1 ] << 24 | header[ 2 ] << 16 |
+    header[ 3 ] << 8 | header[ 4 ];
+  if ( size > MAX_FRAME )
+    return false;
+
+  char *payload = (char *) malloc( size + 1 );
+  if ( !readAll( fd, payload, size ) ) {
+    free( payload );
+    return false;
+  }
+  payload[ size ] = '\0';
+
+  *type = header[ 0 ];
+  *data = payload;
+  *len = size;
+  return true;
+}
@@ -0,0 +1,55 @@
+/**
+  @file frame.h
+
+  Framing for the protocol between the interpreter's server mode and
+  its clients.  Every message is a sequence of frames, each one a type
+  character, a four-byte length in network byte order and then that
+  many bytes of payload.
+
+  A request is any number of variable frames, each one a name=value
+  setting, followed by a source frame holding the text of a program
+  or a path frame holding the name of a file to read it from.  The
+  response is any number of output and error frames, then a status
+  frame holding the program's exit status in decimal.  A client can
+  send another request on the same connection once it has the status.
+*/
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdbool.h>
+
+// Types of frames in a request.
+#define FRAME_VARIABLE 'D'
+#define FRAME_SOURCE 'S'
+#define FRAME_PATH 'P'
+
+// Types of frames in a response.
+#define FRAME_OUTPUT 'O'
+#define FRAME_ERROR 'E'
+#define FRAME_STATUS 'X'
+
+/** Largest payload we'll accept in a frame. */
+#define MAX_FRAME ( 1 << 30 )
+
+/** Send one frame.
+    @param fd socket to write the frame to.
+    @param type type of the frame.
+    @param data payload for the frame.
+    @param len number of bytes in the payload.
+    @return true if the whole frame was written.
+*/
+bool writeFrame( int fd, char type, char const *data, int len );
+
+/** Receive one frame.
+    @param fd socket to read the frame from.
+    @param type returns the type of the frame.
+    @param data returns the payload, in a new block of memory with a
+    null terminator after it.  The caller must free this.
+    @param len returns the number of bytes in the payload.
+    @return true if we got a whole frame, false at end of file, on a
+    read error or if the frame is too large.
+*/
+bool readFrame( int fd, char *type, char **data, int *len );
+
+#endif
@@ -0,0 +1,128 @@
+// For ucontext.
+#define _GNU_SOURCE
+
+#include "green.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ucontext.h>
+#include <sys/resource.h>
+
+// Size of the stack for each task if we can't tell how big a main
+// thread's stack would be.
+#define DEFAULT_STACK_SIZE ( 8 * 1024 * 1024 )
+
+/** State for one task. */
+typedef struct {
+  /** Where the task left off when it last yielded. */
+  ucontext_t context;
+
+  /** The task's stack, or NULL if it hasn't started or it's done. */
+  char *stack;
+
+  /** True once the task has returned. */
+  bool done;
+} Task;
+
+// Where the scheduler left off to let the current task run.  Each
+// thread can run a set of tasks of its own, so these are per thread.
+static __thread ucontext_t scheduler;
+
+// The task running now, or NULL if we're not in a task, and its number.
+static __thread Task *current = NULL;
+static __thread int currentIndex;
+
+// Function each task runs, and its argument.
+static __thread void (*taskFunction)( int index, void *arg );
+static __thread void *taskArg;
+
+/** Return the size of the stack for each task, the same as the main
+    thread would get, so a program can nest as deeply as it could
+    without --green.  This is just address space until a task actually
+    uses it, so it can be generous. */
+static size_t stackSize()
+{
+  struct rlimit limit;
+  if ( getrlimit( RLIMIT_STACK, &limit ) != 0 ||
+       limit.rlim_cur == RLIM_INFINITY )
+    return DEFAULT_STACK_SIZE;
+  return limit.rlim_cur;
+}
+
+/** Starting point for each task, which returns to the scheduler
+    once the task is done. */
+static void startTask()
+{
+  taskFunction( currentIndex, taskArg );
+  current->done = true;
+}
+
+/** Give the given task a turn, starting it if this is its first one.
+    @return false if we couldn't make a stack for the task.
+*/
+static bool resumeTask( Task *task, int index )
+{
+  if ( !task->stack ) {
+    size_t size = stackSize();
+    task->stack = (char *) malloc( size );
+    if ( !task->stack || getcontext( &task->context ) != 0 ) {
+      free( task->stack );
+      task->stack = NULL;
+      return false;
+    }
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = size;
+    task->context.uc_link = &scheduler;
+    makecontext( &task->context, startTask, 0 );
+  }
+
+  current = task;
+  currentIndex = index;
+  swapcontext( &scheduler, &task->context );
+  current = NULL;
+  return true;
+}
+
+void runTasks( int count, void (*task)( int index, void *arg ), void *arg,
+               long *turns )
+{
+  taskFunction = task;
+  taskArg = arg;
+
+  Task *tasks = (Task *) calloc( count, sizeof( Task ) );
+  if ( turns )
+    for ( int i = 0; i < count; i++ )
+      turns[ i ] = 0;
+
+  // Go around and around, giving each unfinished task a turn.
+  int live = count;
+  while ( live > 0 )
+    for ( int i = 0; i < count; i++ ) {
+      if ( tasks[ i ].done )
+        continue;
+
+      if ( turns )
+        turns[ i ]++;
+
+      // If we can't make a stack for a task, it can still run here,
+      // it just can't yield.
+      if ( !resumeTask( tasks + i, i ) ) {
+        task( i, arg );
+        tasks[ i ].done = true;
+      }
+
+      if ( tasks[ i ].done ) {
+        free( tasks[ i ].stack );
+        tasks[ i ].stack = NULL;
+        live--;
+      }
+    }
+
+  free( tasks );
+}
+
+void yieldTask()
+{
+  if ( current )
+    swapcontext( &current->context, &scheduler );
+}
@@ -0,0 +1,34 @@
+/**
+  @file green.h
+
+  Green threads, for interleaving lots of tasks on one thread.  Each
+  task runs on a stack of its own, so it can stop in the middle of
+  whatever it's doing (even deep inside the evaluator) when it calls
+  yieldTask(), and pick up right where it left off the next time it
+  gets a turn.  Tasks take turns in order, so as long as each one
+  yields after a fixed amount of work, they all get an equal share.
+*/
+
+#ifndef _GREEN_H_
+#define _GREEN_H_
+
+/** Run a set of tasks interleaved on the calling thread, returning
+    once they've all finished.  The first task runs until it yields,
+    then the next unfinished one, and so on around and around.
+    @param count number of tasks, numbered from 0 to count - 1.
+    @param task function to run a task, called with the task's number
+    and arg.
+    @param arg value passed to every call to task.
+    @param turns if this isn't NULL, it's filled in with the number of
+    turns each task got.
+*/
+void runTasks( int count, void (*task)( int index, void *arg ), void *arg,
+               long *turns );
+
+/** Give up the rest of the current task's turn, letting the next task
+    run.  This returns when it's the current task's turn again.  It
+    does nothing if it's not called from inside a task.
+*/
+void yieldTask();
+
+#endif
@@ -1,17 +1,71 @@
+// For open_memstream().
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <setjmp.h>
 
 #include "core.h"
 #include "basic.h"
 #include "extra.h"
+#include "optimize.h"
+#include "pool.h"
+#include "number.h"
+#include "output.h"
+#include "workers.h"
+#include "server.h"
+#include "green.h"
+#include "walk.h"
 
-/** Print a usage message then exit unsuccessfully. */
+/** Print a usage message then exit unsuccessfully.  Options that
+    can come before the program file are:
+      --opt-report  print a summary of what the optimizer did to stderr
+      --memo        remember the values of pure subexpressions in loops
+      --profile     print memo hit and miss counts to stderr after running
+      --dump-ast    print the optimized expression tree to stderr
+      --pool-stats  print string allocation counts to stderr after running
+      --async-output  write the program's output from a separate thread
+      --batch       run all the program files that follow (or the ones
+                    listed in an @manifest file) in parallel, with the
+                    output and errors for each one going to file.out
+                    and file.err, then print each program's exit status
+      -D name=value set the variable name to value before the program
+                    starts
+      --sweep file  parse the program once, then run one instance of it
+                    for each line of the given file in parallel.  Each
+                    line is a list of -D name=value settings for that
+                    instance.  The output and errors from the instances
+                    are printed in the same order as the lines.
+      --green       like --batch, but run the programs interleaved on
+                    one thread, each taking a turn of so many steps
+                    (trips through a loop) before the next one runs.
+                    The status for each program is followed by the
+                    number of steps it took and the turns it got.
+      --quantum n   number of steps in each turn for --green
+      --no-opt      run the program just as it was parsed, without
+                    optimizing it
+      --iterative   like --no-opt, but run (and free) the program
+                    without recursion, so it can be nested as deeply
+                    as memory allows
+      --parse-threads n  number of threads for parsing large programs
+                    (at least a megabyte), split into chunks between
+                    their top-level statements.  The default is one
+                    for each core.
+      --serve path  serve requests to run programs on a Unix socket at
+                    the given path, keeping recently used programs so
+                    they don't have to be parsed again (see frame.h)
+*/
 void usage()
 {
-  fprintf( stderr, "usage: interpreter <program-file>\n" );
+  fprintf( stderr,
+           "usage: interpreter [options] <program-file>\n"
+           "       interpreter --sweep <settings-file> [options] <program-file>\n"
+           "       interpreter --batch|--green [options] <program-file|@manifest>...\n"
+           "       interpreter --serve <socket>\n"
+           "options: --opt-report --memo --profile --dump-ast --pool-stats --async-output\n"
+           "         -D name=value --quantum n --no-opt --iterative --parse-threads n\n" );
   exit( EXIT_FAILURE );
 }
 
@@ -27,39 +81,128 @@ void usage()
 // Maximum variable length
 #define MAX_VAR 20
 
+/** Return true if the given string is a legal variable name. */
+static bool isVariableName( char const *name )
+{
+  return isalpha( name[ 0 ] ) && strlen( name ) <= MAX_VAR &&
+    !strchr( name, LEFT_BRACKET ) && !strchr( name, RIGHT_BRACKET ) &&
+    !strchr( name, POUND );
+}
+
 /** Called when we expect another token on the input.  This 
     function parses the token and exits with an error if there isn't one.
     @param storage for the next token, with capacity for at least MAX_TOKEN characters.
     This buffer may be modified by the parse function as it reads additional tokens.
-    @param fp file tokens should be read from.
+    @param src source tokens should be read from.
     @return a copy of the pointer to the tok buffer, so this function can be used as a
     parameter to other parsing calls.
 */
-char *expectToken( char *tok, FILE *fp )
+char *expectToken( char *tok, Source *src )
 {
-  if ( !nextToken( tok, fp ) ) {
-    fprintf( stderr, "line %d: token expected\n", linesRead() );
-    exit( EXIT_FAILURE );
-  }
+  if ( !nextToken( tok, src ) )
+    syntaxError( src, "token expected" );
 
   return tok;
 }
 
-/** Parse with one token worth of look-ahead, return the expression object representing
-    the syntax parsed.
-    @param tok next token from the input.
-    @param fp file subsequent tokens are being read from.
-    @return the expression object constructed from the input.
+// Initial capacity for the parser's stack of unfinished expressions.
+#define INITIAL_PENDING 64
+
+/** An operator in the language, with its name, the number of operands
+    it takes and the function that makes it, whichever one matches its
+    number of operands.  Set is different, with a variable name before
+    its one operand, so it doesn't have a function here. */
+typedef struct {
+  char const *name;
+  int arity;
+  Expr *(*make1)( Expr *op );
+  Expr *(*make2)( Expr *op1, Expr *op2 );
+  Expr *(*make3)( Expr *op1, Expr *op2, Expr *op3 );
+} Operator;
+
+// All the operators (reserved words).
+static Operator const operators[] = {
+  { "print", 1, makePrint, NULL, NULL },
+  { "set", 1, NULL, NULL, NULL },
+  { "add", 2, NULL, makeAdd, NULL },
+  { "sub", 2, NULL, makeSub, NULL },
+  { "mul", 2, NULL, makeMul, NULL },
+  { "div", 2, NULL, makeDiv, NULL },
+  { "equal", 2, NULL, makeEqual, NULL },
+  { "less", 2, NULL, makeLess, NULL },
+  { "not", 1, makeNot, NULL, NULL },
+  { "and", 2, NULL, makeAnd, NULL },
+  { "or", 2, NULL, makeOr, NULL },
+  { "if", 2, NULL, makeIf, NULL },
+  { "while", 2, NULL, makeWhile, NULL },
+  { "concat", 2, NULL, makeConcat, NULL },
+  { "substr", 3, NULL, NULL, makeSubstr },
+};
+
+/** An operator or compound expression we've seen the start of, that's
+    still waiting for some of its operands. */
+typedef struct {
+  /** The operator, or NULL for a compound expression. */
+  Operator const *op;
+
+  /** Operands we've parsed so far, and how many there are. */
+  Expr *args[ 3 ];
+  int len;
+
+  /** For a compound expression, its subexpressions so far, and the
+      capacity of the list. */
+  Expr **eList;
+  int cap;
+
+  /** For set, the name of the variable. */
+  char *name;
+} Pending;
+
+/** Stack of unfinished expressions, innermost on top. */
+typedef struct {
+  Pending *list;
+  int depth;
+  int cap;
+} PendingStack;
+
+/** Free all the unfinished expressions on the stack, along with the
+    operands they've collected, then the stack itself. */
+static void freePending( PendingStack *stack )
+{
+  for ( int i = 0; i < stack->depth; i++ ) {
+    Pending *p = stack->list + i;
+    for ( int j = 0; j < p->len; j++ )
+      destroyProgram( p->op ? p->args[ j ] : p->eList[ j ] );
+    free( p->eList );
+    free( p->name );
+  }
+  free( stack->list );
+  free( stack );
+}
+
+/** Return the operator for the given reserved word, or NULL if it
+    isn't one. */
+static Operator const *findOperator( char const *tok )
+{
+  for ( int i = 0; i < sizeof( operators ) / sizeof( operators[ 0 ] ); i++ )
+    if ( strcmp( tok, operators[ i ].name ) == 0 )
+      return operators + i;
+  return NULL;
+}
+
+/** Make an expression for a token that's a whole expression by itself:
+    a number, a quoted string or a variable.  Reserved words should
+    already have been ruled out.
+    @return the expression, or NULL if the token isn't one of these.
 */
-Expr *parse( char *tok, FILE *fp )
+static Expr *parseLeaf( char const *tok )
 {
   // Create a literal token for anything that looks like a number.
   {
     long dummy;
-    int pos;
+    char const *end;
     // See if the whole token parses as a long int.
-    if ( sscanf( tok, "%ld%n", &dummy, &pos ) == 1 &&
-         pos == strlen( tok ) ) {
+    if ( scanNumber( tok, &dummy, &end ) && *end == '\0' ) {
       // Copy the literal to a dynamically allocated string, since makeLiteral wants
       // a string it can keep.
       char *str = (char *) malloc( strlen( tok ) + 1 );
@@ -78,208 +221,1180 @@ Expr *parse( char *tok, FILE *fp )
     return makeLiteral( str );
   }
 
-  // Handle compound statements
-  if ( strcmp( tok, "{" ) == 0 ) {
-    int len = 0;
-    int cap = INITIAL_CAPACITY;
-    Expr **eList = (Expr **) malloc( cap * sizeof( Expr * ) );
-
-    // Keep parsing subexpressions until we hit the closing curly bracket.
-    while ( strcmp( expectToken( tok, fp ), "}" ) != 0 ) {
-      if ( len >= cap )
-        eList = (Expr **) realloc( eList, ( cap *= 2 ) * sizeof( Expr * ) );
-      eList[ len++ ] = parse( tok, fp );
+  // Handle variables
+  if ( isVariableName( tok ) )
+    return makeVariable( tok );
+
+  return NULL;
+}
+
+/** Parse with one token worth of look-ahead, return the expression object representing
+    the syntax parsed.  This doesn't recurse for subexpressions.  Each
+    operator or compound expression is pushed on a stack until its
+    operands have all been parsed, then it's made and popped, so
+    expressions can be nested as deeply as memory allows.
+    @param tok next token from the input.
+    @param src source subsequent tokens are being read from.
+    @return the expression object constructed from the input.
+*/
+Expr *parse( char *tok, Source *src )
+{
+  // The stack is on the heap, with just a pointer here, so it's still
+  // good if we come back here after a syntax error.
+  PendingStack *stack = (PendingStack *) malloc( sizeof( PendingStack ) );
+  stack->cap = INITIAL_PENDING;
+  stack->list = (Pending *) malloc( stack->cap * sizeof( Pending ) );
+  stack->depth = 0;
+
+  // On a syntax error, free everything we've parsed so far, then go
+  // wherever the error would have gone without us.
+  jmp_buf *outer = src->onError;
+  jmp_buf onError;
+  if ( setjmp( onError ) ) {
+    freePending( stack );
+    src->onError = outer;
+    if ( !outer )
+      exit( EXIT_FAILURE );
+    longjmp( *outer, 1 );
+  }
+  src->onError = &onError;
+
+  while ( true ) {
+    // Shift: tok starts an expression.  Either it's a whole expression
+    // or it starts one that needs operands.
+    Operator const *op = findOperator( tok );
+    Expr *expr = op || strcmp( tok, "{" ) == 0 ? NULL : parseLeaf( tok );
+    if ( !expr ) {
+      if ( !op && strcmp( tok, "{" ) != 0 ) {
+        // Complain if we can't make sense of the token.
+        syntaxError( src, "invalid token \"%s\"", tok );
+      }
+
+      if ( stack->depth >= stack->cap )
+        stack->list = (Pending *) realloc( stack->list, ( stack->cap *= 2 ) *
+                                           sizeof( Pending ) );
+      Pending *p = stack->list + stack->depth++;
+      p->op = op;
+      p->len = 0;
+      p->eList = NULL;
+      p->name = NULL;
+
+      if ( !op ) {
+        // A compound has to have at least one subexpression.
+        p->cap = INITIAL_CAPACITY;
+        p->eList = (Expr **) malloc( p->cap * sizeof( Expr * ) );
+        if ( strcmp( expectToken( tok, src ), "}" ) == 0 )
+          syntaxError( src, "empty compound expression" );
+      } else if ( strcmp( op->name, "set" ) == 0 ) {
+        // Set starts with the variable name.
+        expectToken( tok, src );
+        p->name = strcpy( (char *) malloc( strlen( tok ) + 1 ), tok );
+        if ( !isVariableName( p->name ) ) {
+          // Complain if we can't make sense of the variable.
+          syntaxError( src, "invalid variable name \"%s\"", p->name );
+        }
+        expectToken( tok, src );
+      } else
+        expectToken( tok, src );
+      continue;
+    }
+
+    // Reduce: give the finished expression to the one waiting for it,
+    // finishing that one too if this was its last operand.
+    while ( stack->depth > 0 ) {
+      Pending *p = stack->list + stack->depth - 1;
+      if ( !p->op ) {
+        // Keep parsing subexpressions until we hit the closing curly bracket.
+        if ( p->len >= p->cap )
+          p->eList = (Expr **) realloc( p->eList, ( p->cap *= 2 ) *
+                                        sizeof( Expr * ) );
+        p->eList[ p->len++ ] = expr;
+        if ( strcmp( expectToken( tok, src ), "}" ) != 0 )
+          break;
+        expr = makeCompound( p->eList, p->len );
+      } else {
+        p->args[ p->len++ ] = expr;
+        if ( p->len < p->op->arity ) {
+          expectToken( tok, src );
+          break;
+        }
+
+        if ( p->name )
+          expr = makeSet( p->name, p->args[ 0 ] );
+        else if ( p->op->arity == 1 )
+          expr = p->op->make1( p->args[ 0 ] );
+        else if ( p->op->arity == 2 )
+          expr = p->op->make2( p->args[ 0 ], p->args[ 1 ] );
+        else
+          expr = p->op->make3( p->args[ 0 ], p->args[ 1 ], p->args[ 2 ] );
+        free( p->name );
+      }
+      stack->depth--;
     }
 
-    return makeCompound( eList, len );
+    // If nothing was waiting for it, this is the whole expression.
+    if ( stack->depth == 0 ) {
+      src->onError = outer;
+      free( stack->list );
+      free( stack );
+      return expr;
+    }
   }
+}
+
+/** A variable to set before a program starts, from -D name=value. */
+typedef struct {
+  char *name;
+  char *value;
+} Param;
+
+/** A resizable list of parameters. */
+typedef struct {
+  Param *list;
+  int count;
+  int cap;
+} ParamList;
+
+/** Settings from the command-line options, for running each program. */
+typedef struct {
+  bool optReport;
+  bool profile;
+  bool dumpAst;
+  bool poolStats;
+  OptOptions options;
+
+  /** Variables to set before every program starts. */
+  ParamList params;
+
+  /** Steps each program takes before letting the next one have a
+      turn, or zero if programs just run to completion. */
+  long quantum;
+
+  /** True if programs aren't optimized, and true if they're run with
+      the non-recursive evaluator, which also means they aren't
+      optimized. */
+  bool noOpt;
+  bool iterative;
+
+  /** Threads for parsing large programs. */
+  int parseThreads;
+} Settings;
 
-  // Handle language operators (reserved words)
+// Default number of steps in each turn for --green.
+#define DEFAULT_QUANTUM 10000
 
-  if ( strcmp( tok, "print" ) == 0 ) {
-    // Parse the one argument to print, and create a print expression.
-    Expr *arg = parse( expectToken( tok, fp ), fp );
-    return makePrint( arg );
+/** Add a parameter to a list, if it's a legal name=value setting.
+    @param params list to add the parameter to.
+    @param text parameter from the command line or a parameter file.
+    @return true if the parameter was legal.
+*/
+static bool addParam( ParamList *params, char const *text )
+{
+  char const *eq = strchr( text, '=' );
+  if ( !eq || eq - text > MAX_VAR )
+    return false;
+
+  char name[ MAX_VAR + 1 ];
+  memcpy( name, text, eq - text );
+  name[ eq - text ] = '\0';
+  if ( !isVariableName( name ) )
+    return false;
+
+  if ( params->count >= params->cap ) {
+    params->cap = params->cap ? params->cap * 2 : INITIAL_CAPACITY;
+    params->list = (Param *) realloc( params->list,
+                                      params->cap * sizeof( Param ) );
   }
-  
-  
-  if ( strcmp( tok, "set" ) == 0 ) {
-    // Parse the two operands, then make a set expression with them.
-    char *str = expectToken( tok, fp );
-    int len = strlen( str );
-    char *name = (char *) malloc( len + 1 );
-    strcpy( name, str );
-    name[ len ] = '\0';
-    if ( !isalpha(name[0]) || strlen( name ) > MAX_VAR || strchr( name, LEFT_BRACKET ) || strchr( name, RIGHT_BRACKET ) || strchr( name, POUND ) ) {
-      // Complain if we can't make sense of the variable.
-      fprintf( stderr, "line %d: invalid variable name \"%s\"\n", linesRead(), name );
-      exit( EXIT_FAILURE );
-    }
-    Expr *expr = parse( expectToken( tok, fp ), fp );
-    Expr *set = makeSet
-    ( name, expr );
-    free(name);
-    return set;
-  }
-  
-  if ( strcmp( tok, "add" ) == 0 ) {
-    // Parse the two operands, then make an add expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeAdd( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "sub" ) == 0 ) {
-    // Parse the two operands, then make a sub expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeSub( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "mul" ) == 0 ) {
-    // Parse the two operands, then make a mul expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeMul( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "div" ) == 0 ) {
-    // Parse the two operands, then make a div expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeDiv
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "equal" ) == 0 ) {
-    // Parse the two operands, then make an equal expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeEqual
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "less" ) == 0 ) {
-    // Parse the two operands, then make a less expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeLess
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "not" ) == 0 ) {
-    // Parse the operand, then make a not expression with it.
-    Expr *op = parse( expectToken( tok, fp ), fp );
-    return makeNot
-    ( op );
-  }
-  
-  if ( strcmp( tok, "and" ) == 0 ) {
-    // Parse the two operands, then make an and expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeAnd
-    ( op1, op2 );
-  }
-      
-  if ( strcmp( tok, "or" ) == 0 ) {
-    // Parse the two operands, then make an or expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeOr
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "if" ) == 0 ) {
-    // Parse the two operands, then make an if expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeIf
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "while" ) == 0 ) {
-    // Parse the two operands, then make a while expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeWhile
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "concat" ) == 0 ) {
-    // Parse the two operands, then make a concatenation expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    return makeConcat
-    ( op1, op2 );
-  }
-  
-  if ( strcmp( tok, "substr" ) == 0 ) {
-    // Parse the three operands, then make a substring expression with them.
-    Expr *op1 = parse( expectToken( tok, fp ), fp );
-    Expr *op2 = parse( expectToken( tok, fp ), fp );
-    Expr *op3 = parse( expectToken( tok, fp ), fp );
-    return makeSubstr
-    ( op1, op2, op3 );
-  }
-
-  
-  // Handle variables
-  if ( isalpha(tok[0]) && strlen( tok ) <= MAX_VAR && !strchr( tok, LEFT_BRACKET ) && !strchr( tok, RIGHT_BRACKET ) && !strchr( tok, POUND ) ) {
-    // Parse the variable name and make a variable expression.
-    char *str = tok;
-    int len = strlen( str );
-    char *name = (char *) malloc( len + 1 );
-    strcpy( name, str );
-    name[ len ] = '\0';
-    Expr *var = makeVariable( name );
-    free(name);
-    return var;
-  }
-  
-  // Complain if we can't make sense of the token.
-  fprintf( stderr, "line %d: invalid token \"%s\"\n", linesRead(), tok );
-  exit( EXIT_FAILURE );
-  
-  // Never reached.
-  return NULL;
+  Param *p = params->list + params->count++;
+  p->name = strcpy( (char *) malloc( strlen( name ) + 1 ), name );
+  p->value = strcpy( (char *) malloc( strlen( eq + 1 ) + 1 ), eq + 1 );
+  return true;
 }
 
-int main( int argc, char *argv[] )
+/** Free the memory for a list of parameters. */
+static void freeParams( ParamList *params )
 {
-  // Open the program's source.
-  if ( argc != 2 )
-    usage();
-  FILE *fp = fopen( argv[ 1 ], "r" );
-  if ( !fp ) {
-    fprintf( stderr, "Can't open file: %s\n", argv[ 1 ] );
-    usage();
+  for ( int i = 0; i < params->count; i++ ) {
+    free( params->list[ i ].name );
+    free( params->list[ i ].value );
   }
+  free( params->list );
+}
+
+/** Parse a whole program from a source, one token after another.
+    @param src source to read the program from.
+    @return the program, or NULL if it had a syntax error.
+*/
+static Expr *parseSerial( Source *src )
+{
+  // Syntax errors come back here.
+  jmp_buf onError;
+  if ( setjmp( onError ) )
+    return NULL;
 
   // Parse the whole program source into an expression object.
   // The parser uses a one-token lookahead to help parsing compound expressions.
+  src->onError = &onError;
   char tok[ MAX_TOKEN + 1 ];
-  Expr *expr = parse( expectToken( tok, fp ), fp );
-  
+  Expr *expr = parse( expectToken( tok, src ), src );
+
   // If this is a legal input, there shouldn't be any extra tokens at the end.
-  if ( nextToken( tok, fp ) ) {
-    fprintf( stderr, "line %d: unexpected token \"%s\"\n", linesRead(), tok );
-    exit( EXIT_FAILURE );
+  if ( nextToken( tok, src ) ) {
+    destroyProgram( expr );
+    syntaxError( src, "unexpected token \"%s\"", tok );
   }
 
-  fclose( fp );
+  return expr;
+}
+
+// Sources at least this long are parsed in parallel, if we have more
+// than one thread for it.
+#define PARALLEL_SIZE ( 1024 * 1024 )
+
+// Smallest chunk of source worth parsing on its own, and the number of
+// chunks to aim for for each thread, so a thread that gets through its
+// chunks quickly can help with the rest.
+#define MIN_CHUNK ( 64 * 1024 )
+#define CHUNKS_PER_THREAD 4
+
+/** A piece of a program's source made of whole statements from its
+    top-level compound expression. */
+typedef struct {
+  /** Offset of the piece in the source, and its length. */
+  long start;
+  long len;
+
+  /** Line the piece starts on. */
+  int line;
+} Chunk;
+
+/** Find the end of the token starting at the given offset, the same
+    way nextToken() would.
+    @return offset just past the token, or -1 if it's a string that
+    doesn't end on the same line.
+*/
+static long skipToken( char const *text, long len, long pos )
+{
+  char ch = text[ pos++ ];
+  if ( ch == '{' || ch == '}' )
+    return pos;
+
+  if ( ch != '"' ) {
+    while ( pos < len && !isspace( (unsigned char) text[ pos ] ) &&
+            text[ pos ] != '{' && text[ pos ] != '}' && text[ pos ] != '"' &&
+            text[ pos ] != '#' )
+      pos++;
+    return pos;
+  }
+
+  // Find the close quote, skipping escaped characters.  Bad escapes
+  // are left for the tokenizer to report.
+  bool escape = false;
+  while ( pos < len && text[ pos ] != '\n' && ( text[ pos ] != '"' || escape ) ) {
+    escape = !escape && text[ pos ] == '\\';
+    pos++;
+  }
+  if ( pos >= len || text[ pos ] == '\n' )
+    return -1;
+  return pos + 1;
+}
+
+/** Return the number of operands taken by the operator spelled by the
+    given word, or zero if it isn't an operator.  The variable name
+    for set counts as one of its operands. */
+static int wordArity( char const *word, long len )
+{
+  char name[ 8 ];
+  if ( len >= sizeof( name ) )
+    return 0;
+  memcpy( name, word, len );
+  name[ len ] = '\0';
+
+  Operator const *op = findOperator( name );
+  if ( !op )
+    return 0;
+  return strcmp( op->name, "set" ) == 0 ? 2 : op->arity;
+}
+
+/** Add a chunk to a list of chunks, growing the list if needed. */
+static void addChunk( Chunk **chunks, int *count, int *cap, long start,
+                      long end, int line )
+{
+  if ( *count >= *cap )
+    *chunks = (Chunk *) realloc( *chunks, ( *cap *= 2 ) * sizeof( Chunk ) );
+  ( *chunks )[ ( *count )++ ] = (Chunk) { start, end - start, line };
+}
+
+/** Split a program's source into chunks of at least the given size,
+    each holding whole statements from the program's top-level
+    compound expression.  This is a quick scan that just finds tokens
+    and counts operands, so it gives up on anything unusual, like a
+    source that isn't one compound expression or one with an error
+    the scan can see.  Then the source should just be parsed the
+    usual way, which will report any error.
+    @param text the program's source.
+    @param len length of the source.
+    @param size smallest size for a chunk, except for the last one.
+    @param count returns the number of chunks.
+    @return a list of the chunks, or NULL if the source can't be split.
+*/
+static Chunk *splitSource( char const *text, long len, long size, int *count )
+{
+  int cap = INITIAL_CAPACITY;
+  Chunk *chunks = (Chunk *) malloc( cap * sizeof( Chunk ) );
+  *count = 0;
+
+  // Where we are, the line we're on and how deeply nested in curly
+  // brackets.
+  long pos = 0;
+  int line = 1;
+  int depth = 0;
+
+  // Operands still needed to finish the current top-level statement,
+  // and whether the next token is the variable name for a set.
+  int need = 0;
+  bool name = false;
+
+  // Start of the chunk we're working on, its line, and whether it has
+  // any whole statements yet.
+  long start = 0;
+  int startLine = 0;
+  bool any = false;
+
+  // True once we've seen the end of the top-level compound.
+  bool done = false;
+
+  while ( true ) {
+    // Skip whitespace and comments.
+    while ( pos < len &&
+            ( isspace( (unsigned char) text[ pos ] ) || text[ pos ] == '#' ) ) {
+      if ( text[ pos ] == '#' )
+        while ( pos < len && text[ pos ] != '\n' )
+          pos++;
+      if ( pos < len && text[ pos++ ] == '\n' )
+        line++;
+    }
+    if ( pos >= len )
+      break;
+
+    // Anything after the top-level compound is an error, and so is a
+    // string that doesn't end.
+    char ch = text[ pos ];
+    long end = skipToken( text, len, pos );
+    if ( end < 0 || done || ( depth == 0 && ch != '{' ) ) {
+      free( chunks );
+      return NULL;
+    }
+
+    if ( depth == 0 ) {
+      // The open curly bracket for the top-level compound.
+      depth = 1;
+      start = end;
+      startLine = line;
+    } else if ( depth > 1 ) {
+      // Inside a compound operand, we just have to find its end.
+      if ( ch == '{' )
+        depth++;
+      else if ( ch == '}' && --depth == 1 )
+        need--;
+    } else if ( name ) {
+      // A variable name, whatever it looks like.
+      name = false;
+      need--;
+    } else if ( ch == '}' ) {
+      // The end of the top-level compound, which can't be in the
+      // middle of a statement or right after the start.
+      if ( need > 0 || ( *count == 0 && !any ) ) {
+        free( chunks );
+        return NULL;
+      }
+      if ( any )
+        addChunk( &chunks, count, &cap, start, pos, startLine );
+      done = true;
+    } else {
+      // Another token in a top-level statement, maybe the first one.
+      if ( need == 0 )
+        need = 1;
+      if ( ch == '{' )
+        depth = 2;
+      else {
+        int arity = wordArity( text + pos, end - pos );
+        need += arity - 1;
+        name = arity > 0 && end - pos == 3 &&
+          strncmp( text + pos, "set", 3 ) == 0;
+      }
+    }
+    pos = end;
+
+    // At the end of a top-level statement, end the chunk if it's big
+    // enough.
+    if ( depth == 1 && need == 0 && !done && pos > start ) {
+      any = true;
+      if ( pos - start >= size ) {
+        addChunk( &chunks, count, &cap, start, pos, startLine );
+        start = pos;
+        startLine = line;
+        any = false;
+      }
+    }
+  }
+
+  // We have to have seen the whole compound.
+  if ( !done ) {
+    free( chunks );
+    return NULL;
+  }
+  return chunks;
+}
+
+/** Results from parsing one chunk of a program. */
+typedef struct {
+  /** Statements parsed from the chunk. */
+  Expr **eList;
+  int len;
+
+  /** Syntax error message from the chunk, if there was one. */
+  char *error;
+  size_t errorLen;
+  bool failed;
+} ChunkResult;
+
+/** A program being parsed in parallel. */
+typedef struct {
+  char const *text;
+  Chunk const *chunks;
+  ChunkResult *results;
+} ParallelParse;
+
+/** Job for parsing one chunk of a program on a worker. */
+static void parseChunk( int index, void *arg )
+{
+  ParallelParse *pp = arg;
+  Chunk const *chunk = pp->chunks + index;
+  ChunkResult *result = pp->results + index;
+
+  FILE *err = open_memstream( &result->error, &result->errorLen );
+
+  int cap = INITIAL_CAPACITY;
+  result->eList = (Expr **) malloc( cap * sizeof( Expr * ) );
+  result->len = 0;
+
+  // The tokenizer counts lines from the start of the chunk.
+  Source src;
+  initTextSource( &src, pp->text + chunk->start, chunk->len, err );
+  src.line = chunk->line;
+  jmp_buf onError;
+  src.onError = &onError;
+  if ( setjmp( onError ) == 0 ) {
+    char tok[ MAX_TOKEN + 1 ];
+    while ( nextToken( tok, &src ) ) {
+      if ( result->len >= cap )
+        result->eList = (Expr **) realloc( result->eList, ( cap *= 2 ) *
+                                           sizeof( Expr * ) );
+      Expr *stmt = parse( tok, &src );
+      result->eList[ result->len++ ] = stmt;
+    }
+  } else
+    result->failed = true;
+
+  fclose( err );
+}
+
+/** Parse a program's source in chunks, in parallel, then put the
+    statements from all the chunks together in one compound
+    expression.  A syntax error is reported as if the source had been
+    parsed in order, since it's from the first chunk that has one.
+    @param text the program's source.
+    @param len length of the source.
+    @param workers number of threads to use.
+    @param err stream for a syntax error.
+    @param fallback set to true if the source couldn't be split, so it
+    still has to be parsed.
+    @return the program, or NULL if it had a syntax error or couldn't
+    be split.
+*/
+static Expr *parseParallel( char const *text, long len, int workers,
+                            FILE *err, bool *fallback )
+{
+  long size = len / ( workers * CHUNKS_PER_THREAD );
+  int count;
+  Chunk *chunks = splitSource( text, len, size > MIN_CHUNK ? size : MIN_CHUNK,
+                               &count );
+  *fallback = !chunks;
+  if ( !chunks )
+    return NULL;
+
+  ChunkResult *results = (ChunkResult *) calloc( count, sizeof( ChunkResult ) );
+  ParallelParse pp = { text, chunks, results };
+  runJobs( count, workers, parseChunk, &pp );
+
+  int total = 0;
+  int failed = -1;
+  for ( int i = 0; i < count; i++ ) {
+    total += results[ i ].len;
+    if ( results[ i ].failed && failed < 0 )
+      failed = i;
+  }
+
+  Expr *expr = NULL;
+  if ( failed >= 0 ) {
+    // Report the first error, then throw away everything we parsed.
+    fwrite( results[ failed ].error, 1, results[ failed ].errorLen, err );
+    for ( int i = 0; i < count; i++ )
+      for ( int j = 0; j < results[ i ].len; j++ )
+        destroyProgram( results[ i ].eList[ j ] );
+  } else {
+    Expr **eList = (Expr **) malloc( total * sizeof( Expr * ) );
+    int len = 0;
+    for ( int i = 0; i < count; i++ )
+      for ( int j = 0; j < results[ i ].len; j++ )
+        eList[ len++ ] = results[ i ].eList[ j ];
+    expr = makeCompound( eList, len );
+  }
+
+  for ( int i = 0; i < count; i++ ) {
+    free( results[ i ].eList );
+    free( results[ i ].error );
+  }
+  free( results );
+  free( chunks );
+  return expr;
+}
+
+/** Parse a whole program from a file.  A large source is read into
+    memory and parsed in parallel, if we have more than one thread for
+    it.
+    @param fp file to read the program from.
+    @param err stream for a syntax error.
+    @param threads number of threads to use.
+    @return the program, or NULL if it had a syntax error.
+*/
+static Expr *parseProgram( FILE *fp, FILE *err, int threads )
+{
+  // See how much is left to read, if we can tell.
+  long start = ftell( fp );
+  long end = -1;
+  if ( start >= 0 && fseek( fp, 0, SEEK_END ) == 0 ) {
+    end = ftell( fp );
+    fseek( fp, start, SEEK_SET );
+  }
+  Source src;
+  if ( end - start < PARALLEL_SIZE || threads < 2 ) {
+    initSource( &src, fp, err );
+    return parseSerial( &src );
+  }
+
+  long len = end - start;
+  char *text = (char *) malloc( len );
+  len = fread( text, 1, len, fp );
+
+  bool fallback;
+  Expr *expr = parseParallel( text, len, threads, err, &fallback );
+  if ( fallback ) {
+    initTextSource( &src, text, len, err );
+    expr = parseSerial( &src );
+  }
+
+  free( text );
+  return expr;
+}
+
+/** Parse and optimize a program.  A syntax error is reported to err.
+    @param fp file to read the program from.
+    @param err stream for error messages and reports.
+    @param settings options for building the program.
+    @param params variables that may be set before the program starts,
+    in addition to the ones in settings, or NULL if there aren't any.
+    @return the optimized program, or NULL if it had a syntax error.
+*/
+static Expr *buildProgram( FILE *fp, FILE *err, Settings const *settings,
+                           ParamList const *params )
+{
+  Expr *expr = parseProgram( fp, err, settings->parseThreads );
+  if ( !expr )
+    return NULL;
+
+  if ( settings->noOpt || settings->iterative ) {
+    if ( settings->dumpAst )
+      dumpExpr( expr, err );
+    return expr;
+  }
+
+  // Rewrite the program into something faster to evaluate.  The
+  // optimizer can't assume parameters start out empty.
+  OptOptions options = settings->options;
+  int count = 0;
+  char const **inputs = (char const **)
+    malloc( ( settings->params.count + ( params ? params->count : 0 ) + 1 ) *
+            sizeof( char * ) );
+  for ( int i = 0; i < settings->params.count; i++ )
+    inputs[ count++ ] = settings->params.list[ i ].name;
+  for ( int i = 0; params && i < params->count; i++ )
+    inputs[ count++ ] = params->list[ i ].name;
+  options.inputs = inputs;
+  options.inputCount = count;
+
+  OptReport report;
+  expr = optimize( expr, &options, &report );
+  free( inputs );
+  if ( settings->optReport )
+    printOptReport( &report, err );
+  if ( settings->dumpAst )
+    dumpExpr( expr, err );
+
+  return expr;
+}
+
+/** Step hook for programs running as green threads, letting the next
+    program have a turn. */
+static void yieldStep( Context *ctxt )
+{
+  yieldTask();
+}
 
-  // Run the program.
+/** Run an optimized program in a context of its own.  This doesn't
+    change the program, so several threads can run the same one at
+    once, as long as it has no memo nodes.
+    @param expr program to run.
+    @param out stream for the program's output.
+    @param err stream for error messages and reports.
+    @param settings options for running the program.
+    @param params variables to set before the program starts, in
+    addition to the ones in settings, or NULL if there aren't any.
+    @param steps if this isn't NULL, it returns the number of steps the
+    program took.  These are only counted if settings has a quantum.
+    @return exit status for the program.
+*/
+static int execProgram( Expr *expr, FILE *out, FILE *err,
+                        Settings const *settings, ParamList const *params,
+                        long *steps )
+{
   Context *ctxt = makeContext();
-  char *result = expr->eval( expr, ctxt );
+  setContextStreams( ctxt, out, err );
+  jmp_buf onRuntimeError;
+  setErrorHandler( ctxt, &onRuntimeError );
+  if ( settings->quantum )
+    setStepHook( ctxt, settings->quantum, yieldStep );
+
+  for ( int i = 0; i < settings->params.count; i++ )
+    setVariable( ctxt, settings->params.list[ i ].name,
+                 settings->params.list[ i ].value );
+  for ( int i = 0; params && i < params->count; i++ )
+    setVariable( ctxt, params->list[ i ].name, params->list[ i ].value );
 
-  // Everything evaluates to a dynamically allocated string, but we don't
-  // do anything with the one out of the top-level expression.
-  free( result );
+  // We don't do anything with the value of the top-level expression,
+  // so we just execute it.
+  int status = EXIT_SUCCESS;
+  if ( setjmp( onRuntimeError ) == 0 ) {
+    if ( settings->iterative )
+      walkProgram( expr, ctxt );
+    else
+      expr->exec( expr, ctxt );
+    if ( settings->profile )
+      printProfile( expr, err );
+    if ( settings->poolStats )
+      printPoolStats( err );
+  } else
+    status = EXIT_FAILURE;
 
-  // We're done, free everything.
+  if ( steps )
+    *steps = contextSteps( ctxt );
   freeContext( ctxt );
-  expr->destroy( expr );
+  return status;
+}
+
+/** Free a program built by buildProgram(). */
+static void freeProgram( Expr *expr, Settings const *settings )
+{
+  if ( settings->iterative )
+    destroyProgram( expr );
+  else
+    expr->destroy( expr );
+}
+
+/** Parse, optimize and run one program.  An error in the program is
+    reported to err and ends just this program, rather than exiting,
+    so this can run lots of programs at once on different threads.
+    @param fp file to read the program from.
+    @param out stream for the program's output.
+    @param err stream for error messages and reports.
+    @param settings options for running the program.
+    @param steps if this isn't NULL, it returns the number of steps the
+    program took, as for execProgram().
+    @return exit status for the program.
+*/
+static int runProgram( FILE *fp, FILE *out, FILE *err,
+                       Settings const *settings, long *steps )
+{
+  if ( steps )
+    *steps = 0;
+  Expr *expr = buildProgram( fp, err, settings, NULL );
+  if ( !expr )
+    return EXIT_FAILURE;
+
+  int status = execProgram( expr, out, err, settings, NULL, steps );
+  freeProgram( expr, settings );
+  return status;
+}
+
+/** A batch of programs to run, each with its own output files. */
+typedef struct {
+  /** Program files, and the exit status for each one. */
+  char **files;
+  int *status;
+
+  /** Number of steps each program took, for --green. */
+  long *steps;
+
+  /** Options for running all the programs. */
+  Settings const *settings;
+} Batch;
+
+/** Make a name for one of a program's output files, by adding the
+    given suffix to its name. */
+static char *outputName( char const *file, char const *suffix )
+{
+  char *name = (char *) malloc( strlen( file ) + strlen( suffix ) + 1 );
+  return strcat( strcpy( name, file ), suffix );
+}
+
+/** Run one program from a batch, with its output going to file.out
+    and its error messages to file.err. */
+static void runBatchJob( int index, void *arg )
+{
+  Batch *batch = arg;
+  char const *file = batch->files[ index ];
+
+  char *outName = outputName( file, ".out" );
+  char *errName = outputName( file, ".err" );
+  FILE *out = fopen( outName, "w" );
+  FILE *err = fopen( errName, "w" );
+  FILE *fp = fopen( file, "r" );
+
+  if ( !out || !err || !fp ) {
+    fprintf( stderr, "Can't open file: %s\n", !out ? outName :
+             !err ? errName : file );
+    batch->status[ index ] = EXIT_FAILURE;
+  } else {
+    batch->status[ index ] = runProgram( fp, out, err, batch->settings, NULL );
+  }
+
+  if ( fp )
+    fclose( fp );
+  if ( out )
+    fclose( out );
+  if ( err )
+    fclose( err );
+  free( outName );
+  free( errName );
+}
+
+/** Write some text to a file.
+    @return true if we could write the file.
+*/
+static bool writeFile( char const *name, char const *text, size_t len )
+{
+  FILE *fp = fopen( name, "w" );
+  if ( !fp )
+    return false;
+  fwrite( text, 1, len, fp );
+  return fclose( fp ) == 0;
+}
+
+/** Run one program from a batch as a green thread, taking turns with
+    the others.  Its output and errors are collected in memory as it
+    runs, then written to file.out and file.err once it's done. */
+static void runGreenJob( int index, void *arg )
+{
+  Batch *batch = arg;
+  char const *file = batch->files[ index ];
+
+  char *outText = NULL, *errText = NULL;
+  size_t outLen = 0, errLen = 0;
+  FILE *out = open_memstream( &outText, &outLen );
+  FILE *err = open_memstream( &errText, &errLen );
+  FILE *fp = fopen( file, "r" );
+
+  batch->steps[ index ] = 0;
+  if ( !out || !err || !fp ) {
+    fprintf( stderr, "Can't open file: %s\n", file );
+    batch->status[ index ] = EXIT_FAILURE;
+  } else {
+    batch->status[ index ] = runProgram( fp, out, err, batch->settings,
+                                         batch->steps + index );
+  }
+
+  if ( fp )
+    fclose( fp );
+  if ( out )
+    fclose( out );
+  if ( err )
+    fclose( err );
+
+  char *outName = outputName( file, ".out" );
+  char *errName = outputName( file, ".err" );
+  if ( out && err && ( !writeFile( outName, outText, outLen ) ||
+                       !writeFile( errName, errText, errLen ) ) ) {
+    fprintf( stderr, "Can't write file: %s\n", outName );
+    batch->status[ index ] = EXIT_FAILURE;
+  }
+
+  free( outText );
+  free( errText );
+  free( outName );
+  free( errName );
+}
+
+/** Add the programs listed in a manifest file, one per line, to a
+    list of program files.
+    @param manifest name of the manifest file.
+    @param files list of files, which may be reallocated.
+    @param count number of files in the list, updated as we add them.
+    @param cap capacity of the list, updated if we grow it.
+    @return the list of files.
+*/
+static char **readManifest( char const *manifest, char **files, int *count,
+                            int *cap )
+{
+  FILE *fp = fopen( manifest, "r" );
+  if ( !fp ) {
+    fprintf( stderr, "Can't open file: %s\n", manifest );
+    usage();
+  }
+
+  char line[ MAX_TOKEN + 2 ];
+  while ( fgets( line, sizeof( line ), fp ) ) {
+    line[ strcspn( line, "\r\n" ) ] = '\0';
+    if ( line[ 0 ] == '\0' )
+      continue;
+
+    if ( *count >= *cap )
+      files = (char **) realloc( files, ( *cap *= 2 ) * sizeof( char * ) );
+    files[ ( *count )++ ] = strcpy( (char *) malloc( strlen( line ) + 1 ), line );
+  }
+
+  fclose( fp );
+  return files;
+}
+
+/** Run a batch of programs on a pool of workers, one for each core,
+    or as green threads if settings has a quantum, then report each
+    program's exit status.
+    @param args program files, or @manifest for a file listing them.
+    @param argCount number of args.
+    @param settings options for running the programs.
+    @return exit status, successful if every program succeeded.
+*/
+static int runBatch( char *args[], int argCount, Settings const *settings )
+{
+  int count = 0;
+  int cap = INITIAL_CAPACITY;
+  char **files = (char **) malloc( cap * sizeof( char * ) );
+  for ( int i = 0; i < argCount; i++ ) {
+    if ( args[ i ][ 0 ] == '@' ) {
+      files = readManifest( args[ i ] + 1, files, &count, &cap );
+    } else {
+      if ( count >= cap )
+        files = (char **) realloc( files, ( cap *= 2 ) * sizeof( char * ) );
+      files[ count++ ] = strcpy( (char *) malloc( strlen( args[ i ] ) + 1 ),
+                                 args[ i ] );
+    }
+  }
+
+  Batch batch = { files, (int *) malloc( count * sizeof( int ) ),
+                  (long *) malloc( count * sizeof( long ) ), settings };
+  long *turns = NULL;
+  if ( settings->quantum ) {
+    turns = (long *) malloc( count * sizeof( long ) );
+    runTasks( count, runGreenJob, &batch, turns );
+  } else
+    runJobs( count, coreCount(), runBatchJob, &batch );
+
+  int status = EXIT_SUCCESS;
+  for ( int i = 0; i < count; i++ ) {
+    if ( turns )
+      printf( "%s %d %ld %ld\n", files[ i ], batch.status[ i ],
+              batch.steps[ i ], turns[ i ] );
+    else
+      printf( "%s %d\n", files[ i ], batch.status[ i ] );
+    if ( batch.status[ i ] != EXIT_SUCCESS )
+      status = EXIT_FAILURE;
+    free( files[ i ] );
+  }
+
+  free( turns );
+  free( batch.steps );
+  free( batch.status );
+  free( files );
+  return status;
+}
+
+/** One instance of a program in a parameter sweep. */
+typedef struct {
+  /** Variables to set before this instance starts. */
+  ParamList params;
+
+  /** Output and error messages from this instance, and its exit status. */
+  char *out;
+  size_t outLen;
+  char *err;
+  size_t errLen;
+  int status;
+} Instance;
+
+/** A program to run once for each of a list of instances.  Every
+    instance shares the same program, so it must not have memo nodes. */
+typedef struct {
+  Expr *expr;
+  Instance *instances;
+  Settings const *settings;
+} Sweep;
+
+/** Run one instance from a sweep, collecting its output and error
+    messages in memory. */
+static void runSweepJob( int index, void *arg )
+{
+  Sweep *sweep = arg;
+  Instance *inst = sweep->instances + index;
+
+  FILE *out = open_memstream( &inst->out, &inst->outLen );
+  FILE *err = open_memstream( &inst->err, &inst->errLen );
+  if ( !out || !err ) {
+    fprintf( stderr, "Can't collect output for instance %d\n", index + 1 );
+    inst->status = EXIT_FAILURE;
+  } else {
+    inst->status = execProgram( sweep->expr, out, err, sweep->settings,
+                                &inst->params, NULL );
+  }
+
+  if ( out )
+    fclose( out );
+  if ( err )
+    fclose( err );
+}
+
+/** Read the instances for a sweep from a parameter file.  Each
+    non-blank line is one instance, a list of -D name=value settings.
+    @param paramFile name of the parameter file.
+    @param count returns the number of instances.
+    @return a new array of instances.
+*/
+static Instance *readInstances( char const *paramFile, int *count )
+{
+  FILE *fp = fopen( paramFile, "r" );
+  if ( !fp ) {
+    fprintf( stderr, "Can't open file: %s\n", paramFile );
+    usage();
+  }
+
+  int cap = INITIAL_CAPACITY;
+  Instance *instances = (Instance *) malloc( cap * sizeof( Instance ) );
+  *count = 0;
+
+  char *line = NULL;
+  size_t lineCap = 0;
+  while ( getline( &line, &lineCap, fp ) >= 0 ) {
+    char *word = strtok( line, " \t\r\n" );
+    if ( !word )
+      continue;
+
+    if ( *count >= cap )
+      instances = (Instance *) realloc( instances,
+                                        ( cap *= 2 ) * sizeof( Instance ) );
+    Instance *inst = instances + ( *count )++;
+    inst->params = (ParamList) { NULL, 0, 0 };
+    inst->out = inst->err = NULL;
+    inst->outLen = inst->errLen = 0;
+
+    for ( ; word; word = strtok( NULL, " \t\r\n" ) )
+      if ( strcmp( word, "-D" ) != 0 && !addParam( &inst->params, word ) ) {
+        fprintf( stderr, "Invalid parameter: %s\n", word );
+        usage();
+      }
+  }
+
+  free( line );
+  fclose( fp );
+  return instances;
+}
+
+/** Parse and optimize a program once, then run an instance of it for
+    each line of a parameter file on a pool of workers, one for each
+    core.  The output and error messages from each instance are
+    printed in order once they're all done.
+    @param fp file to read the program from.
+    @param paramFile name of the parameter file.
+    @param settings options for running the program.
+    @return exit status, successful if every instance succeeded.
+*/
+static int runSweep( FILE *fp, char const *paramFile, Settings const *settings )
+{
+  int count;
+  Instance *instances = readInstances( paramFile, &count );
+
+  // The instances all share one program, so it can't have memo nodes,
+  // and there's nothing to profile.  Pool statistics are per thread.
+  Settings shared = *settings;
+  shared.options.memoize = false;
+  shared.profile = false;
+  shared.poolStats = false;
+
+  // Any of the instances' parameters could be set when it starts.
+  ParamList inputs = { NULL, 0, 0 };
+  for ( int i = 0; i < count; i++ )
+    inputs.count += instances[ i ].params.count;
+  inputs.list = (Param *) malloc( ( inputs.count + 1 ) * sizeof( Param ) );
+  inputs.count = 0;
+  for ( int i = 0; i < count; i++ )
+    for ( int j = 0; j < instances[ i ].params.count; j++ )
+      inputs.list[ inputs.count++ ] = instances[ i ].params.list[ j ];
+
+  Expr *expr = buildProgram( fp, stderr, &shared, &inputs );
+  free( inputs.list );
+
+  int status = expr ? EXIT_SUCCESS : EXIT_FAILURE;
+  if ( expr ) {
+    Sweep sweep = { expr, instances, &shared };
+    runJobs( count, coreCount(), runSweepJob, &sweep );
+    freeProgram( expr, &shared );
+  }
+
+  for ( int i = 0; i < count; i++ ) {
+    Instance *inst = instances + i;
+    if ( expr ) {
+      fwrite( inst->out, 1, inst->outLen, stdout );
+      fwrite( inst->err, 1, inst->errLen, stderr );
+      if ( inst->status != EXIT_SUCCESS )
+        status = EXIT_FAILURE;
+    }
+    free( inst->out );
+    free( inst->err );
+    freeParams( &inst->params );
+  }
+
+  free( instances );
+  return status;
+}
+
+/** Build function for the server, parsing and optimizing a program
+    with the settings from the command line. */
+static Expr *buildServed( FILE *fp, FILE *err, char const **inputs,
+                          int inputCount, void *arg )
+{
+  Settings const *settings = arg;
+
+  ParamList params = { (Param *) malloc( ( inputCount + 1 ) * sizeof( Param ) ),
+                       inputCount, inputCount };
+  for ( int i = 0; i < inputCount; i++ )
+    params.list[ i ] = (Param) { (char *) inputs[ i ], NULL };
+
+  Expr *expr = buildProgram( fp, err, settings, &params );
+  free( params.list );
+  return expr;
+}
+
+int main( int argc, char *argv[] )
+{
+  // Look for options before the program's name.
+  Settings settings = { false, false, false, false, { false },
+                        { NULL, 0, 0 }, 0, false, false, coreCount() };
+  bool asyncOutput = false;
+  bool batch = false;
+  bool green = false;
+  long quantum = DEFAULT_QUANTUM;
+  char const *paramFile = NULL;
+  char const *socketPath = NULL;
+  int arg = 1;
+  while ( arg < argc && argv[ arg ][ 0 ] == '-' ) {
+    if ( strcmp( argv[ arg ], "-D" ) == 0 && arg + 1 < argc ) {
+      if ( !addParam( &settings.params, argv[ ++arg ] ) ) {
+        fprintf( stderr, "Invalid parameter: %s\n", argv[ arg ] );
+        usage();
+      }
+    } else if ( strcmp( argv[ arg ], "--sweep" ) == 0 && arg + 1 < argc )
+      paramFile = argv[ ++arg ];
+    else if ( strcmp( argv[ arg ], "--serve" ) == 0 && arg + 1 < argc )
+      socketPath = argv[ ++arg ];
+    else if ( strcmp( argv[ arg ], "--opt-report" ) == 0 )
+      settings.optReport = true;
+    else if ( strcmp( argv[ arg ], "--memo" ) == 0 )
+      settings.options.memoize = true;
+    else if ( strcmp( argv[ arg ], "--profile" ) == 0 )
+      settings.profile = true;
+    else if ( strcmp( argv[ arg ], "--dump-ast" ) == 0 )
+      settings.dumpAst = true;
+    else if ( strcmp( argv[ arg ], "--no-opt" ) == 0 )
+      settings.noOpt = true;
+    else if ( strcmp( argv[ arg ], "--iterative" ) == 0 )
+      settings.iterative = true;
+    else if ( strcmp( argv[ arg ], "--parse-threads" ) == 0 && arg + 1 < argc ) {
+      settings.parseThreads = atoi( argv[ ++arg ] );
+      if ( settings.parseThreads < 1 )
+        usage();
+    }
+    else if ( strcmp( argv[ arg ], "--pool-stats" ) == 0 )
+      settings.poolStats = true;
+    else if ( strcmp( argv[ arg ], "--async-output" ) == 0 )
+      asyncOutput = true;
+    else if ( strcmp( argv[ arg ], "--batch" ) == 0 )
+      batch = true;
+    else if ( strcmp( argv[ arg ], "--green" ) == 0 )
+      batch = green = true;
+    else if ( strcmp( argv[ arg ], "--quantum" ) == 0 && arg + 1 < argc ) {
+      quantum = atol( argv[ ++arg ] );
+      if ( quantum < 1 )
+        usage();
+    }
+    else
+      usage();
+    arg++;
+  }
+
+  // The server shares each program it builds among the clients running
+  // it, so it can't have memo nodes, and there's nothing to report.
+  // It always runs programs with the usual evaluator.
+  if ( socketPath ) {
+    if ( arg != argc || batch || paramFile || settings.params.count ||
+         settings.iterative )
+      usage();
+    settings.options.memoize = false;
+    settings.optReport = settings.dumpAst = false;
+    return serve( socketPath, buildServed, &settings );
+  }
+
+  // In batch mode, everything else is a program to run.  With --green,
+  // the programs take turns, with their steps counted.
+  if ( green )
+    settings.quantum = quantum;
+  if ( batch ) {
+    if ( arg >= argc || paramFile )
+      usage();
+    int status = runBatch( argv + arg, argc - arg, &settings );
+    freeParams( &settings.params );
+    return status;
+  }
+
+  // Open the program's source.
+  if ( argc != arg + 1 )
+    usage();
+  FILE *fp = fopen( argv[ arg ], "r" );
+  if ( !fp ) {
+    fprintf( stderr, "Can't open file: %s\n", argv[ arg ] );
+    usage();
+  }
+
+  // Use a separate thread for output if we're asked to.
+  if ( asyncOutput )
+    startAsyncOutput();
+
+  int status;
+  if ( paramFile )
+    status = runSweep( fp, paramFile, &settings );
+  else
+    status = runProgram( fp, stdout, stderr, &settings, NULL );
+  fclose( fp );
+  freeParams( &settings.params );
+  freePool();
 
-  return EXIT_SUCCESS;
+  return status;
 }
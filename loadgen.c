@@ -0,0 +1,291 @@
+/**
+  @file loadgen.c
+
+  Client for the interpreter's server mode (interpreter --serve), for
+  running programs and measuring how fast the server handles them.
+  Given just a socket and a program, this sends one request and
+  prints the program's output and errors, exiting with its status.
+  Given a number of requests (and optionally a number of clients),
+  it sends that many requests for the same program, split among the
+  clients, each on its own connection and thread, then reports the
+  throughput and the distribution of latencies.
+*/
+
+// For sockets, threads and clock_gettime().
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame.h"
+
+// Initial capacity for reading the program file.
+#define INITIAL_SOURCE 4096
+
+/** The request to send, over and over. */
+typedef struct {
+  /** Socket to connect to. */
+  char const *path;
+
+  /** name=value settings to send with each request. */
+  char **vars;
+  int count;
+
+  /** Frame type and payload for the program, its source or its path. */
+  char type;
+  char *program;
+  int len;
+} Request;
+
+/** Work for one client thread. */
+typedef struct {
+  Request const *req;
+
+  /** Range of requests this client sends, and where to record how long
+      each one took. */
+  int first;
+  int end;
+  double *latency;
+
+  /** Number of requests that failed. */
+  int failed;
+
+  pthread_t thread;
+} Client;
+
+/** Print a usage message then exit unsuccessfully. */
+static void usage()
+{
+  fprintf( stderr, "usage: loadgen [-D name=value]... [--path] <socket> "
+           "<program-file> [requests [clients]]\n" );
+  exit( EXIT_FAILURE );
+}
+
+/** Return the current time in seconds. */
+static double now()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Connect to the server.
+    @return the socket, or -1 if we can't connect.
+*/
+static int connectServer( char const *path )
+{
+  struct sockaddr_un addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+  if ( strlen( path ) >= sizeof( addr.sun_path ) )
+    return -1;
+  strcpy( addr.sun_path, path );
+
+  int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( fd >= 0 &&
+       connect( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ) {
+    close( fd );
+    fd = -1;
+  }
+  return fd;
+}
+
+/** Send a request, then read the response.
+    @param fd connection to the server.
+    @param req request to send.
+    @param copy true if the output and errors should be printed.
+    @return the program's exit status, or -1 if the connection failed.
+*/
+static int sendRequest( int fd, Request const *req, bool copy )
+{
+  for ( int i = 0; i < req->count; i++ )
+    if ( !writeFrame( fd, FRAME_VARIABLE, req->vars[ i ],
+                      strlen( req->vars[ i ] ) ) )
+      return -1;
+  if ( !writeFrame( fd, req->type, req->program, req->len ) )
+    return -1;
+
+  char type;
+  char *data;
+  int len;
+  while ( readFrame( fd, &type, &data, &len ) ) {
+    if ( copy && type == FRAME_OUTPUT )
+      fwrite( data, 1, len, stdout );
+    if ( copy && type == FRAME_ERROR )
+      fwrite( data, 1, len, stderr );
+
+    int status = atoi( data );
+    free( data );
+    if ( type == FRAME_STATUS )
+      return status;
+  }
+
+  return -1;
+}
+
+/** Body of each client thread, sending its share of the requests on
+    a connection of its own. */
+static void *runClient( void *arg )
+{
+  Client *client = arg;
+  int fd = connectServer( client->req->path );
+
+  for ( int i = client->first; i < client->end; i++ ) {
+    double start = now();
+    int status = fd < 0 ? -1 : sendRequest( fd, client->req, false );
+    client->latency[ i ] = now() - start;
+    if ( status != 0 )
+      client->failed++;
+  }
+
+  if ( fd >= 0 )
+    close( fd );
+  return NULL;
+}
+
+/** Comparison function for sorting latencies. */
+static int compareTimes( void const *a, void const *b )
+{
+  double x = *(double const *) a;
+  double y = *(double const *) b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/** Return the given fraction of the way through some sorted times, in
+    milliseconds. */
+static double percentile( double *times, int count, double fraction )
+{
+  int i = (int) ( fraction * ( count - 1 ) + 0.5 );
+  return times[ i ] * 1000;
+}
+
+/** Send lots of requests from some number of clients, then report how
+    long they took.
+    @return exit status, successful if every request succeeded.
+*/
+static int runLoad( Request const *req, int requests, int clients )
+{
+  double *latency = (double *) malloc( requests * sizeof( double ) );
+  Client *list = (Client *) calloc( clients, sizeof( Client ) );
+
+  double start = now();
+  for ( int i = 0; i < clients; i++ ) {
+    list[ i ].req = req;
+    list[ i ].first = (long) requests * i / clients;
+    list[ i ].end = (long) requests * ( i + 1 ) / clients;
+    list[ i ].latency = latency;
+    if ( pthread_create( &list[ i ].thread, NULL, runClient, list + i ) != 0 ) {
+      fprintf( stderr, "Can't start client thread\n" );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  int failed = 0;
+  for ( int i = 0; i < clients; i++ ) {
+    pthread_join( list[ i ].thread, NULL );
+    failed += list[ i ].failed;
+  }
+  double elapsed = now() - start;
+
+  qsort( latency, requests, sizeof( double ), compareTimes );
+  printf( "requests: %d  clients: %d  failed: %d\n", requests, clients,
+          failed );
+  printf( "time: %.3f s  throughput: %.1f requests/s\n", elapsed,
+          requests / elapsed );
+  printf( "latency ms: min %.3f  median %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+          percentile( latency, requests, 0 ),
+          percentile( latency, requests, 0.5 ),
+          percentile( latency, requests, 0.9 ),
+          percentile( latency, requests, 0.99 ),
+          percentile( latency, requests, 1 ) );
+
+  free( list );
+  free( latency );
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/** Read the whole program file into memory. */
+static char *readFile( char const *name, int *len )
+{
+  FILE *fp = fopen( name, "r" );
+  if ( !fp ) {
+    fprintf( stderr, "Can't open file: %s\n", name );
+    usage();
+  }
+
+  int cap = INITIAL_SOURCE;
+  char *text = (char *) malloc( cap );
+  *len = 0;
+  size_t n;
+  while ( ( n = fread( text + *len, 1, cap - *len, fp ) ) > 0 ) {
+    *len += n;
+    if ( *len == cap )
+      text = (char *) realloc( text, cap *= 2 );
+  }
+
+  fclose( fp );
+  return text;
+}
+
+int main( int argc, char *argv[] )
+{
+  Request req = { NULL, (char **) malloc( argc * sizeof( char * ) ), 0,
+                  FRAME_SOURCE, NULL, 0 };
+
+  int arg = 1;
+  while ( arg < argc && argv[ arg ][ 0 ] == '-' ) {
+    if ( strcmp( argv[ arg ], "-D" ) == 0 && arg + 1 < argc )
+      req.vars[ req.count++ ] = argv[ ++arg ];
+    else if ( strcmp( argv[ arg ], "--path" ) == 0 )
+      req.type = FRAME_PATH;
+    else
+      usage();
+    arg++;
+  }
+
+  if ( argc - arg < 2 || argc - arg > 4 )
+    usage();
+  req.path = argv[ arg ];
+
+  // Send the path if we're asked to, so the server reads the file.
+  if ( req.type == FRAME_PATH ) {
+    req.program = argv[ arg + 1 ];
+    req.len = strlen( req.program );
+  } else
+    req.program = readFile( argv[ arg + 1 ], &req.len );
+
+  int status;
+  if ( argc - arg == 2 ) {
+    int fd = connectServer( req.path );
+    if ( fd < 0 ) {
+      fprintf( stderr, "Can't connect to socket: %s\n", req.path );
+      exit( EXIT_FAILURE );
+    }
+    status = sendRequest( fd, &req, true );
+    close( fd );
+    if ( status < 0 ) {
+      fprintf( stderr, "Lost connection to server\n" );
+      status = EXIT_FAILURE;
+    }
+  } else {
+    int requests = atoi( argv[ arg + 2 ] );
+    int clients = argc - arg > 3 ? atoi( argv[ arg + 3 ] ) : 1;
+    if ( requests < 1 || clients < 1 )
+      usage();
+    if ( clients > requests )
+      clients = requests;
+    status = runLoad( &req, requests, clients );
+  }
+
+  if ( req.type == FRAME_SOURCE )
+    free( req.program );
+  free( req.vars );
+  return status;
+}
@@ -0,0 +1,182 @@
+#include "memo.h"
+#include "nodes.h"
+#include "pool.h"
+#include "number.h"
+#include "typed.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// For arithmetic operators, this is the maximum length of a long, printed
+// out as a decimal (with a sign).
+#define MAX_NUMBER 20
+
+/** Free memory for a memo node. */
+static void destroyMemo( Expr *expr )
+{
+  MemoExpr *this = (MemoExpr *)expr;
+
+  this->op->destroy( this->op );
+  for ( int i = 0; i < this->count; i++ )
+    free( this->inputs[ i ].name );
+  free( this->inputs );
+  freeString( this->value );
+  free( this );
+}
+
+/** Return true if the remembered value is still good in this context:
+    it was computed here, and none of its inputs have been assigned
+    since. */
+static bool current( MemoExpr *this, Context *ctxt )
+{
+  if ( !this->valid || this->epoch != contextEpoch( ctxt ) )
+    return false;
+
+  for ( int i = 0; i < this->count; i++ ) {
+    MemoInput *in = &this->inputs[ i ];
+    if ( slotVersion( cachedSlot( ctxt, in->name, &in->cache ) ) != in->version )
+      return false;
+  }
+  return true;
+}
+
+/** Record the versions of all the inputs the value is about to be
+    computed from. */
+static void stamp( MemoExpr *this, Context *ctxt )
+{
+  for ( int i = 0; i < this->count; i++ ) {
+    MemoInput *in = &this->inputs[ i ];
+    in->version = slotVersion( cachedSlot( ctxt, in->name, &in->cache ) );
+  }
+  this->epoch = contextEpoch( ctxt );
+  this->valid = true;
+}
+
+/** Make sure the remembered string value is current, computing it
+    again if it isn't. */
+static void refresh( MemoExpr *this, Context *ctxt )
+{
+  if ( current( this, ctxt ) ) {
+    this->hits++;
+  } else {
+    this->misses++;
+    stamp( this, ctxt );
+
+    // Don't let go of the old value until we have the new one, in case
+    // evaluating it ends in a runtime error.
+    char *value = this->op->eval( this->op, ctxt );
+    freeString( this->value );
+    this->value = value;
+  }
+}
+
+/** Eval for a memo node with a string value. */
+static char *evalMemo( Expr *expr, Context *ctxt )
+{
+  MemoExpr *this = (MemoExpr *)expr;
+  refresh( this, ctxt );
+  return copyString( this->value );
+}
+
+/** evalTo for a memo node with a string value. */
+static void evalToMemo( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  MemoExpr *this = (MemoExpr *)expr;
+  refresh( this, ctxt );
+  appendString( dest, this->value );
+}
+
+/** evalCond for a memo node with a string value, which just checks
+    the remembered value rather than copying it. */
+static bool condMemo( Expr *expr, Context *ctxt )
+{
+  MemoExpr *this = (MemoExpr *)expr;
+  refresh( this, ctxt );
+  return this->value[ 0 ] != '\0';
+}
+
+/** evalInt for a memo node around an integer-valued subexpression. */
+static long evalIntMemo( Expr *expr, Context *ctxt )
+{
+  MemoExpr *this = (MemoExpr *)expr;
+
+  if ( current( this, ctxt ) ) {
+    this->hits++;
+  } else {
+    this->misses++;
+    stamp( this, ctxt );
+    this->num = intValue( this->op, ctxt );
+  }
+
+  return this->num;
+}
+
+/** Eval for a memo node around an integer-valued subexpression. */
+static char *evalIntMemoString( Expr *expr, Context *ctxt )
+{
+  char *result = allocString( MAX_NUMBER + 1 );
+  formatNumber( result, evalIntMemo( expr, ctxt ) );
+  return result;
+}
+
+/** evalTo for a memo node around an integer-valued subexpression. */
+static void evalToIntMemo( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  char buffer[ MAX_NUMBER + 1 ];
+  appendBuffer( dest, buffer, formatNumber( buffer, evalIntMemo( expr, ctxt ) ) );
+}
+
+/** evalCond for a memo node around an integer-valued subexpression. */
+static bool condIntMemo( Expr *expr, Context *ctxt )
+{
+  evalIntMemo( expr, ctxt );
+  return true;
+}
+
+Expr *makeMemo( Expr *op, char const **names, int count )
+{
+  MemoExpr *this = (MemoExpr *) malloc( sizeof( MemoExpr ) );
+  this->destroy = destroyMemo;
+  if ( isIntExpr( op ) ) {
+    this->eval = evalIntMemoString;
+    this->evalCond = condIntMemo;
+    this->exec = defaultExec;
+    this->evalTo = evalToIntMemo;
+    this->evalInt = evalIntMemo;
+    this->kind = EXPR_INT_MEMO;
+  } else {
+    this->eval = evalMemo;
+    this->evalCond = condMemo;
+    this->exec = defaultExec;
+    this->evalTo = evalToMemo;
+    this->evalInt = NULL;
+    this->kind = EXPR_MEMO;
+  }
+
+  this->op = op;
+  this->inputs = (MemoInput *) malloc( count * sizeof( MemoInput ) );
+  for ( int i = 0; i < count; i++ ) {
+    MemoInput *in = &this->inputs[ i ];
+    in->name = (char *) malloc( strlen( names[ i ] ) + 1 );
+    strcpy( in->name, names[ i ] );
+    initVarCache( &in->cache, in->name );
+    in->version = 0;
+  }
+  this->count = count;
+
+  this->valid = false;
+  this->epoch = 0;
+  this->value = NULL;
+  this->num = 0;
+  this->hits = 0;
+  this->misses = 0;
+
+  return (Expr *) this;
+}
+
+void printMemoCounts( Expr *expr, FILE *fp )
+{
+  MemoExpr *this = (MemoExpr *)expr;
+  fprintf( fp, "%lu hits, %lu misses", this->hits, this->misses );
+}
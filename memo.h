@@ -0,0 +1,36 @@
+/**
+  @file memo.h
+
+  Memoizing wrapper for pure subexpressions.  A memo node remembers
+  the last value its subexpression produced, along with the write
+  version of every variable the subexpression reads.  As long as none
+  of those variables has been assigned since, it hands back the
+  remembered value rather than evaluating the subexpression again.
+  The optimizer only adds these when asked to (see optimize.h).
+*/
+
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include "core.h"
+
+/** Make a memo node for the given subexpression.
+    @param op the subexpression to remember the value of.  It must be
+    pure, so its value only depends on the variables in names, and
+    evaluating it can't change any variables or print anything.
+    @param names names of all the variables op reads.  The memo node
+    makes its own copies of these.
+    @param count number of names.
+    @return a new expression that evaluates to the same value as op.
+*/
+Expr *makeMemo( Expr *op, char const **names, int count );
+
+/** Print the number of times a memo node was able to reuse its value
+    (hits) and the number of times it had to evaluate its
+    subexpression (misses).
+    @param expr a memo node made by makeMemo().
+    @param fp stream to print to.
+*/
+void printMemoCounts( Expr *expr, FILE *fp );
+
+#endif
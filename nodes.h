@@ -0,0 +1,394 @@
+/**
+  @file nodes.h
+
+  Representation for each kind of expression node.  These used to be
+  private to the files that build them, but the optimizer needs to
+  look inside nodes (and take them apart) to rewrite the tree, so the
+  structs live here.  Client code should still just use the Expr
+  interface from core.h.
+*/
+
+#ifndef _NODES_H_
+#define _NODES_H_
+
+#include "core.h"
+
+//////////////////////////////////////////////////////////////////////
+// Nodes from basic.c
+
+// Representation for a Literal expression, derived from Expr.
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  /** Literal value of this expression, its length and its hash. */
+  char *val;
+  int len;
+  unsigned hash;
+} LiteralExpr;
+
+// Representation for a print expression, derived from Expr.
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  /** Argument expression we're supposed to evaluate and print. */
+  Expr *arg;
+} PrintExpr;
+
+// Representation for a compound expression, derived from Expr.
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  /** List of subexpressions in the compound. */
+  Expr **eList;
+
+  /** Number of subexpressions in the compound. */
+  int len;
+} CompoundExpr;
+
+//////////////////////////////////////////////////////////////////////
+// Nodes from extra.c
+
+/** Representation for an arbitrary variable operator.  The eval
+    pointer decides what it computes. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  // One operand expressions.
+  char *op1;
+
+  // Where we found the variable last time.
+  VarCache cache;
+} VariableExpr;
+
+/** Representation for an arbitrary set operator.  The eval
+    pointer decides what it computes. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  // Two operand expressions.
+  char *op1;
+  Expr *op2;
+
+  // Where we found the variable last time.
+  VarCache cache;
+} SetExpr;
+
+/** Representation for an arbitrary unary operator.  The eval
+    pointer decides what it computes. */
+typedef struct {
+  char *(*eval)( Expr *expr, Context *ctxt );
+  void (*destroy)( Expr *expr );
+  ExprKind kind;
+  bool (*evalCond)( Expr *expr, Context *ctxt );
+  void (*exec)( Expr *expr, Context *ctxt );
+  void (*evalTo)( Expr *expr, Context *ctxt, Buffer *dest );
+
+  // One operand expression.
+  Expr *op;
+} UnaryExpr;
+
+/** Representation for an arbitrary binary operator.  The eval
+    pointer decides what it computes. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  // Two operand expressions.
+  Expr *op1, *op2;
+} BinaryExpr;
+
+/** Representation for an arbitrary trinary operator.  The eval
+    pointer decides what it computes. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  // Three operand expressions.
+  Expr *op1, *op2, *op3;
+} TrinaryExpr;
+
+//////////////////////////////////////////////////////////////////////
+// Nodes from typed.c
+
+/** Representation shared by all the integer-valued nodes.  Besides
+    the usual eval, these can compute their value directly as a long,
+    without going through a string. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  /** Compute the value of this expression as a long. */
+  long (*evalInt)( Expr *oper, Context *ctxt );
+} IntExpr;
+
+/** Integer literal, with its value already parsed. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** Text of the literal. */
+  char *val;
+
+  /** Value of the literal, as a long. */
+  long num;
+} IntLiteralExpr;
+
+/** Read of a variable that always holds an integer, or an
+    assignment of an integer-valued expression to a variable. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** Name of the variable. */
+  char *name;
+
+  /** Value to assign, or NULL for a variable read. */
+  Expr *op;
+
+  /** Where we found the variable last time. */
+  VarCache cache;
+} IntVariableExpr;
+
+/** Integer arithmetic on two operands. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  // Two operand expressions.
+  Expr *op1, *op2;
+} IntBinaryExpr;
+
+/** Integer arithmetic with a constant operand, reduced to something
+    cheaper than the general operation where we can. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** The operand that isn't constant. */
+  Expr *op;
+
+  /** The constant operand. */
+  long c;
+
+  /** For division, the magic multiplier used instead of dividing by c. */
+  long magic;
+
+  /** Number of bits to shift by, for shifts and division. */
+  int shift;
+
+  /** For shifts, whether to negate the result (multiplying by -2^k). */
+  bool negate;
+} IntConstExpr;
+
+/** A while loop that counts a variable up to a limit, keeping the
+    counter as a long rather than in the context. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** Name of the counter variable. */
+  char *name;
+
+  /** Where we found the counter variable last time. */
+  VarCache cache;
+
+  /** Upper bound for the counter, a literal or a variable. */
+  Expr *limit;
+
+  /** Amount added to the counter at the end of each iteration. */
+  long step;
+
+  /** The rest of the loop body, or NULL if there isn't any. */
+  Expr *body;
+
+  /** True if the body uses the counter variable, so it has to be
+      stored back to the context on every iteration. */
+  bool publish;
+} CountedLoopExpr;
+
+/** Boolean-valued operator on one or two operands (op2 is NULL for
+    not).  These compute their value in evalCond, and eval just prints
+    it as "true" or "". */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  // Operand expressions.
+  Expr *op1, *op2;
+} BoolBinaryExpr;
+
+/** Fused increment, set x add x K, done with one lookup of x. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** Name of the variable. */
+  char *name;
+
+  /** Where we found the variable last time. */
+  VarCache cache;
+
+  /** Amount to add. */
+  long c;
+} IncrementExpr;
+
+/** Fused assignment of a literal, set x "value".  If the literal is
+    an integer, this is also an IntExpr. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** Name of the variable. */
+  char *name;
+
+  /** Where we found the variable last time. */
+  VarCache cache;
+
+  /** Text of the literal, its length and its value if it's an
+      integer. */
+  char *val;
+  int len;
+  long num;
+} SetLiteralExpr;
+
+/** Fused if whose condition compares two integers, if less a b body
+    or if not less a b body. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+
+  // Operands of the comparison, and the body.
+  Expr *op1, *op2, *body;
+
+  /** True to run the body when op1 is not less than op2. */
+  bool negate;
+} IfLessExpr;
+
+//////////////////////////////////////////////////////////////////////
+// Nodes from memo.c
+
+/** A variable a memoized subexpression reads, and the version it had
+    when the remembered value was computed. */
+typedef struct {
+  /** Name of the variable. */
+  char *name;
+
+  /** Where we found the variable last time. */
+  VarCache cache;
+
+  /** Write version of the variable when the value was computed. */
+  unsigned long version;
+} MemoInput;
+
+/** Wrapper that remembers the value of a pure subexpression.  For an
+    integer-valued subexpression, this is also an IntExpr. */
+typedef struct {
+  char *(*eval)( Expr *oper, Context *ctxt );
+  void (*destroy)( Expr *oper );
+  ExprKind kind;
+  bool (*evalCond)( Expr *oper, Context *ctxt );
+  void (*exec)( Expr *oper, Context *ctxt );
+  void (*evalTo)( Expr *oper, Context *ctxt, Buffer *dest );
+  long (*evalInt)( Expr *oper, Context *ctxt );
+
+  /** The subexpression whose value we remember. */
+  Expr *op;
+
+  /** Variables the subexpression reads. */
+  MemoInput *inputs;
+  int count;
+
+  /** True once we have a value, and the epoch of the context it's for. */
+  bool valid;
+  unsigned long epoch;
+
+  /** Remembered value, as a string or (for integers) as a long. */
+  char *value;
+  long num;
+
+  /** Number of evaluations that reused the value or had to compute it. */
+  unsigned long hits;
+  unsigned long misses;
+} MemoExpr;
+
+#endif
@@ -0,0 +1,176 @@
+#include "number.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/** Return true if c is one of the characters sscanf skips as
+    whitespace: space, tab, newline, vertical tab, form feed or
+    carriage return. */
+static bool isSpace( char c )
+{
+  return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+/** Return true if c is a decimal digit. */
+static bool isDigit( char c )
+{
+  return c >= '0' && c <= '9';
+}
+
+/** Convert exactly eight digits to their value, all at once.  The
+    digits are packed into one 64-bit word, then combined into pairs,
+    then groups of four, then all eight, with a couple of multiplies
+    in place of a loop. */
+static uint64_t convertEight( char const *p )
+{
+  // Pack the digits with the first one in the low byte.  Compilers
+  // turn this into a single load on little-endian machines.
+  uint64_t v = 0;
+  for ( int i = 7; i >= 0; i-- )
+    v = ( v << 8 ) | (unsigned char) p[ i ];
+  v -= 0x3030303030303030ULL;
+
+  // Now each byte is a digit.  Combine adjacent bytes into two-digit
+  // values in every other byte, then those into four-digit values
+  // and finally the whole thing.
+  v = ( v * 10 ) + ( v >> 8 );
+  v = ( ( ( v & 0x000000FF000000FFULL ) * ( 100 + ( 1000000ULL << 32 ) ) ) +
+        ( ( ( v >> 16 ) & 0x000000FF000000FFULL ) * ( 1 + ( 10000ULL << 32 ) ) ) )
+    >> 32;
+  return v;
+}
+
+/** Convert a run of n decimal digits to an unsigned value, eight at a
+    time where we can.  There can't be more than 19 digits, so this
+    never overflows. */
+static uint64_t convertDigits( char const *p, int n )
+{
+  uint64_t val = 0;
+  while ( n >= 8 ) {
+    val = val * 100000000 + convertEight( p );
+    p += 8;
+    n -= 8;
+  }
+  while ( n > 0 ) {
+    val = val * 10 + ( *p++ - '0' );
+    n--;
+  }
+  return val;
+}
+
+bool scanNumber( char const *str, long *val, char const **end )
+{
+  char const *p = str;
+  while ( isSpace( *p ) )
+    p++;
+
+  bool neg = false;
+  if ( *p == '-' || *p == '+' ) {
+    neg = ( *p == '-' );
+    p++;
+  }
+
+  // There has to be at least one digit.
+  if ( !isDigit( *p ) ) {
+    if ( end )
+      *end = str;
+    return false;
+  }
+
+  // Leading zeros don't count toward the number of digits we can hold.
+  while ( *p == '0' )
+    p++;
+  char const *start = p;
+  while ( isDigit( *p ) )
+    p++;
+  if ( end )
+    *end = p;
+
+  // Like strtol(), which sscanf uses, clamp values that are too big.
+  int n = p - start;
+  uint64_t mag = n > 19 ? UINT64_MAX : convertDigits( start, n );
+  if ( neg )
+    *val = mag > (uint64_t) LONG_MAX + 1 ? LONG_MIN :
+      mag == 0 ? 0 : -(long) ( mag - 1 ) - 1;
+  else
+    *val = mag > LONG_MAX ? LONG_MAX : (long) mag;
+  return true;
+}
+
+long parseNumber( char const *str )
+{
+  long val;
+  if ( !scanNumber( str, &val, NULL ) )
+    val = 0;
+  return val;
+}
+
+long parseCanonical( char const *str )
+{
+  char const *p = str;
+  bool neg = ( *p == '-' );
+  if ( neg )
+    p++;
+
+  char const *start = p;
+  while ( isDigit( *p ) )
+    p++;
+
+  // Anything unexpected, including a value that might be out of
+  // range, gets the general parse.
+  int n = p - start;
+  if ( *p != '\0' || n == 0 || n > 18 )
+    return parseNumber( str );
+
+  long val = (long) convertDigits( start, n );
+  return neg ? -val : val;
+}
+
+bool isCanonical( char const *str, long *val )
+{
+  char const *end;
+  if ( !scanNumber( str, val, &end ) || *end != '\0' )
+    return false;
+
+  char buffer[ MAX_DIGITS + 1 ];
+  formatNumber( buffer, *val );
+  return strcmp( buffer, str ) == 0;
+}
+
+/** The two-digit numbers 00 through 99, so we can print a long two
+    digits at a time. */
+static char const digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+int formatNumber( char *buffer, long val )
+{
+  // Work on the magnitude as unsigned, so LONG_MIN doesn't overflow.
+  uint64_t mag = val < 0 ? 0 - (uint64_t) val : (uint64_t) val;
+
+  // Fill in digits from the end of a temporary buffer.
+  char digits[ MAX_DIGITS ];
+  char *p = digits + MAX_DIGITS;
+  while ( mag >= 100 ) {
+    p -= 2;
+    memcpy( p, digitPairs + 2 * ( mag % 100 ), 2 );
+    mag /= 100;
+  }
+  if ( mag >= 10 ) {
+    p -= 2;
+    memcpy( p, digitPairs + 2 * mag, 2 );
+  } else {
+    *--p = '0' + mag;
+  }
+  if ( val < 0 )
+    *--p = '-';
+
+  int len = digits + MAX_DIGITS - p;
+  memcpy( buffer, p, len );
+  buffer[ len ] = '\0';
+  return len;
+}
@@ -0,0 +1,63 @@
+/**
+  @file number.h
+
+  Conversions between strings and long ints.  These give exactly the
+  results the interpreter has always gotten from sscanf( "%ld" ) and
+  sprintf( "%ld" ), but they're much faster, since they don't have to
+  interpret a format string or go through a stream.  numtest.c checks
+  them against the library functions.
+*/
+
+#ifndef _NUMBER_H_
+#define _NUMBER_H_
+
+#include <stdbool.h>
+
+/** Maximum length of a long printed in decimal, with a sign. */
+#define MAX_DIGITS 20
+
+/** Parse a long from the start of a string, the way sscanf( "%ld" )
+    does.  Leading whitespace is skipped, then there's an optional
+    sign and as many decimal digits as there are, so "12abc" is 12.
+    Values out of range are clamped to LONG_MIN or LONG_MAX.
+    @param str string to parse.
+    @param val if there's a number, this is set to its value.
+    @param end if this isn't NULL, it's set to the first character
+    after the number, or to str if there wasn't a number.
+    @return true if there was a number to parse.
+*/
+bool scanNumber( char const *str, long *val, char const **end );
+
+/** Parse a string as a long, the same way the arithmetic operators
+    do.  Strings that don't start with a number are zero.
+    @param str string to parse.
+    @return value of the string.
+*/
+long parseNumber( char const *str );
+
+/** Parse a string that should be a long printed exactly the way
+    formatNumber() prints it.  Anything else falls back to
+    parseNumber(), so this is always correct, just fastest for strings
+    in that form.
+    @param str string to parse.
+    @return value of the string.
+*/
+long parseCanonical( char const *str );
+
+/** Report whether a string is exactly how formatNumber() would print
+    some long, with no extra sign, leading zeros or other characters.
+    @param str string to check.
+    @param val if the string is canonical, this is set to its value.
+    @return true if the string is canonical.
+*/
+bool isCanonical( char const *str, long *val );
+
+/** Print a long in decimal, the way sprintf( "%ld" ) does.
+    @param buffer storage for the result, with room for at least
+    MAX_DIGITS + 1 characters.
+    @param val value to print.
+    @return length of the result, not counting the null terminator.
+*/
+int formatNumber( char *buffer, long val );
+
+#endif
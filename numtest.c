@@ -0,0 +1,258 @@
+/**
+  @file numtest.c
+
+  Differential test for the conversions in number.c.  This checks
+  them against sscanf( "%ld" ) and sprintf( "%ld" ) on lots of random
+  inputs, concentrating on the edges: signs, whitespace, leading
+  zeros, trailing junk and values near or beyond the range of a
+  long.  Run with --bench to time both versions instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "number.h"
+
+// Number of random inputs to try of each kind.
+#define TRIALS 1000000
+
+// Number of conversions to time for each benchmark.
+#define BENCH_COUNT 5000000
+
+// Longest random string we make.
+#define MAX_INPUT 30
+
+// Number of inputs in the benchmark, reused over and over.
+#define BENCH_INPUTS 1024
+
+/** Return a random 64-bit value. */
+static unsigned long randomBits()
+{
+  unsigned long val = 0;
+  for ( int i = 0; i < 4; i++ )
+    val = ( val << 16 ) ^ ( rand() & 0xFFFF );
+  return val;
+}
+
+/** Return a random long, with its magnitude spread out over all the
+    possible numbers of digits rather than mostly huge. */
+static long randomLong()
+{
+  switch ( rand() % 4 ) {
+  case 0:
+    return (long) randomBits();
+  case 1: {
+    // Values right at the ends of the range.
+    long edges[] = { LONG_MIN, LONG_MIN + 1, LONG_MAX, LONG_MAX - 1, 0, -1, 1 };
+    return edges[ rand() % ( sizeof( edges ) / sizeof( edges[ 0 ] ) ) ];
+  }
+  default: {
+    // Negate as unsigned, so we never overflow.
+    unsigned long mag = randomBits() >> ( rand() % 64 );
+    return (long) ( rand() % 2 ? mag : 0 - mag );
+  }
+  }
+}
+
+/** Fill in a random string that's likely to look something like a
+    number, but often not quite. */
+static void randomString( char *str )
+{
+  static char const junk[] = " \t\n\v\f\r+-0123456789ax.";
+  int len = 0;
+
+  switch ( rand() % 3 ) {
+  case 0:
+    // Completely random characters from the ones that matter.
+    len = rand() % MAX_INPUT;
+    for ( int i = 0; i < len; i++ )
+      str[ i ] = junk[ rand() % ( sizeof( junk ) - 1 ) ];
+    break;
+
+  case 1: {
+    // A number, with some random things before and after it.
+    int before = rand() % 3;
+    for ( int i = 0; i < before; i++ )
+      str[ len++ ] = junk[ rand() % 9 ];
+    len += sprintf( str + len, "%ld", randomLong() );
+    int after = rand() % 3;
+    for ( int i = 0; i < after; i++ )
+      str[ len++ ] = junk[ rand() % ( sizeof( junk ) - 1 ) ];
+    break;
+  }
+
+  default: {
+    // A long run of digits, near or past the largest long.
+    if ( rand() % 2 )
+      str[ len++ ] = rand() % 2 ? '-' : '+';
+    int zeros = rand() % 3;
+    for ( int i = 0; i < zeros; i++ )
+      str[ len++ ] = '0';
+    int digits = 17 + rand() % 6;
+    str[ len++ ] = '1' + rand() % 9;
+    for ( int i = 1; i < digits; i++ )
+      str[ len++ ] = '0' + rand() % 10;
+  }
+  }
+
+  str[ len ] = '\0';
+}
+
+/** Show a string with its whitespace escaped, for error messages. */
+static void showString( char const *str )
+{
+  putchar( '"' );
+  for ( char const *p = str; *p; p++ )
+    if ( *p == ' ' || ( *p > ' ' && *p < 127 ) )
+      putchar( *p );
+    else
+      printf( "\\%03o", (unsigned char) *p );
+  putchar( '"' );
+}
+
+/** Check all the conversions against the library, returning the
+    number of mismatches. */
+static int runTest()
+{
+  int failures = 0;
+  char str[ MAX_INPUT + 40 ];
+
+  for ( int t = 0; t < TRIALS && failures < 10; t++ ) {
+    // Parsing, compared with sscanf.
+    randomString( str );
+    long expected = 0;
+    int pos = 0;
+    bool found = sscanf( str, "%ld%n", &expected, &pos ) == 1;
+
+    long val = 0;
+    char const *end;
+    bool ok = scanNumber( str, &val, &end );
+    if ( ok != found || ( found && ( val != expected || end != str + pos ) ) ) {
+      printf( "scanNumber( " );
+      showString( str );
+      printf( " ) gave %d %ld %d, expected %d %ld %d\n", ok, val,
+              (int) ( end - str ), found, expected, pos );
+      failures++;
+    }
+
+    long num = parseNumber( str );
+    if ( num != ( found ? expected : 0 ) ) {
+      printf( "parseNumber( " );
+      showString( str );
+      printf( " ) gave %ld\n", num );
+      failures++;
+    }
+
+    // Canonical checks, compared with printing the number back out.
+    char printed[ MAX_DIGITS + 1 ];
+    sprintf( printed, "%ld", expected );
+    bool canon = found && str[ pos ] == '\0' && strcmp( printed, str ) == 0;
+    if ( isCanonical( str, &val ) != canon || ( canon && val != expected ) ) {
+      printf( "isCanonical( " );
+      showString( str );
+      printf( " ) was wrong\n" );
+      failures++;
+    }
+    if ( parseCanonical( str ) != parseNumber( str ) ) {
+      printf( "parseCanonical( " );
+      showString( str );
+      printf( " ) gave %ld\n", parseCanonical( str ) );
+      failures++;
+    }
+
+    // Formatting, compared with sprintf.
+    long n = randomLong();
+    char mine[ MAX_DIGITS + 1 ];
+    int len = formatNumber( mine, n );
+    sprintf( printed, "%ld", n );
+    if ( strcmp( mine, printed ) != 0 || len != strlen( printed ) ) {
+      printf( "formatNumber( %ld ) gave \"%s\"\n", n, mine );
+      failures++;
+    }
+    if ( parseCanonical( printed ) != n || !isCanonical( printed, &val ) ) {
+      printf( "parseCanonical( \"%s\" ) was wrong\n", printed );
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+/** Return seconds of CPU time since start. */
+static double elapsed( clock_t start )
+{
+  return (double) ( clock() - start ) / CLOCKS_PER_SEC;
+}
+
+/** Time the library conversions against ours. */
+static void runBench()
+{
+  // Inputs like the ones the interpreter sees, mostly short numbers.
+  static char inputs[ BENCH_INPUTS ][ MAX_DIGITS + 1 ];
+  static long values[ BENCH_INPUTS ];
+  for ( int i = 0; i < BENCH_INPUTS; i++ ) {
+    values[ i ] = i % 4 ? rand() % 100000 - 50000 : randomLong();
+    sprintf( inputs[ i ], "%ld", values[ i ] );
+  }
+
+  // Keep a sum so the compiler can't skip the work.
+  long sum = 0;
+  char buffer[ MAX_DIGITS + 1 ];
+
+  clock_t start = clock();
+  for ( int i = 0; i < BENCH_COUNT; i++ ) {
+    long val;
+    sscanf( inputs[ i % BENCH_INPUTS ], "%ld", &val );
+    sum += val;
+  }
+  printf( "sscanf:         %.3f s\n", elapsed( start ) );
+
+  start = clock();
+  for ( int i = 0; i < BENCH_COUNT; i++ )
+    sum += parseNumber( inputs[ i % BENCH_INPUTS ] );
+  printf( "parseNumber:    %.3f s\n", elapsed( start ) );
+
+  start = clock();
+  for ( int i = 0; i < BENCH_COUNT; i++ )
+    sum += parseCanonical( inputs[ i % BENCH_INPUTS ] );
+  printf( "parseCanonical: %.3f s\n", elapsed( start ) );
+
+  start = clock();
+  for ( int i = 0; i < BENCH_COUNT; i++ )
+    sum += sprintf( buffer, "%ld", values[ i % BENCH_INPUTS ] );
+  printf( "sprintf:        %.3f s\n", elapsed( start ) );
+
+  start = clock();
+  for ( int i = 0; i < BENCH_COUNT; i++ )
+    sum += formatNumber( buffer, values[ i % BENCH_INPUTS ] );
+  printf( "formatNumber:   %.3f s\n", elapsed( start ) );
+
+  printf( "(checksum %ld)\n", sum );
+}
+
+int main( int argc, char *argv[] )
+{
+  srand( 1 );
+
+  if ( argc == 2 && strcmp( argv[ 1 ], "--bench" ) == 0 ) {
+    runBench();
+    return EXIT_SUCCESS;
+  }
+
+  if ( argc != 1 ) {
+    fprintf( stderr, "usage: numtest [--bench]\n" );
+    return EXIT_FAILURE;
+  }
+
+  int failures = runTest();
+  if ( failures ) {
+    printf( "numtest: %d mismatches\n", failures );
+    return EXIT_FAILURE;
+  }
+
+  printf( "numtest: all conversions match\n" );
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1899 @@
+#include "optimize.h"
+#include "nodes.h"
+#include "typed.h"
+#include "basic.h"
+#include "extra.h"
+#include "memo.h"
+#include "number.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+// For arithmetic operators, this is the maximum length of a long, printed
+// out as a decimal (with a sign).
+#define MAX_NUMBER 20
+
+// Initial capacity for the hash tables used by the optimizer.
+#define INITIAL_CAPACITY 64
+
+// Format for the names of the variables holding temporaries.  These
+// start with a character that can't appear in a token, so they can't
+// collide with variables in the program.
+#define TEMP_NAME "#%d"
+
+//////////////////////////////////////////////////////////////////////
+// Walking the tree
+
+/** Return the number of subexpressions the given node has. */
+static int childCount( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_LITERAL:
+  case EXPR_VARIABLE:
+  case EXPR_INT_LITERAL:
+  case EXPR_INT_VARIABLE:
+  case EXPR_INCREMENT:
+  case EXPR_SET_LITERAL:
+  case EXPR_INT_SET_LITERAL:
+    return 0;
+  case EXPR_PRINT:
+  case EXPR_SET:
+  case EXPR_NOT:
+  case EXPR_INT_SET:
+  case EXPR_BOOL_NOT:
+  case EXPR_INT_ADD_CONST:
+  case EXPR_INT_MUL_CONST:
+  case EXPR_INT_SHIFT:
+  case EXPR_INT_DIV_CONST:
+  case EXPR_MEMO:
+  case EXPR_INT_MEMO:
+    return 1;
+  case EXPR_COMPOUND:
+    return ( (CompoundExpr *)expr )->len;
+  case EXPR_SUBSTR:
+  case EXPR_IF_LESS:
+    return 3;
+  case EXPR_COUNTED_LOOP:
+    return ( (CountedLoopExpr *)expr )->body ? 2 : 1;
+  default:
+    return 2;
+  }
+}
+
+/** Return a pointer to the field holding the given subexpression of a
+    node, so the caller can read or replace it. */
+static Expr **childSlot( Expr *expr, int i )
+{
+  switch ( expr->kind ) {
+  case EXPR_PRINT:
+    return &( (PrintExpr *)expr )->arg;
+  case EXPR_SET:
+    return &( (SetExpr *)expr )->op2;
+  case EXPR_NOT:
+    return &( (UnaryExpr *)expr )->op;
+  case EXPR_COMPOUND:
+    return &( (CompoundExpr *)expr )->eList[ i ];
+  case EXPR_SUBSTR: {
+    TrinaryExpr *this = (TrinaryExpr *)expr;
+    return i == 0 ? &this->op1 : i == 1 ? &this->op2 : &this->op3;
+  }
+  case EXPR_INT_SET:
+    return &( (IntVariableExpr *)expr )->op;
+  case EXPR_INT_ADD_CONST:
+  case EXPR_INT_MUL_CONST:
+  case EXPR_INT_SHIFT:
+  case EXPR_INT_DIV_CONST:
+    return &( (IntConstExpr *)expr )->op;
+  case EXPR_MEMO:
+  case EXPR_INT_MEMO:
+    return &( (MemoExpr *)expr )->op;
+  case EXPR_IF_LESS: {
+    IfLessExpr *this = (IfLessExpr *)expr;
+    return i == 0 ? &this->op1 : i == 1 ? &this->op2 : &this->body;
+  }
+  case EXPR_INT_ADD:
+  case EXPR_INT_SUB:
+  case EXPR_INT_MUL:
+  case EXPR_INT_DIV:
+  case EXPR_INT_WHILE: {
+    IntBinaryExpr *this = (IntBinaryExpr *)expr;
+    return i == 0 ? &this->op1 : &this->op2;
+  }
+  case EXPR_COUNTED_LOOP: {
+    CountedLoopExpr *this = (CountedLoopExpr *)expr;
+    return i == 0 ? &this->limit : &this->body;
+  }
+  case EXPR_INT_LESS:
+  case EXPR_INT_EQUAL:
+  case EXPR_BOOL_EQUAL:
+  case EXPR_BOOL_NOT:
+  case EXPR_BOOL_AND:
+  case EXPR_BOOL_OR:
+  case EXPR_BOOL_IF: {
+    BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+    return i == 0 ? &this->op1 : &this->op2;
+  }
+  default: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    return i == 0 ? &this->op1 : &this->op2;
+  }
+  }
+}
+
+/** Return a short name for the given kind of node, for reports. */
+static char const *kindName( ExprKind kind )
+{
+  static char const *names[] = {
+    [ EXPR_LITERAL ] = "literal",
+    [ EXPR_PRINT ] = "print",
+    [ EXPR_COMPOUND ] = "compound",
+    [ EXPR_VARIABLE ] = "variable",
+    [ EXPR_SET ] = "set",
+    [ EXPR_ADD ] = "add",
+    [ EXPR_SUB ] = "sub",
+    [ EXPR_MUL ] = "mul",
+    [ EXPR_DIV ] = "div",
+    [ EXPR_EQUAL ] = "equal",
+    [ EXPR_LESS ] = "less",
+    [ EXPR_NOT ] = "not",
+    [ EXPR_AND ] = "and",
+    [ EXPR_OR ] = "or",
+    [ EXPR_IF ] = "if",
+    [ EXPR_WHILE ] = "while",
+    [ EXPR_CONCAT ] = "concat",
+    [ EXPR_SUBSTR ] = "substr",
+    [ EXPR_INT_LITERAL ] = "int literal",
+    [ EXPR_INT_VARIABLE ] = "int variable",
+    [ EXPR_INT_SET ] = "int set",
+    [ EXPR_INT_ADD ] = "int add",
+    [ EXPR_INT_SUB ] = "int sub",
+    [ EXPR_INT_MUL ] = "int mul",
+    [ EXPR_INT_DIV ] = "int div",
+    [ EXPR_INT_WHILE ] = "int while",
+    [ EXPR_COUNTED_LOOP ] = "counted loop",
+    [ EXPR_INT_ADD_CONST ] = "add constant",
+    [ EXPR_INT_MUL_CONST ] = "mul constant",
+    [ EXPR_INT_SHIFT ] = "shift",
+    [ EXPR_INT_DIV_CONST ] = "div constant",
+    [ EXPR_INT_LESS ] = "int less",
+    [ EXPR_INT_EQUAL ] = "int equal",
+    [ EXPR_BOOL_EQUAL ] = "bool equal",
+    [ EXPR_BOOL_NOT ] = "bool not",
+    [ EXPR_BOOL_AND ] = "bool and",
+    [ EXPR_BOOL_OR ] = "bool or",
+    [ EXPR_BOOL_IF ] = "bool if",
+    [ EXPR_INCREMENT ] = "fused increment",
+    [ EXPR_SET_LITERAL ] = "fused set literal",
+    [ EXPR_INT_SET_LITERAL ] = "fused int set literal",
+    [ EXPR_IF_LESS ] = "fused if less",
+    [ EXPR_MEMO ] = "memo",
+    [ EXPR_INT_MEMO ] = "int memo",
+  };
+  return names[ kind ];
+}
+
+/** Return the name of the variable the given node reads or assigns,
+    or NULL if it's not that kind of node. */
+static char const *varName( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_VARIABLE:
+    return ( (VariableExpr *)expr )->op1;
+  case EXPR_SET:
+    return ( (SetExpr *)expr )->op1;
+  case EXPR_INT_VARIABLE:
+  case EXPR_INT_SET:
+    return ( (IntVariableExpr *)expr )->name;
+  case EXPR_COUNTED_LOOP:
+    return ( (CountedLoopExpr *)expr )->name;
+  case EXPR_INCREMENT:
+    return ( (IncrementExpr *)expr )->name;
+  case EXPR_SET_LITERAL:
+  case EXPR_INT_SET_LITERAL:
+    return ( (SetLiteralExpr *)expr )->name;
+  default:
+    return NULL;
+  }
+}
+
+/** Return true if evaluating the given expression might assign a value
+    to the named variable. */
+static bool assigns( Expr *expr, char const *name )
+{
+  switch ( expr->kind ) {
+  case EXPR_SET:
+  case EXPR_INT_SET:
+  case EXPR_COUNTED_LOOP:
+  case EXPR_INCREMENT:
+  case EXPR_SET_LITERAL:
+  case EXPR_INT_SET_LITERAL:
+    if ( strcmp( varName( expr ), name ) == 0 )
+      return true;
+    break;
+  default:
+    break;
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    if ( assigns( *childSlot( expr, i ), name ) )
+      return true;
+  return false;
+}
+
+/** Return true if evaluating the given expression might look at the
+    value of the named variable. */
+static bool uses( Expr *expr, char const *name )
+{
+  switch ( expr->kind ) {
+  case EXPR_VARIABLE:
+  case EXPR_INT_VARIABLE:
+  case EXPR_COUNTED_LOOP:
+  case EXPR_INCREMENT:
+    if ( strcmp( varName( expr ), name ) == 0 )
+      return true;
+    break;
+  default:
+    break;
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    if ( uses( *childSlot( expr, i ), name ) )
+      return true;
+  return false;
+}
+
+/** Return true if the given expression is one of the pure operators
+    whose value can be reused or computed early: arithmetic and
+    comparisons, with operands that are also pure. */
+static bool reusable( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIV:
+  case EXPR_LESS:
+  case EXPR_EQUAL:
+    break;
+  default:
+    return false;
+  }
+
+  BinaryExpr *this = (BinaryExpr *)expr;
+  Expr *ops[] = { this->op1, this->op2 };
+  for ( int i = 0; i < 2; i++ )
+    if ( ops[ i ]->kind != EXPR_LITERAL && ops[ i ]->kind != EXPR_VARIABLE &&
+         !reusable( ops[ i ] ) )
+      return false;
+  return true;
+}
+
+/** Pick a new temporary variable, store its name in name and return
+    its number.  The name buffer must hold at least MAX_NUMBER + 2
+    characters. */
+static int newTemp( OptReport *report, char *name )
+{
+  int temp = ++report->temps;
+  sprintf( name, TEMP_NAME, temp );
+  return temp;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Type inference
+
+/* The type of a value is a set of these bits, saying what it might
+   be.  Every value is in exactly one of these categories. */
+
+// A long, the way sprintf prints it.
+#define T_INT 0x1
+
+// The string "true".
+#define T_TRUE 0x2
+
+// The empty string (the value of variables that haven't been set).
+#define T_EMPTY 0x4
+
+// Any other string.
+#define T_STR 0x8
+
+// Values produced by the boolean operators.
+#define T_BOOL ( T_TRUE | T_EMPTY )
+
+// A value we don't know anything about.
+#define T_ANY ( T_INT | T_TRUE | T_EMPTY | T_STR )
+
+/** Hash table entry mapping a node to what we've learned about it. */
+typedef struct {
+  Expr *expr;
+  unsigned char type;
+} TypeEntry;
+
+/** Everything the inference pass keeps up with. */
+typedef struct {
+  // Names of all the variables in the program, so each one gets an
+  // index into the variable state.
+  char **names;
+  int nameCount;
+
+  // Open-addressed table of indices into names.
+  int *nameTable;
+  int nameCap;
+
+  // Open-addressed table of the type for each node, joined over every
+  // time the analysis visits it.
+  TypeEntry *types;
+  int typeCount;
+  int typeCap;
+} Infer;
+
+/** Hash function for variable names. */
+static unsigned int hashName( char const *name )
+{
+  unsigned int h = 5381;
+  while ( *name )
+    h = h * 33 + (unsigned char) *name++;
+  return h;
+}
+
+/** Hash function for node pointers. */
+static unsigned int hashExpr( Expr *expr )
+{
+  unsigned long v = (unsigned long) expr;
+  return (unsigned int) ( ( v >> 4 ) * 2654435761u );
+}
+
+/** Return the index for the given variable name, adding it if it's new. */
+static int nameIndex( Infer *inf, char const *name )
+{
+  // Grow the table if it's getting full.
+  if ( 2 * ( inf->nameCount + 1 ) > inf->nameCap ) {
+    int oldCap = inf->nameCap;
+    int *oldTable = inf->nameTable;
+    inf->nameCap = oldCap ? oldCap * 2 : INITIAL_CAPACITY;
+    inf->nameTable = (int *) malloc( inf->nameCap * sizeof( int ) );
+    for ( int i = 0; i < inf->nameCap; i++ )
+      inf->nameTable[ i ] = -1;
+    for ( int i = 0; i < oldCap; i++ )
+      if ( oldTable[ i ] >= 0 ) {
+        unsigned int h = hashName( inf->names[ oldTable[ i ] ] ) % inf->nameCap;
+        while ( inf->nameTable[ h ] >= 0 )
+          h = ( h + 1 ) % inf->nameCap;
+        inf->nameTable[ h ] = oldTable[ i ];
+      }
+    free( oldTable );
+    inf->names = (char **) realloc( inf->names, inf->nameCap * sizeof( char * ) );
+  }
+
+  unsigned int h = hashName( name ) % inf->nameCap;
+  while ( inf->nameTable[ h ] >= 0 ) {
+    if ( strcmp( inf->names[ inf->nameTable[ h ] ], name ) == 0 )
+      return inf->nameTable[ h ];
+    h = ( h + 1 ) % inf->nameCap;
+  }
+
+  inf->names[ inf->nameCount ] = (char *) name;
+  inf->nameTable[ h ] = inf->nameCount;
+  return inf->nameCount++;
+}
+
+/** Return the entry recording the type of the given node, adding one
+    if it's new. */
+static TypeEntry *typeEntry( Infer *inf, Expr *expr )
+{
+  if ( 2 * ( inf->typeCount + 1 ) > inf->typeCap ) {
+    int oldCap = inf->typeCap;
+    TypeEntry *oldTypes = inf->types;
+    inf->typeCap = oldCap ? oldCap * 2 : INITIAL_CAPACITY;
+    inf->types = (TypeEntry *) calloc( inf->typeCap, sizeof( TypeEntry ) );
+    for ( int i = 0; i < oldCap; i++ )
+      if ( oldTypes[ i ].expr ) {
+        unsigned int h = hashExpr( oldTypes[ i ].expr ) % inf->typeCap;
+        while ( inf->types[ h ].expr )
+          h = ( h + 1 ) % inf->typeCap;
+        inf->types[ h ] = oldTypes[ i ];
+      }
+    free( oldTypes );
+  }
+
+  unsigned int h = hashExpr( expr ) % inf->typeCap;
+  while ( inf->types[ h ].expr && inf->types[ h ].expr != expr )
+    h = ( h + 1 ) % inf->typeCap;
+  if ( !inf->types[ h ].expr ) {
+    inf->types[ h ].expr = expr;
+    inf->types[ h ].type = 0;
+    inf->typeCount++;
+  }
+  return &inf->types[ h ];
+}
+
+/** Return the type recorded for the given node. */
+static unsigned char typeOf( Infer *inf, Expr *expr )
+{
+  return typeEntry( inf, expr )->type;
+}
+
+/** Give every variable in the program an index. */
+static void collectNames( Infer *inf, Expr *expr )
+{
+  if ( varName( expr ) )
+    nameIndex( inf, varName( expr ) );
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    collectNames( inf, *childSlot( expr, i ) );
+}
+
+/** Return the type of a literal's value. */
+static unsigned char literalType( char const *val )
+{
+  long num;
+  if ( val[ 0 ] == '\0' )
+    return T_EMPTY;
+  if ( strcmp( val, "true" ) == 0 )
+    return T_TRUE;
+  if ( isCanonical( val, &num ) )
+    return T_INT;
+  return T_STR;
+}
+
+/** Make a copy of a variable state. */
+static unsigned char *copyState( Infer *inf, unsigned char *state )
+{
+  unsigned char *copy = (unsigned char *) malloc( inf->nameCount + 1 );
+  memcpy( copy, state, inf->nameCount );
+  return copy;
+}
+
+/** Join other into state, returning true if state changed. */
+static bool joinState( Infer *inf, unsigned char *state, unsigned char *other )
+{
+  bool changed = false;
+  for ( int i = 0; i < inf->nameCount; i++ )
+    if ( ( state[ i ] | other[ i ] ) != state[ i ] ) {
+      state[ i ] |= other[ i ];
+      changed = true;
+    }
+  return changed;
+}
+
+/** Abstractly evaluate expr, starting with the given types for every
+    variable.  On return, state holds the possible types of every
+    variable after expr is evaluated.  Returns the possible types of
+    the value of expr, and joins that into the type recorded for expr. */
+static unsigned char infer( Infer *inf, Expr *expr, unsigned char *state )
+{
+  unsigned char type = T_ANY;
+
+  switch ( expr->kind ) {
+  case EXPR_LITERAL:
+    type = literalType( ( (LiteralExpr *)expr )->val );
+    break;
+
+  case EXPR_VARIABLE:
+    type = state[ nameIndex( inf, ( (VariableExpr *)expr )->op1 ) ];
+    break;
+
+  case EXPR_SET: {
+    SetExpr *this = (SetExpr *)expr;
+    type = infer( inf, this->op2, state );
+    state[ nameIndex( inf, this->op1 ) ] = type;
+    break;
+  }
+
+  case EXPR_PRINT:
+    type = infer( inf, ( (PrintExpr *)expr )->arg, state );
+    break;
+
+  case EXPR_COMPOUND: {
+    CompoundExpr *this = (CompoundExpr *)expr;
+    for ( int i = 0; i < this->len; i++ )
+      type = infer( inf, this->eList[ i ], state );
+    break;
+  }
+
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIV: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    infer( inf, this->op1, state );
+    infer( inf, this->op2, state );
+    type = T_INT;
+    break;
+  }
+
+  case EXPR_EQUAL:
+  case EXPR_LESS: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    infer( inf, this->op1, state );
+    infer( inf, this->op2, state );
+    type = T_BOOL;
+    break;
+  }
+
+  case EXPR_NOT:
+    infer( inf, ( (UnaryExpr *)expr )->op, state );
+    type = T_BOOL;
+    break;
+
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_IF: {
+    // The second operand may or may not be evaluated, so afterward
+    // variables could have the types from either path.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    type = infer( inf, this->op1, state );
+    unsigned char *other = copyState( inf, state );
+    infer( inf, this->op2, other );
+    joinState( inf, state, other );
+    free( other );
+    if ( expr->kind != EXPR_IF )
+      type = T_BOOL;
+    break;
+  }
+
+  case EXPR_WHILE: {
+    // Iterate until the state at the top of the loop stops growing.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    unsigned char *top = copyState( inf, state );
+    while ( true ) {
+      memcpy( state, top, inf->nameCount );
+      infer( inf, this->op1, state );
+      unsigned char *body = copyState( inf, state );
+      infer( inf, this->op2, body );
+      bool changed = joinState( inf, top, body );
+      free( body );
+      if ( !changed )
+        break;
+    }
+    free( top );
+    type = T_INT;
+    break;
+  }
+
+  case EXPR_COUNTED_LOOP: {
+    // Like a while loop, but the increment at the end of the body
+    // always leaves an integer in the counter.
+    CountedLoopExpr *this = (CountedLoopExpr *)expr;
+    int counter = nameIndex( inf, this->name );
+    infer( inf, this->limit, state );
+    unsigned char *top = copyState( inf, state );
+    while ( true ) {
+      memcpy( state, top, inf->nameCount );
+      if ( this->body )
+        infer( inf, this->body, state );
+      state[ counter ] = T_INT;
+      bool changed = joinState( inf, top, state );
+      if ( !changed )
+        break;
+    }
+    memcpy( state, top, inf->nameCount );
+    free( top );
+    type = T_INT;
+    break;
+  }
+
+  case EXPR_CONCAT: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    infer( inf, this->op1, state );
+    infer( inf, this->op2, state );
+    break;
+  }
+
+  case EXPR_SUBSTR: {
+    TrinaryExpr *this = (TrinaryExpr *)expr;
+    infer( inf, this->op1, state );
+    infer( inf, this->op2, state );
+    infer( inf, this->op3, state );
+    break;
+  }
+
+  default:
+    // Anything else, we don't know what it does, so it could have
+    // assigned anything to any variable.
+    for ( int i = 0; i < childCount( expr ); i++ )
+      infer( inf, *childSlot( expr, i ), state );
+    memset( state, T_ANY, inf->nameCount );
+    break;
+  }
+
+  typeEntry( inf, expr )->type |= type;
+  return type;
+}
+
+/** Return the type-specialized version of a single node, or expr
+    itself if the types don't permit one.  The node's operands have
+    already been specialized, and t1 and t2 are the types inferred for
+    the first two of them. */
+static Expr *lowerNode( Infer *inf, Expr *expr, unsigned char t1, unsigned char t2 )
+{
+  switch ( expr->kind ) {
+  case EXPR_LITERAL: {
+    LiteralExpr *this = (LiteralExpr *)expr;
+    long num;
+    if ( isCanonical( this->val, &num ) ) {
+      Expr *result = makeIntLiteral( this->val, num );
+      free( this );
+      return result;
+    }
+    return expr;
+  }
+
+  case EXPR_VARIABLE:
+    if ( typeOf( inf, expr ) == T_INT ) {
+      Expr *result = makeIntVariable( ( (VariableExpr *)expr )->op1 );
+      expr->destroy( expr );
+      return result;
+    }
+    return expr;
+
+  case EXPR_SET: {
+    SetExpr *this = (SetExpr *)expr;
+    if ( isIntExpr( this->op2 ) ) {
+      Expr *result = makeIntSet( this->op1, this->op2 );
+      free( this->op1 );
+      free( this );
+      return result;
+    }
+    return expr;
+  }
+
+  case EXPR_NOT: {
+    Expr *result = makeBoolNot( ( (UnaryExpr *)expr )->op );
+    free( expr );
+    return result;
+  }
+
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIV:
+  case EXPR_LESS:
+  case EXPR_EQUAL:
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_IF:
+  case EXPR_WHILE: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    Expr *result = NULL;
+    switch ( expr->kind ) {
+    case EXPR_ADD:
+      result = makeIntAdd( this->op1, this->op2 );
+      break;
+    case EXPR_SUB:
+      result = makeIntSub( this->op1, this->op2 );
+      break;
+    case EXPR_MUL:
+      result = makeIntMul( this->op1, this->op2 );
+      break;
+    case EXPR_DIV:
+      result = makeIntDiv( this->op1, this->op2 );
+      break;
+    case EXPR_LESS:
+      result = makeIntLess( this->op1, this->op2 );
+      break;
+    case EXPR_EQUAL:
+      // Equal compares strings, so we can only skip that if we know
+      // what sort of strings the operands will be.
+      if ( t1 == T_INT && t2 == T_INT )
+        result = makeIntEqual( this->op1, this->op2 );
+      else if ( t1 && t2 && ( t1 | t2 | T_BOOL ) == T_BOOL )
+        result = makeBoolEqual( this->op1, this->op2 );
+      break;
+    case EXPR_AND:
+      result = makeBoolAnd( this->op1, this->op2 );
+      break;
+    case EXPR_OR:
+      result = makeBoolOr( this->op1, this->op2 );
+      break;
+    case EXPR_IF:
+      // If evaluates to a copy of its condition, so it's only boolean
+      // if the condition is.
+      if ( t1 && ( t1 | T_BOOL ) == T_BOOL )
+        result = makeBoolIf( this->op1, this->op2 );
+      break;
+    case EXPR_WHILE:
+      result = makeIntWhile( this->op1, this->op2 );
+      break;
+    default:
+      break;
+    }
+
+    if ( result ) {
+      free( this );
+      return result;
+    }
+    return expr;
+  }
+
+  default:
+    return expr;
+  }
+}
+
+/** Replace nodes with their type-specialized versions wherever the
+    inferred types permit, returning the replacement for expr. */
+static Expr *specialize( Infer *inf, Expr *expr, OptReport *report )
+{
+  // Look up what we know about the operands before they get replaced.
+  unsigned char t1 = 0, t2 = 0;
+  if ( childCount( expr ) >= 1 )
+    t1 = typeOf( inf, *childSlot( expr, 0 ) );
+  if ( childCount( expr ) >= 2 )
+    t2 = typeOf( inf, *childSlot( expr, 1 ) );
+
+  for ( int i = 0; i < childCount( expr ); i++ ) {
+    Expr **slot = childSlot( expr, i );
+    *slot = specialize( inf, *slot, report );
+  }
+
+  Expr *result = lowerNode( inf, expr, t1, t2 );
+  if ( result != expr )
+    report->specialized++;
+  return result;
+}
+
+/** Infer the type of every node and variable in the program, then
+    substitute integer and boolean versions of nodes where we can. */
+static Expr *inferTypes( Expr *expr, OptOptions const *options,
+                         OptReport *report )
+{
+  Infer inf = { NULL, 0, NULL, 0, NULL, 0, 0 };
+  collectNames( &inf, expr );
+  int inputCount = options ? options->inputCount : 0;
+  for ( int i = 0; i < inputCount; i++ )
+    nameIndex( &inf, options->inputs[ i ] );
+
+  // Every variable starts out as the empty string, except for inputs
+  // the caller may have set to anything.
+  unsigned char *state = (unsigned char *) malloc( inf.nameCount + 1 );
+  memset( state, T_EMPTY, inf.nameCount );
+  for ( int i = 0; i < inputCount; i++ )
+    state[ nameIndex( &inf, options->inputs[ i ] ) ] = T_ANY;
+  infer( &inf, expr, state );
+  free( state );
+
+  expr = specialize( &inf, expr, report );
+
+  free( inf.names );
+  free( inf.nameTable );
+  free( inf.types );
+  return expr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Dead code elimination
+
+// Initial capacity for a set of live variables.
+#define INITIAL_LIVE 8
+
+/** Set of variables whose current values might still be read. */
+typedef struct {
+  /** Copies of the variable names, in no particular order. */
+  char **names;
+  int len;
+  int cap;
+} Live;
+
+/** Return true if the named variable is in the live set. */
+static bool isLive( Live *live, char const *name )
+{
+  for ( int i = 0; i < live->len; i++ )
+    if ( strcmp( live->names[ i ], name ) == 0 )
+      return true;
+  return false;
+}
+
+/** Add the named variable to the live set, if it's not already there. */
+static void addLive( Live *live, char const *name )
+{
+  if ( isLive( live, name ) )
+    return;
+
+  if ( live->len >= live->cap ) {
+    live->cap = live->cap ? live->cap * 2 : INITIAL_LIVE;
+    live->names = (char **) realloc( live->names, live->cap * sizeof( char * ) );
+  }
+  live->names[ live->len ] = (char *) malloc( strlen( name ) + 1 );
+  strcpy( live->names[ live->len++ ], name );
+}
+
+/** Remove the named variable from the live set. */
+static void removeLive( Live *live, char const *name )
+{
+  for ( int i = 0; i < live->len; i++ )
+    if ( strcmp( live->names[ i ], name ) == 0 ) {
+      free( live->names[ i ] );
+      live->names[ i ] = live->names[ --live->len ];
+      return;
+    }
+}
+
+/** Add everything in other to the live set. */
+static void joinLive( Live *live, Live *other )
+{
+  for ( int i = 0; i < other->len; i++ )
+    addLive( live, other->names[ i ] );
+}
+
+/** Make an independent copy of the live set. */
+static Live copyLive( Live *live )
+{
+  Live copy = { NULL, 0, 0 };
+  joinLive( &copy, live );
+  return copy;
+}
+
+/** Free the memory for a live set. */
+static void freeLive( Live *live )
+{
+  for ( int i = 0; i < live->len; i++ )
+    free( live->names[ i ] );
+  free( live->names );
+}
+
+/** Add every variable read anywhere in expr to the live set. */
+static void addUses( Live *live, Expr *expr )
+{
+  if ( expr->kind == EXPR_VARIABLE || expr->kind == EXPR_INT_VARIABLE )
+    addLive( live, varName( expr ) );
+  for ( int i = 0; i < childCount( expr ); i++ )
+    addUses( live, *childSlot( expr, i ) );
+}
+
+/** Return true if evaluating the given expression can't have any
+    effect other than computing its value: it doesn't print, assign,
+    loop or report an error. */
+static bool removable( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_LITERAL:
+  case EXPR_VARIABLE:
+    return true;
+
+  case EXPR_DIV: {
+    // Division is only safe if it can't divide by zero or overflow.
+    Expr *divisor = ( (BinaryExpr *)expr )->op2;
+    if ( divisor->kind != EXPR_LITERAL )
+      return false;
+    long c = parseNumber( ( (LiteralExpr *)divisor )->val );
+    if ( c == 0 || c == -1 )
+      return false;
+    break;
+  }
+
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_EQUAL:
+  case EXPR_LESS:
+  case EXPR_NOT:
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_IF:
+  case EXPR_CONCAT:
+  case EXPR_SUBSTR:
+  case EXPR_COMPOUND:
+    break;
+
+  default:
+    return false;
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    if ( !removable( *childSlot( expr, i ) ) )
+      return false;
+  return true;
+}
+
+/** While the expression stored in slot is an assignment to a variable
+    that isn't live, replace it with the value being assigned.  A set
+    evaluates to the value it assigns, so this doesn't change the
+    value of the expression. */
+static void removeDeadStores( Expr **slot, Live *live, OptReport *report )
+{
+  while ( ( *slot )->kind == EXPR_SET && !isLive( live, varName( *slot ) ) ) {
+    SetExpr *this = (SetExpr *)*slot;
+    *slot = this->op2;
+    free( this->op1 );
+    free( this );
+    report->deadStores++;
+  }
+}
+
+/** Remove dead stores and dead computations from the expression stored
+    in slot.  On entry, live holds the variables that might be read
+    after the expression is evaluated.  On return, it holds the ones
+    that might be read before. */
+static void deadWalk( Expr **slot, Live *live, OptReport *report )
+{
+  removeDeadStores( slot, live, report );
+  Expr *expr = *slot;
+
+  switch ( expr->kind ) {
+  case EXPR_VARIABLE:
+    addLive( live, varName( expr ) );
+    break;
+
+  case EXPR_SET:
+    removeLive( live, varName( expr ) );
+    deadWalk( childSlot( expr, 0 ), live, report );
+    break;
+
+  case EXPR_COMPOUND: {
+    // Work backward through the list.  Everything but the last
+    // expression is evaluated just for its side effects, so it can go
+    // if it doesn't have any.
+    CompoundExpr *this = (CompoundExpr *)expr;
+    for ( int i = this->len - 1; i >= 0; i-- ) {
+      if ( i + 1 < this->len ) {
+        removeDeadStores( &this->eList[ i ], live, report );
+        if ( removable( this->eList[ i ] ) ) {
+          this->eList[ i ]->destroy( this->eList[ i ] );
+          this->eList[ i ] = NULL;
+          report->deadExprs++;
+          continue;
+        }
+      }
+      deadWalk( &this->eList[ i ], live, report );
+    }
+
+    int j = 0;
+    for ( int i = 0; i < this->len; i++ )
+      if ( this->eList[ i ] )
+        this->eList[ j++ ] = this->eList[ i ];
+    this->len = j;
+    break;
+  }
+
+  case EXPR_IF: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+
+    // An if evaluates to its condition, so if the body doesn't do
+    // anything, the condition is all we need.
+    if ( removable( this->op2 ) ) {
+      *slot = this->op1;
+      this->op2->destroy( this->op2 );
+      free( this );
+      report->deadExprs++;
+      deadWalk( slot, live, report );
+      break;
+    }
+  }
+  // Fall through, since the body of an if is conditional like the
+  // second operand of and or.
+
+  case EXPR_AND:
+  case EXPR_OR: {
+    // The second operand might not be evaluated, so whatever is live
+    // after it is also live before.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    Live after = copyLive( live );
+    deadWalk( &this->op2, &after, report );
+    joinLive( live, &after );
+    freeLive( &after );
+    deadWalk( &this->op1, live, report );
+    break;
+  }
+
+  case EXPR_WHILE: {
+    // Anything the loop reads might be read on a later iteration, so
+    // it's live throughout.  Since the loop might not run at all,
+    // nothing it assigns is definitely overwritten.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    addUses( live, expr );
+    Live inside = copyLive( live );
+    deadWalk( &this->op2, &inside, report );
+    freeLive( &inside );
+    inside = copyLive( live );
+    deadWalk( &this->op1, &inside, report );
+    freeLive( &inside );
+    break;
+  }
+
+  default:
+    // Anything else evaluates its operands in order, so work backward.
+    for ( int i = childCount( expr ) - 1; i >= 0; i-- )
+      deadWalk( childSlot( expr, i ), live, report );
+    break;
+  }
+}
+
+/** Remove assignments whose values are never read and expressions
+    whose values are discarded without having any side effects. */
+static void removeDeadCode( Expr **slot, OptReport *report )
+{
+  // Nothing is read after the program finishes.
+  Live live = { NULL, 0, 0 };
+  deadWalk( slot, &live, report );
+  freeLive( &live );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Counted loops
+
+/** If the given while loop has the form:
+      while less i N { ... set i add i K }
+    where N is a literal or a variable and nothing else in the body
+    assigns i or N, return an equivalent counted loop.  Otherwise,
+    return NULL. */
+static Expr *countedLoop( BinaryExpr *loop )
+{
+  // Check the condition.
+  if ( loop->op1->kind != EXPR_LESS )
+    return NULL;
+  BinaryExpr *cond = (BinaryExpr *)loop->op1;
+  if ( cond->op1->kind != EXPR_VARIABLE ||
+       ( cond->op2->kind != EXPR_LITERAL && cond->op2->kind != EXPR_VARIABLE ) )
+    return NULL;
+  char const *name = varName( cond->op1 );
+  char const *limitName = varName( cond->op2 );
+  if ( limitName && strcmp( limitName, name ) == 0 )
+    return NULL;
+
+  // Find the last expression in the body, and make sure it's the increment.
+  Expr *body = loop->op2;
+  CompoundExpr *block = NULL;
+  Expr *last = body;
+  if ( body->kind == EXPR_COMPOUND ) {
+    block = (CompoundExpr *)body;
+    last = block->eList[ block->len - 1 ];
+  }
+  if ( last->kind != EXPR_SET || strcmp( varName( last ), name ) != 0 )
+    return NULL;
+  Expr *inc = ( (SetExpr *)last )->op2;
+  if ( inc->kind != EXPR_ADD )
+    return NULL;
+  BinaryExpr *add = (BinaryExpr *)inc;
+  Expr *step = NULL;
+  if ( add->op1->kind == EXPR_VARIABLE && strcmp( varName( add->op1 ), name ) == 0 )
+    step = add->op2;
+  else if ( add->op2->kind == EXPR_VARIABLE && strcmp( varName( add->op2 ), name ) == 0 )
+    step = add->op1;
+  if ( step == NULL || step->kind != EXPR_LITERAL )
+    return NULL;
+
+  // Make sure nothing else in the body changes the counter or the limit.
+  if ( block )
+    for ( int i = 0; i + 1 < block->len; i++ )
+      if ( assigns( block->eList[ i ], name ) ||
+           ( limitName && assigns( block->eList[ i ], limitName ) ) )
+        return NULL;
+
+  // Take the loop apart, keeping the limit and the rest of the body.
+  long k = parseNumber( ( (LiteralExpr *)step )->val );
+  Expr *limit = cond->op2;
+  Expr *rest = NULL;
+  if ( block && block->len > 2 ) {
+    block->len--;
+    rest = body;
+  } else if ( block && block->len == 2 ) {
+    rest = block->eList[ 0 ];
+    free( block->eList );
+    free( block );
+  } else if ( block ) {
+    free( block->eList );
+    free( block );
+  }
+
+  bool publish = false;
+  if ( rest )
+    publish = uses( rest, name );
+  Expr *result = makeCountedLoop( name, limit, k, rest, publish );
+
+  last->destroy( last );
+  cond->op1->destroy( cond->op1 );
+  free( cond );
+  free( loop );
+  return result;
+}
+
+/** Replace every while loop that just counts a variable up to a limit
+    with a counted loop, returning the replacement for expr. */
+static Expr *countLoops( Expr *expr, OptReport *report )
+{
+  for ( int i = 0; i < childCount( expr ); i++ ) {
+    Expr **slot = childSlot( expr, i );
+    *slot = countLoops( *slot, report );
+  }
+
+  if ( expr->kind == EXPR_WHILE ) {
+    Expr *result = countedLoop( (BinaryExpr *)expr );
+    if ( result ) {
+      report->countedLoops++;
+      return result;
+    }
+  }
+
+  return expr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Loop-invariant code motion
+
+// Initial capacity for the lists used while hoisting out of a loop.
+#define INITIAL_HOIST 8
+
+/** What we know about a loop while hoisting invariant computations
+    out of it. */
+typedef struct {
+  /** Names of all the variables the loop might assign. */
+  char const **writes;
+  int wlen, wcap;
+
+  /** Assignments to temporaries, to be evaluated before the loop. */
+  Expr **pre;
+  int plen, pcap;
+} Hoist;
+
+/** Add the name of every variable assigned anywhere in expr to the
+    write set. */
+static void collectWrites( Hoist *h, Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_SET:
+  case EXPR_INT_SET:
+  case EXPR_COUNTED_LOOP:
+    if ( h->wlen >= h->wcap ) {
+      h->wcap = h->wcap ? h->wcap * 2 : INITIAL_HOIST;
+      h->writes = (char const **) realloc( h->writes, h->wcap * sizeof( char const * ) );
+    }
+    h->writes[ h->wlen++ ] = varName( expr );
+    break;
+  default:
+    break;
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    collectWrites( h, *childSlot( expr, i ) );
+}
+
+/** Return true if the pure expression has the same value on every
+    iteration of the loop, since the loop doesn't assign any of the
+    variables it reads. */
+static bool invariant( Hoist *h, Expr *expr )
+{
+  if ( expr->kind == EXPR_LITERAL )
+    return true;
+  if ( expr->kind == EXPR_VARIABLE ) {
+    for ( int i = 0; i < h->wlen; i++ )
+      if ( strcmp( h->writes[ i ], varName( expr ) ) == 0 )
+        return false;
+    return true;
+  }
+
+  BinaryExpr *this = (BinaryExpr *)expr;
+  return invariant( h, this->op1 ) && invariant( h, this->op2 );
+}
+
+/** Return true if the pure expression can be evaluated before the
+    loop, even if the loop itself would never have gotten to it.  The
+    only thing that can go wrong is division, so the divisor has to be
+    a literal that can't fail. */
+static bool speculable( Expr *expr )
+{
+  if ( expr->kind == EXPR_LITERAL || expr->kind == EXPR_VARIABLE )
+    return true;
+
+  BinaryExpr *this = (BinaryExpr *)expr;
+  if ( expr->kind == EXPR_DIV ) {
+    if ( this->op2->kind != EXPR_LITERAL )
+      return false;
+    long c = parseNumber( ( (LiteralExpr *)this->op2 )->val );
+    if ( c == 0 || c == -1 )
+      return false;
+  }
+  return speculable( this->op1 ) && speculable( this->op2 );
+}
+
+/** Move the largest invariant computations in the expression stored
+    in slot to the loop's pre-header, replacing them with a temporary
+    holding their value. */
+static void hoistWalk( Hoist *h, Expr **slot, OptReport *report )
+{
+  Expr *expr = *slot;
+
+  if ( reusable( expr ) && invariant( h, expr ) && speculable( expr ) ) {
+    if ( h->plen >= h->pcap ) {
+      h->pcap = h->pcap ? h->pcap * 2 : INITIAL_HOIST;
+      h->pre = (Expr **) realloc( h->pre, h->pcap * sizeof( Expr * ) );
+    }
+    char name[ MAX_NUMBER + 2 ];
+    newTemp( report, name );
+    h->pre[ h->plen++ ] = makeSet( name, expr );
+    *slot = makeVariable( name );
+    report->hoisted++;
+    return;
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    hoistWalk( h, childSlot( expr, i ), report );
+}
+
+/** Hoist loop-invariant computations out of every loop, innermost
+    first, returning the replacement for expr.  A loop with anything
+    to hoist becomes a compound that computes the invariant values
+    into temporaries and then runs the loop, so the compound still
+    evaluates to the loop's iteration count. */
+static Expr *hoistInvariants( Expr *expr, OptReport *report )
+{
+  for ( int i = 0; i < childCount( expr ); i++ ) {
+    Expr **slot = childSlot( expr, i );
+    *slot = hoistInvariants( *slot, report );
+  }
+
+  if ( expr->kind != EXPR_WHILE && expr->kind != EXPR_COUNTED_LOOP )
+    return expr;
+
+  Hoist h = { NULL, 0, 0, NULL, 0, 0 };
+  collectWrites( &h, expr );
+  for ( int i = 0; i < childCount( expr ); i++ )
+    hoistWalk( &h, childSlot( expr, i ), report );
+  free( h.writes );
+
+  if ( h.plen == 0 )
+    return expr;
+
+  h.pre = (Expr **) realloc( h.pre, ( h.plen + 1 ) * sizeof( Expr * ) );
+  h.pre[ h.plen ] = expr;
+  return makeCompound( h.pre, h.plen + 1 );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Common subexpression elimination
+
+// Initial capacity for the list of available expressions in a region.
+#define INITIAL_AVAILABLE 8
+
+/** A subexpression that's already been computed in the current
+    region, with no assignment to its variables since. */
+typedef struct {
+  /** Hash of the subexpression's structure. */
+  unsigned int hash;
+
+  /** The first place this subexpression is computed. */
+  Expr *first;
+
+  /** Field holding the first occurrence, so we can have it save its
+      value to a temporary. */
+  Expr **slot;
+
+  /** Number of the temporary holding its value, or zero if none of
+      its repeats have been found yet. */
+  int temp;
+} Available;
+
+/** A straight-line region of code, a sequence of subexpressions that
+    are always evaluated in order, one after another. */
+typedef struct {
+  Available *list;
+  int len;
+  int cap;
+} Region;
+
+/** Return the pure expression itself, looking past the assignment to
+    a temporary that gets wrapped around a subexpression once a later
+    repeat of it has been found. */
+static Expr *pureTree( Expr *expr )
+{
+  if ( expr->kind == EXPR_SET )
+    return ( (SetExpr *)expr )->op2;
+  return expr;
+}
+
+/** Hash the structure of a pure expression. */
+static unsigned int hashTree( Expr *expr )
+{
+  expr = pureTree( expr );
+  if ( expr->kind == EXPR_LITERAL )
+    return hashName( ( (LiteralExpr *)expr )->val ) * 3 + 1;
+  if ( expr->kind == EXPR_VARIABLE )
+    return hashName( varName( expr ) ) * 3 + 2;
+
+  BinaryExpr *this = (BinaryExpr *)expr;
+  return ( expr->kind * 31 + hashTree( this->op1 ) ) * 31 + hashTree( this->op2 );
+}
+
+/** Return true if two pure expressions compute the same thing. */
+static bool sameTree( Expr *a, Expr *b )
+{
+  a = pureTree( a );
+  b = pureTree( b );
+  if ( a->kind != b->kind )
+    return false;
+  if ( a->kind == EXPR_LITERAL )
+    return strcmp( ( (LiteralExpr *)a )->val, ( (LiteralExpr *)b )->val ) == 0;
+  if ( a->kind == EXPR_VARIABLE )
+    return strcmp( varName( a ), varName( b ) ) == 0;
+
+  BinaryExpr *x = (BinaryExpr *)a;
+  BinaryExpr *y = (BinaryExpr *)b;
+  return sameTree( x->op1, y->op1 ) && sameTree( x->op2, y->op2 );
+}
+
+/** Return true if evaluating other might change the value of the pure
+    expression expr, by assigning one of the variables it uses. */
+static bool interferes( Expr *expr, Expr *other )
+{
+  expr = pureTree( expr );
+  if ( expr->kind == EXPR_LITERAL )
+    return false;
+  if ( expr->kind == EXPR_VARIABLE )
+    return assigns( other, varName( expr ) );
+
+  BinaryExpr *this = (BinaryExpr *)expr;
+  return interferes( this->op1, other ) || interferes( this->op2, other );
+}
+
+/** Forget every available expression whose value might be changed by
+    evaluating other. */
+static void killAvailable( Region *region, Expr *other )
+{
+  int j = 0;
+  for ( int i = 0; i < region->len; i++ )
+    if ( !interferes( region->list[ i ].first, other ) )
+      region->list[ j++ ] = region->list[ i ];
+  region->len = j;
+}
+
+/** Forget every available expression that uses the named variable. */
+static void killVariable( Region *region, char const *name )
+{
+  int j = 0;
+  for ( int i = 0; i < region->len; i++ )
+    if ( !uses( region->list[ i ].first, name ) )
+      region->list[ j++ ] = region->list[ i ];
+  region->len = j;
+}
+
+static void cseRegion( Expr **slot, OptReport *report );
+
+/** Look for common subexpressions in the expression stored in slot,
+    which is evaluated as part of the given region. */
+static void cseWalk( Region *region, Expr **slot, OptReport *report )
+{
+  Expr *expr = *slot;
+
+  if ( reusable( expr ) ) {
+    unsigned int h = hashTree( expr );
+
+    // If we've already computed this, just use its value.
+    for ( int i = 0; i < region->len; i++ ) {
+      Available *a = &region->list[ i ];
+      if ( a->hash == h && sameTree( a->first, expr ) ) {
+        if ( a->temp == 0 ) {
+          // Have the first occurrence save its value.
+          char name[ MAX_NUMBER + 2 ];
+          a->temp = newTemp( report, name );
+          report->cseTemps++;
+          *a->slot = makeSet( name, a->first );
+        }
+
+        char name[ MAX_NUMBER + 2 ];
+        sprintf( name, TEMP_NAME, a->temp );
+        *slot = makeVariable( name );
+        expr->destroy( expr );
+        report->cseEliminated++;
+        return;
+      }
+    }
+
+    // Otherwise, its parts may be reusable, and then the whole thing is.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    cseWalk( region, &this->op1, report );
+    cseWalk( region, &this->op2, report );
+
+    if ( region->len >= region->cap ) {
+      region->cap = region->cap ? region->cap * 2 : INITIAL_AVAILABLE;
+      region->list = (Available *) realloc( region->list,
+                                            region->cap * sizeof( Available ) );
+    }
+    region->list[ region->len++ ] = (Available){ h, expr, slot, 0 };
+    return;
+  }
+
+  switch ( expr->kind ) {
+  case EXPR_SET:
+    cseWalk( region, childSlot( expr, 0 ), report );
+    killVariable( region, varName( expr ) );
+    break;
+
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_IF: {
+    // The second operand is only evaluated sometimes, so it gets its
+    // own region.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    cseWalk( region, &this->op1, report );
+    cseRegion( &this->op2, report );
+    killAvailable( region, this->op2 );
+    break;
+  }
+
+  case EXPR_WHILE:
+  case EXPR_COUNTED_LOOP:
+    // Loop conditions and bodies run repeatedly, so they're separate regions.
+    for ( int i = 0; i < childCount( expr ); i++ )
+      cseRegion( childSlot( expr, i ), report );
+    killAvailable( region, expr );
+    break;
+
+  default:
+    // Anything else evaluates its operands in order.
+    for ( int i = 0; i < childCount( expr ); i++ )
+      cseWalk( region, childSlot( expr, i ), report );
+    break;
+  }
+}
+
+/** Eliminate common subexpressions in the expression stored in slot,
+    treating it as the start of a new straight-line region. */
+static void cseRegion( Expr **slot, OptReport *report )
+{
+  Region region = { NULL, 0, 0 };
+  cseWalk( &region, slot, report );
+  free( region.list );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Strength reduction
+
+/** If the given expression is a literal, store the value the
+    arithmetic operators would see for it in c and return true. */
+static bool constantValue( Expr *expr, long *c )
+{
+  if ( expr->kind == EXPR_INT_LITERAL ) {
+    *c = ( (IntLiteralExpr *)expr )->num;
+    return true;
+  }
+  if ( expr->kind == EXPR_LITERAL ) {
+    *c = parseNumber( ( (LiteralExpr *)expr )->val );
+    return true;
+  }
+  return false;
+}
+
+/** Return true if evaluating the given expression can't have any
+    side effects. */
+static bool isLeaf( Expr *expr )
+{
+  return expr->kind == EXPR_LITERAL || expr->kind == EXPR_VARIABLE ||
+    expr->kind == EXPR_INT_LITERAL || expr->kind == EXPR_INT_VARIABLE;
+}
+
+/** If c is plus or minus a power of two (other than 1), return the
+    power.  Otherwise, return zero. */
+static int powerOfTwo( long c )
+{
+  unsigned long mag = c < 0 ? 0 - (unsigned long) c : (unsigned long) c;
+  if ( mag < 2 || ( mag & ( mag - 1 ) ) != 0 )
+    return 0;
+
+  int k = 0;
+  while ( mag > 1 ) {
+    mag >>= 1;
+    k++;
+  }
+  return k;
+}
+
+/** Return an expression for the value of x as an integer, the way
+    adding zero or multiplying by one would compute it. */
+static Expr *integerOf( Expr *x )
+{
+  if ( isIntExpr( x ) )
+    return x;
+  return makeIntAddConst( x, 0 );
+}
+
+/** Return a cheaper equivalent of the given arithmetic node with the
+    constant operand c and other operand x, or NULL if there isn't one. */
+static Expr *reduceNode( ExprKind kind, Expr *x, long c )
+{
+  switch ( kind ) {
+  case EXPR_INT_ADD:
+    return c == 0 ? integerOf( x ) : makeIntAddConst( x, c );
+
+  case EXPR_INT_SUB:
+    // Subtracting c is adding -c, with the same wraparound.
+    return c == 0 ? integerOf( x ) : makeIntAddConst( x, (long) ( 0 - (unsigned long) c ) );
+
+  case EXPR_INT_MUL: {
+    if ( c == 1 )
+      return integerOf( x );
+    if ( c == 0 && isLeaf( x ) ) {
+      x->destroy( x );
+      char *zero = (char *) malloc( 2 );
+      strcpy( zero, "0" );
+      return makeIntLiteral( zero, 0 );
+    }
+    int k = powerOfTwo( c );
+    if ( k )
+      return makeIntShift( x, k, c < 0 );
+    return makeIntMulConst( x, c );
+  }
+
+  case EXPR_INT_DIV:
+    // Leave division by zero alone, so it reports the error, and
+    // division by -1, so it traps on overflow the same way.
+    if ( c == 1 )
+      return integerOf( x );
+    if ( c == 0 || c == -1 || c == LONG_MIN )
+      return NULL;
+    return makeIntDivConst( x, c );
+
+  default:
+    return NULL;
+  }
+}
+
+/** Replace arithmetic with a constant operand by cheaper operations
+    with the same result: shifts for powers of two, multiplication by
+    a magic number for division, and nothing at all for identities
+    like adding zero.  Returns the replacement for expr. */
+static Expr *reduceStrength( Expr *expr, OptReport *report )
+{
+  for ( int i = 0; i < childCount( expr ); i++ ) {
+    Expr **slot = childSlot( expr, i );
+    *slot = reduceStrength( *slot, report );
+  }
+
+  switch ( expr->kind ) {
+  case EXPR_INT_ADD:
+  case EXPR_INT_SUB:
+  case EXPR_INT_MUL:
+  case EXPR_INT_DIV: {
+    IntBinaryExpr *this = (IntBinaryExpr *)expr;
+
+    // Find the constant.  Add and mul are commutative, and since a
+    // literal has no side effects, it doesn't matter that it would have
+    // been evaluated first.
+    long c;
+    Expr *x = NULL, *k = NULL;
+    if ( constantValue( this->op2, &c ) ) {
+      x = this->op1;
+      k = this->op2;
+    } else if ( ( expr->kind == EXPR_INT_ADD || expr->kind == EXPR_INT_MUL ) &&
+                constantValue( this->op1, &c ) ) {
+      x = this->op2;
+      k = this->op1;
+    }
+    if ( x == NULL )
+      return expr;
+
+    Expr *result = reduceNode( expr->kind, x, c );
+    if ( result == NULL )
+      return expr;
+
+    report->strengthReduced++;
+    k->destroy( k );
+    free( this );
+    return result;
+  }
+
+  default:
+    return expr;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fused statements
+
+/** Replace the given node with a fused equivalent, if it's one of the
+    statement shapes we have fused nodes for.  Returns the replacement,
+    or NULL if there isn't one. */
+static Expr *fuseNode( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_INT_SET: {
+    IntVariableExpr *this = (IntVariableExpr *)expr;
+
+    // set x add x K, after strength reduction.
+    if ( this->op->kind == EXPR_INT_ADD_CONST ) {
+      IntConstExpr *add = (IntConstExpr *)this->op;
+      char const *name = varName( add->op );
+      if ( name == NULL || add->op->kind == EXPR_INT_SET ||
+           strcmp( name, this->name ) != 0 )
+        return NULL;
+      Expr *result = makeIncrement( this->name, add->c );
+      expr->destroy( expr );
+      return result;
+    }
+
+    // set x <integer literal>
+    if ( this->op->kind == EXPR_INT_LITERAL ) {
+      IntLiteralExpr *lit = (IntLiteralExpr *)this->op;
+      Expr *result = makeSetLiteral( this->name, lit->val, true, lit->num );
+      free( lit );
+      free( this->name );
+      free( this );
+      return result;
+    }
+    return NULL;
+  }
+
+  case EXPR_SET: {
+    // set x <literal>
+    SetExpr *this = (SetExpr *)expr;
+    if ( this->op2->kind != EXPR_LITERAL )
+      return NULL;
+    LiteralExpr *lit = (LiteralExpr *)this->op2;
+    long num;
+    bool isInt = isCanonical( lit->val, &num );
+    Expr *result = makeSetLiteral( this->op1, lit->val, isInt, num );
+    free( lit );
+    free( this->op1 );
+    free( this );
+    return result;
+  }
+
+  case EXPR_BOOL_IF: {
+    // if less a b body, or if not less a b body
+    BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+    BoolBinaryExpr *cond = (BoolBinaryExpr *)this->op1;
+    bool negate = false;
+    if ( cond->kind == EXPR_BOOL_NOT && cond->op1->kind == EXPR_INT_LESS ) {
+      BoolBinaryExpr *not = cond;
+      cond = (BoolBinaryExpr *)not->op1;
+      free( not );
+      negate = true;
+    } else if ( cond->kind != EXPR_INT_LESS )
+      return NULL;
+
+    Expr *result = makeIfLess( cond->op1, cond->op2, this->op2, negate );
+    free( cond );
+    free( this );
+    return result;
+  }
+
+  default:
+    return NULL;
+  }
+}
+
+/** Fuse the most common statement shapes into single nodes, returning
+    the replacement for expr. */
+static Expr *fuseStatements( Expr *expr, OptReport *report )
+{
+  for ( int i = 0; i < childCount( expr ); i++ ) {
+    Expr **slot = childSlot( expr, i );
+    *slot = fuseStatements( *slot, report );
+  }
+
+  Expr *result = fuseNode( expr );
+  if ( result == NULL )
+    return expr;
+
+  report->fused++;
+  return result;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Memoization
+
+// Smallest number of operators worth memoizing.  Remembering a single
+// operation on variables costs about as much as doing it.
+#define MEMO_MIN_OPS 2
+
+/** Return true if the value of the given expression depends only on
+    the variables it reads, and evaluating it has no effects other than
+    (possibly) reporting an error.  Adds the number of operators it
+    contains to ops. */
+static bool memoizable( Expr *expr, int *ops )
+{
+  switch ( expr->kind ) {
+  case EXPR_LITERAL:
+  case EXPR_VARIABLE:
+  case EXPR_INT_LITERAL:
+  case EXPR_INT_VARIABLE:
+    return true;
+
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIV:
+  case EXPR_EQUAL:
+  case EXPR_LESS:
+  case EXPR_NOT:
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_CONCAT:
+  case EXPR_SUBSTR:
+  case EXPR_INT_ADD:
+  case EXPR_INT_SUB:
+  case EXPR_INT_MUL:
+  case EXPR_INT_DIV:
+  case EXPR_INT_ADD_CONST:
+  case EXPR_INT_MUL_CONST:
+  case EXPR_INT_SHIFT:
+  case EXPR_INT_DIV_CONST:
+  case EXPR_INT_LESS:
+  case EXPR_INT_EQUAL:
+  case EXPR_BOOL_EQUAL:
+  case EXPR_BOOL_NOT:
+  case EXPR_BOOL_AND:
+  case EXPR_BOOL_OR:
+    ( *ops )++;
+    break;
+
+  default:
+    return false;
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    if ( !memoizable( *childSlot( expr, i ), ops ) )
+      return false;
+  return true;
+}
+
+/** Wrap the largest pure subexpressions inside loops in memo nodes,
+    returning the replacement for expr.  The loops parameter is the
+    number of loops expr is nested in. */
+static Expr *memoWalk( Expr *expr, int loops, OptReport *report )
+{
+  int ops = 0;
+  if ( loops > 0 && memoizable( expr, &ops ) && ops >= MEMO_MIN_OPS ) {
+    Live inputs = { NULL, 0, 0 };
+    addUses( &inputs, expr );
+    Expr *memo = makeMemo( expr, (char const **) inputs.names, inputs.len );
+    freeLive( &inputs );
+    report->memoized++;
+    return memo;
+  }
+
+  if ( expr->kind == EXPR_WHILE || expr->kind == EXPR_INT_WHILE ||
+       expr->kind == EXPR_COUNTED_LOOP )
+    loops++;
+  for ( int i = 0; i < childCount( expr ); i++ ) {
+    Expr **slot = childSlot( expr, i );
+    *slot = memoWalk( *slot, loops, report );
+  }
+  return expr;
+}
+
+/** Print the memo counts for every memo node in expr, numbering them
+    in the order they appear in the program. */
+static void profileWalk( Expr *expr, int *count, FILE *fp )
+{
+  if ( expr->kind == EXPR_MEMO || expr->kind == EXPR_INT_MEMO ) {
+    Expr *op = ( (MemoExpr *)expr )->op;
+    fprintf( fp, "profile: memo %d (%s): ", ++( *count ), kindName( op->kind ) );
+    printMemoCounts( expr, fp );
+    fprintf( fp, "\n" );
+  }
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    profileWalk( *childSlot( expr, i ), count, fp );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Operand shapes
+
+/** Passes can replace the operands of the nodes built by the parser,
+    so pick the eval function for the operands each node ends up with. */
+static void reshape( Expr *expr )
+{
+  for ( int i = 0; i < childCount( expr ); i++ )
+    reshape( *childSlot( expr, i ) );
+  chooseOperandShape( expr );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Optimizer entry point
+
+Expr *optimize( Expr *expr, OptOptions const *options, OptReport *report )
+{
+  // Keep counts somewhere, even if the caller doesn't want them.
+  OptReport counts;
+  if ( report == NULL )
+    report = &counts;
+  memset( report, 0, sizeof( OptReport ) );
+
+  removeDeadCode( &expr, report );
+  expr = countLoops( expr, report );
+  expr = hoistInvariants( expr, report );
+  cseRegion( &expr, report );
+
+  // This lowers the tree to nodes from typed.c, so any pass that works
+  // on the nodes built by the parser has to come before it.
+  expr = inferTypes( expr, options, report );
+  expr = reduceStrength( expr, report );
+  expr = fuseStatements( expr, report );
+
+  if ( options && options->memoize )
+    expr = memoWalk( expr, 0, report );
+
+  reshape( expr );
+
+  return expr;
+}
+
+void printOptReport( OptReport const *report, FILE *fp )
+{
+  fprintf( fp, "opt-report: dead stores removed: %d\n", report->deadStores );
+  fprintf( fp, "opt-report: dead expressions removed: %d\n", report->deadExprs );
+  fprintf( fp, "opt-report: counted loops: %d\n", report->countedLoops );
+  fprintf( fp, "opt-report: loop-invariant expressions hoisted: %d\n", report->hoisted );
+  fprintf( fp, "opt-report: common subexpressions eliminated: %d (%d temporaries)\n",
+           report->cseEliminated, report->cseTemps );
+  fprintf( fp, "opt-report: nodes specialized for type: %d\n", report->specialized );
+  fprintf( fp, "opt-report: arithmetic strength reduced: %d\n", report->strengthReduced );
+  fprintf( fp, "opt-report: statements fused: %d\n", report->fused );
+  fprintf( fp, "opt-report: subexpressions memoized: %d\n", report->memoized );
+}
+
+void printProfile( Expr *expr, FILE *fp )
+{
+  int count = 0;
+  profileWalk( expr, &count, fp );
+}
+
+/** Print a string for the tree dump, in quotes, escaping the
+    characters that would make it hard to read. */
+static void dumpString( char const *str, FILE *fp )
+{
+  fputc( '"', fp );
+  for ( char const *p = str; *p; p++ ) {
+    if ( *p == '\n' )
+      fprintf( fp, "\\n" );
+    else if ( *p == '\t' )
+      fprintf( fp, "\\t" );
+    else if ( *p == '"' || *p == '\\' )
+      fprintf( fp, "\\%c", *p );
+    else
+      fputc( *p, fp );
+  }
+  fputc( '"', fp );
+}
+
+/** Print the given node on its own line, indented by depth, with its
+    subexpressions indented under it. */
+static void dumpWalk( Expr *expr, int depth, FILE *fp )
+{
+  fprintf( fp, "%*s%s", depth * 2, "", kindName( expr->kind ) );
+
+  switch ( expr->kind ) {
+  case EXPR_LITERAL:
+    fputc( ' ', fp );
+    dumpString( ( (LiteralExpr *)expr )->val, fp );
+    break;
+  case EXPR_INT_LITERAL:
+    fprintf( fp, " %s", ( (IntLiteralExpr *)expr )->val );
+    break;
+  case EXPR_INT_ADD_CONST:
+  case EXPR_INT_MUL_CONST:
+  case EXPR_INT_SHIFT:
+  case EXPR_INT_DIV_CONST:
+    fprintf( fp, " %ld", ( (IntConstExpr *)expr )->c );
+    break;
+  case EXPR_COUNTED_LOOP:
+    fprintf( fp, " %s step %ld", varName( expr ), ( (CountedLoopExpr *)expr )->step );
+    break;
+  case EXPR_INCREMENT:
+    fprintf( fp, " %s %ld", varName( expr ), ( (IncrementExpr *)expr )->c );
+    break;
+  case EXPR_SET_LITERAL:
+  case EXPR_INT_SET_LITERAL:
+    fprintf( fp, " %s ", varName( expr ) );
+    dumpString( ( (SetLiteralExpr *)expr )->val, fp );
+    break;
+  case EXPR_IF_LESS:
+    if ( ( (IfLessExpr *)expr )->negate )
+      fprintf( fp, " (negated)" );
+    break;
+  default:
+    if ( varName( expr ) )
+      fprintf( fp, " %s", varName( expr ) );
+    break;
+  }
+  fputc( '\n', fp );
+
+  for ( int i = 0; i < childCount( expr ); i++ )
+    dumpWalk( *childSlot( expr, i ), depth + 1, fp );
+}
+
+void dumpExpr( Expr *expr, FILE *fp )
+{
+  dumpWalk( expr, 0, fp );
+}
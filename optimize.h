@@ -0,0 +1,97 @@
+/**
+  @file optimize.h
+
+  Optimizer for parsed programs.  This rewrites the expression tree
+  built by the parser into an equivalent one that's cheaper to
+  evaluate.  The rewritten program prints exactly the same output and
+  reports exactly the same errors as the original.
+*/
+
+#ifndef _OPTIMIZE_H_
+#define _OPTIMIZE_H_
+
+#include "core.h"
+
+/** Optional optimizations the caller can ask for. */
+typedef struct {
+  /** Remember the values of pure subexpressions inside loops, and
+      reuse them until a variable they read is assigned. */
+  bool memoize;
+
+  /** Names of variables that may already have a value when the program
+      starts (from -D name=value), rather than the empty string. */
+  char const **inputs;
+  int inputCount;
+} OptOptions;
+
+/** Counts of what the optimizer did, for the --opt-report option. */
+typedef struct {
+  /** Number of assignments removed because their values are never read. */
+  int deadStores;
+
+  /** Number of expressions removed because their values are discarded
+      and evaluating them has no other effect. */
+  int deadExprs;
+
+  /** Number of while loops replaced with counted loops. */
+  int countedLoops;
+
+  /** Number of loop-invariant computations moved out of a loop. */
+  int hoisted;
+
+  /** Number of repeated subexpressions replaced by a temporary. */
+  int cseEliminated;
+
+  /** Number of temporaries introduced to hold common subexpressions. */
+  int cseTemps;
+
+  /** Total number of temporary variables introduced by all passes. */
+  int temps;
+
+  /** Number of nodes replaced by integer or boolean versions. */
+  int specialized;
+
+  /** Number of arithmetic operations with a constant operand reduced
+      to something cheaper. */
+  int strengthReduced;
+
+  /** Number of statements replaced by fused nodes. */
+  int fused;
+
+  /** Number of subexpressions wrapped in memo nodes. */
+  int memoized;
+} OptReport;
+
+/** Optimize the given program.
+    @param expr the whole program, as built by the parser.  The
+    optimizer takes this tree apart as it works, so the caller should
+    only use the returned expression afterward.
+    @param options optional optimizations to do, or NULL for none.
+    @param report if this isn't NULL, it's filled in with counts of
+    what the optimizer did.
+    @return the optimized program.
+*/
+Expr *optimize( Expr *expr, OptOptions const *options, OptReport *report );
+
+/** Print a summary of what the optimizer did.
+    @param report counts filled in by optimize().
+    @param fp stream to print the report to.
+*/
+void printOptReport( OptReport const *report, FILE *fp );
+
+/** Print profiling counts collected while the optimized program ran:
+    the number of hits and misses for each memo node.
+    @param expr the optimized program, after it's been evaluated.
+    @param fp stream to print the profile to.
+*/
+void printProfile( Expr *expr, FILE *fp );
+
+/** Print the expression tree, one node per line with subexpressions
+    indented under their parent, so you can see what the optimizer
+    turned the program into (including which statements were fused).
+    @param expr the expression to print.
+    @param fp stream to print it to.
+*/
+void dumpExpr( Expr *expr, FILE *fp );
+
+#endif
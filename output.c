@@ -0,0 +1,162 @@
+// For threads and semaphores.
+#define _POSIX_C_SOURCE 200809L
+
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+// Number of blocks in the ring.
+#define RING_SIZE 8
+
+// Number of bytes of output each block holds.
+#define BLOCK_SIZE 65536
+
+/** One block of output in the ring. */
+typedef struct {
+  /** Output waiting to be written. */
+  char data[ BLOCK_SIZE ];
+
+  /** Number of bytes in data. */
+  int len;
+
+  /** True if this is the last block, so the writer should stop. */
+  bool last;
+} Block;
+
+// True once output is going through the writer thread.
+static bool async = false;
+
+// The ring of blocks.  The interpreter fills the block at head, and
+// the writer writes out the block at tail.  Each index is only used by
+// one thread, so neither needs a lock.
+static Block *ring;
+static int head;
+static int tail;
+
+// Number of blocks ready for the writer, and number of empty blocks
+// ready for the interpreter.  These are only touched once per block,
+// not on every print, and they're what make one thread's changes to a
+// block visible to the other.
+static sem_t readyBlocks;
+static sem_t emptyBlocks;
+
+// Set by the writer while it's waiting with nothing to write, so the
+// interpreter can hand over a block before it's full.
+static int writerIdle;
+
+// The writer thread.
+static pthread_t writer;
+
+/** Give the block at head to the writer and move on to the next one,
+    waiting for it if the ring is full.
+    @param last true if this is the last block we'll give it.
+*/
+static void publish( bool last )
+{
+  ring[ head ].last = last;
+  sem_post( &readyBlocks );
+
+  head = ( head + 1 ) % RING_SIZE;
+  if ( !last ) {
+    sem_wait( &emptyBlocks );
+    ring[ head ].len = 0;
+  }
+}
+
+/** Body of the writer thread, writing out blocks in order until it
+    gets the last one. */
+static void *runWriter( void *arg )
+{
+  bool last = false;
+  while ( !last ) {
+    // If we've caught up, make sure everything we wrote is out, and
+    // let the interpreter know we're waiting.
+    int pending;
+    sem_getvalue( &readyBlocks, &pending );
+    if ( pending == 0 ) {
+      fflush( stdout );
+      __atomic_store_n( &writerIdle, 1, __ATOMIC_RELEASE );
+    }
+
+    sem_wait( &readyBlocks );
+    __atomic_store_n( &writerIdle, 0, __ATOMIC_RELEASE );
+
+    Block *block = ring + tail;
+    fwrite( block->data, 1, block->len, stdout );
+    last = block->last;
+
+    tail = ( tail + 1 ) % RING_SIZE;
+    sem_post( &emptyBlocks );
+  }
+
+  fflush( stdout );
+  return NULL;
+}
+
+/** At exit, give the writer whatever's left and wait for it to finish. */
+static void finishAsyncOutput()
+{
+  publish( true );
+  pthread_join( writer, NULL );
+
+  sem_destroy( &readyBlocks );
+  sem_destroy( &emptyBlocks );
+  free( ring );
+  async = false;
+}
+
+void startAsyncOutput()
+{
+  // We start out with the first block, the rest are empty.
+  ring = (Block *) malloc( RING_SIZE * sizeof( Block ) );
+  head = tail = 0;
+  ring[ head ].len = 0;
+  sem_init( &readyBlocks, 0, 0 );
+  sem_init( &emptyBlocks, 0, RING_SIZE - 1 );
+  writerIdle = 0;
+
+  if ( pthread_create( &writer, NULL, runWriter, NULL ) != 0 ) {
+    // We can still write the output ourselves.
+    sem_destroy( &readyBlocks );
+    sem_destroy( &emptyBlocks );
+    free( ring );
+    return;
+  }
+
+  async = true;
+  atexit( finishAsyncOutput );
+}
+
+void writeOutput( FILE *fp, char const *data, int len )
+{
+  if ( !async || fp != stdout ) {
+    fwrite( data, 1, len, fp );
+    return;
+  }
+
+  // Copy as much as fits into the current block, moving on to the
+  // next one each time it fills up.
+  while ( len > 0 ) {
+    Block *block = ring + head;
+    int n = BLOCK_SIZE - block->len;
+    if ( n > len )
+      n = len;
+    memcpy( block->data + block->len, data, n );
+    block->len += n;
+    data += n;
+    len -= n;
+
+    if ( block->len == BLOCK_SIZE )
+      publish( false );
+  }
+
+  // If the writer has nothing to do, give it what we have now rather
+  // than waiting for the block to fill up.
+  if ( ring[ head ].len > 0 && __atomic_load_n( &writerIdle, __ATOMIC_ACQUIRE ) )
+    publish( false );
+}
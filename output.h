@@ -0,0 +1,31 @@
+/**
+  @file output.h
+
+  How the print expression writes its output.  Normally this just
+  writes to the program's output stream, but with startAsyncOutput()
+  a separate writer thread does all the writing to stdout.  Prints
+  copy their text into a ring of blocks and the writer thread drains
+  them in order, so a slow reader on the other end of stdout only
+  holds up the interpreter when every block in the ring is waiting to
+  be written.
+*/
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stdio.h>
+
+/** Start a writer thread to do all the output to stdout from here on.
+    Whatever's been written when the interpreter exits, however it
+    exits, is written out first.
+*/
+void startAsyncOutput();
+
+/** Write some characters to a program's output.
+    @param fp stream for the program's output.
+    @param data characters to write.
+    @param len number of characters.
+*/
+void writeOutput( FILE *fp, char const *data, int len );
+
+#endif
@@ -0,0 +1,162 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Capacity of the smallest size class.  Each class after that is
+// twice as big as the one before it.
+#define SMALLEST_CLASS 16
+
+// Number of size classes, so the largest pooled string has room for
+// SMALLEST_CLASS << ( CLASS_COUNT - 1 ) bytes.
+#define CLASS_COUNT 5
+
+// Class number recorded for strings too long for any of the classes.
+#define LARGE_CLASS -1
+
+/** Header stored just before every string we hand out, so we can tell
+    how big it is when it comes back. */
+typedef struct {
+  /** Size class of the string, or LARGE_CLASS. */
+  int cls;
+
+  /** Number of bytes of storage after the header. */
+  int cap;
+} Header;
+
+/** While a string is on a free list, its storage holds a pointer to
+    the next one. */
+typedef struct FreeTag {
+  struct FreeTag *next;
+} FreeString;
+
+// Free list for each size class.  Each thread has its own, so
+// programs running on different threads never have to share them.
+static __thread FreeString *freeLists[ CLASS_COUNT ];
+
+// Counts for getPoolStats(), also kept for each thread.
+static __thread PoolStats stats;
+
+/** Return the header for a string we handed out. */
+static Header *headerOf( char const *str )
+{
+  return (Header *) str - 1;
+}
+
+char *allocString( int size )
+{
+  stats.allocs++;
+  stats.bytes += size;
+
+  // Find the smallest class big enough for this string.
+  int cls = 0;
+  int cap = SMALLEST_CLASS;
+  while ( cls < CLASS_COUNT && cap < size ) {
+    cls++;
+    cap *= 2;
+  }
+
+  Header *head;
+  if ( cls >= CLASS_COUNT ) {
+    // Too big for the pool, it just gets exactly what it asked for.
+    cls = LARGE_CLASS;
+    cap = size;
+    head = (Header *) malloc( sizeof( Header ) + cap );
+  } else if ( freeLists[ cls ] ) {
+    // Reuse a string from the free list.
+    FreeString *str = freeLists[ cls ];
+    freeLists[ cls ] = str->next;
+    head = headerOf( (char *) str );
+    stats.reused++;
+  } else {
+    head = (Header *) malloc( sizeof( Header ) + cap );
+  }
+
+  head->cls = cls;
+  head->cap = cap;
+
+  stats.inUse += cap;
+  if ( stats.inUse > stats.highWater )
+    stats.highWater = stats.inUse;
+
+  return (char *) ( head + 1 );
+}
+
+char *copyString( char const *str )
+{
+  int len = strlen( str );
+  char *copy = allocString( len + 1 );
+  memcpy( copy, str, len + 1 );
+  return copy;
+}
+
+char *resizeString( char *str, int size )
+{
+  Header *head = headerOf( str );
+  if ( size <= head->cap )
+    return str;
+
+  // Strings outside the pool can just grow in place, if malloc can.
+  if ( head->cls == LARGE_CLASS ) {
+    stats.allocs++;
+    stats.bytes += size;
+    stats.inUse += size - head->cap;
+    if ( stats.inUse > stats.highWater )
+      stats.highWater = stats.inUse;
+
+    head = (Header *) realloc( head, sizeof( Header ) + size );
+    head->cap = size;
+    return (char *) ( head + 1 );
+  }
+
+  char *bigger = allocString( size );
+  memcpy( bigger, str, head->cap );
+  freeString( str );
+  return bigger;
+}
+
+int stringCapacity( char const *str )
+{
+  return headerOf( str )->cap;
+}
+
+void freeString( char *str )
+{
+  if ( str == NULL )
+    return;
+
+  Header *head = headerOf( str );
+  stats.inUse -= head->cap;
+
+  if ( head->cls == LARGE_CLASS ) {
+    free( head );
+  } else {
+    FreeString *entry = (FreeString *) str;
+    entry->next = freeLists[ head->cls ];
+    freeLists[ head->cls ] = entry;
+  }
+}
+
+void getPoolStats( PoolStats *s )
+{
+  *s = stats;
+}
+
+void printPoolStats( FILE *fp )
+{
+  fprintf( fp, "strings allocated: %lu\n", stats.allocs );
+  fprintf( fp, "reused from free lists: %lu\n", stats.reused );
+  fprintf( fp, "bytes requested: %lu\n", stats.bytes );
+  fprintf( fp, "high-water bytes in use: %lu\n", stats.highWater );
+}
+
+void freePool()
+{
+  for ( int i = 0; i < CLASS_COUNT; i++ ) {
+    while ( freeLists[ i ] ) {
+      FreeString *str = freeLists[ i ];
+      freeLists[ i ] = str->next;
+      free( headerOf( (char *) str ) );
+    }
+  }
+}
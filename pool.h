@@ -0,0 +1,88 @@
+/**
+  @file pool.h
+
+  Allocator for the strings the interpreter makes while it runs: the
+  values expressions evaluate to and the values stored in variables.
+  Almost all of these are short (numbers, "true", short words), so
+  small strings come from a few size classes, each with its own free
+  list.  A freed string goes back on its list and the next request in
+  the same class reuses it, rather than going through malloc and free
+  every time.  Longer strings just use malloc.  Each thread has its
+  own free lists and counts, so threads can allocate without locking.
+  A string freed by a different thread than the one that allocated it
+  just goes on the free list of the thread that freed it.
+*/
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stdio.h>
+
+/** Counts kept by the allocator, for seeing how much allocation a
+    program does. */
+typedef struct {
+  /** Number of strings allocated. */
+  unsigned long allocs;
+
+  /** Number of those that reused a string from a free list. */
+  unsigned long reused;
+
+  /** Total number of bytes asked for. */
+  unsigned long bytes;
+
+  /** Bytes in strings that are currently allocated, counting the
+      whole capacity of each one. */
+  unsigned long inUse;
+
+  /** Largest value inUse has reached. */
+  unsigned long highWater;
+} PoolStats;
+
+/** Allocate storage for a string.
+    @param size number of bytes needed, including the null terminator.
+    @return storage for the string, with room for at least size bytes.
+    This has to be freed with freeString(), not free().
+*/
+char *allocString( int size );
+
+/** Allocate a copy of the given string.
+    @param str string to copy.
+    @return copy of str, to be freed with freeString().
+*/
+char *copyString( char const *str );
+
+/** Make room for a longer string, like realloc().  The contents up to
+    the old capacity are kept.
+    @param str string from allocString().
+    @param size number of bytes needed, including the null terminator.
+    @return storage for the string, which may have moved.
+*/
+char *resizeString( char *str, int size );
+
+/** Return the number of bytes a string from allocString() actually
+    has room for.  This is at least the size that was asked for.
+    @param str string from allocString().
+    @return capacity of the string, including room for the terminator.
+*/
+int stringCapacity( char const *str );
+
+/** Free a string from allocString() or copyString().  It's fine to
+    pass NULL.
+    @param str string to free.
+*/
+void freeString( char *str );
+
+/** Report the allocator's counts so far, for this thread.
+    @param stats filled in with the current counts.
+*/
+void getPoolStats( PoolStats *stats );
+
+/** Print the allocator's counts, for the --pool-stats option.
+    @param fp stream to print to.
+*/
+void printPoolStats( FILE *fp );
+
+/** Give the strings on all this thread's free lists back to malloc. */
+void freePool();
+
+#endif
@@ -0,0 +1,524 @@
+// For fopencookie(), fmemopen(), sockets and threads.
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "frame.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Most programs the cache holds at once.
+#define CACHE_SIZE 64
+
+// Number of buckets in the cache's hash table.
+#define CACHE_BUCKETS 128
+
+// Size of the buffer for a program's output.  Output goes back to the
+// client a buffer at a time, as the program runs.
+#define OUTPUT_BUFFER 65536
+
+// Initial capacity for the list of variables in a request, and for
+// reading a program from a file.
+#define INITIAL_CAPACITY 5
+#define INITIAL_SOURCE 4096
+
+/** A program in the cache. */
+typedef struct EntryTag {
+  /** The variables set before it starts, each followed by a null
+      character, then another null and the program's source. */
+  char *key;
+  int keyLen;
+  unsigned hash;
+
+  /** The program, built for those variables. */
+  Expr *expr;
+
+  /** Number of requests using the program right now. */
+  int refs;
+
+  /** True while the entry is in the cache.  An entry that's evicted
+      while it's being used is freed when the last request is done. */
+  bool cached;
+
+  /** Next entry in the same bucket. */
+  struct EntryTag *chain;
+
+  /** Neighbors in the list of entries, from most to least recently used. */
+  struct EntryTag *newer;
+  struct EntryTag *older;
+} Entry;
+
+// The cache, a hash table of entries and a list of them in the order
+// they were used.  Clients are served on different threads, so these
+// are only used with cacheLock held.
+static Entry *buckets[ CACHE_BUCKETS ];
+static Entry *newest = NULL;
+static Entry *oldest = NULL;
+static int cacheCount = 0;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Everything a thread needs to serve one client. */
+typedef struct {
+  int fd;
+  BuildFunction build;
+  void *arg;
+} Client;
+
+/** One stream of a program's output going back to its client, with
+    the type of frame to send it in. */
+typedef struct {
+  int fd;
+  char type;
+} Stream;
+
+/** A request from a client. */
+typedef struct {
+  /** Variables to set before the program starts.  Each one is a
+      name and a value, with a null character between them. */
+  char **vars;
+  int count;
+  int cap;
+
+  /** The program's source, or the name of the file it's in. */
+  char *source;
+  int len;
+  bool path;
+} Request;
+
+//////////////////////////////////////////////////////////////////////
+// Program cache
+
+/** Take an entry out of the list of entries in the order they were used. */
+static void unlinkEntry( Entry *entry )
+{
+  if ( entry->newer )
+    entry->newer->older = entry->older;
+  else
+    newest = entry->older;
+
+  if ( entry->older )
+    entry->older->newer = entry->newer;
+  else
+    oldest = entry->newer;
+}
+
+/** Put an entry at the front of the list, as the most recently used. */
+static void pushNewest( Entry *entry )
+{
+  entry->newer = NULL;
+  entry->older = newest;
+  if ( newest )
+    newest->newer = entry;
+  else
+    oldest = entry;
+  newest = entry;
+}
+
+/** Take an entry out of the cache entirely. */
+static void removeEntry( Entry *entry )
+{
+  Entry **link = &buckets[ entry->hash % CACHE_BUCKETS ];
+  while ( *link != entry )
+    link = &( *link )->chain;
+  *link = entry->chain;
+
+  unlinkEntry( entry );
+  entry->cached = false;
+  cacheCount--;
+}
+
+/** Free the memory for an entry and its program. */
+static void freeEntry( Entry *entry )
+{
+  entry->expr->destroy( entry->expr );
+  free( entry->key );
+  free( entry );
+}
+
+/** Return the cached entry with the given key, if there is one,
+    marking it as in use and most recently used. */
+static Entry *findEntry( char const *key, int keyLen, unsigned hash )
+{
+  for ( Entry *entry = buckets[ hash % CACHE_BUCKETS ]; entry;
+        entry = entry->chain )
+    if ( entry->hash == hash && entry->keyLen == keyLen &&
+         memcmp( entry->key, key, keyLen ) == 0 ) {
+      unlinkEntry( entry );
+      pushNewest( entry );
+      entry->refs++;
+      return entry;
+    }
+
+  return NULL;
+}
+
+/** Return the cached program for the given key, marking it as in
+    use, or NULL if it's not in the cache. */
+static Entry *acquireProgram( char const *key, int keyLen, unsigned hash )
+{
+  pthread_mutex_lock( &cacheLock );
+  Entry *entry = findEntry( key, keyLen, hash );
+  pthread_mutex_unlock( &cacheLock );
+  return entry;
+}
+
+/** Add a program we just built to the cache, marked as in use,
+    evicting the least recently used programs if the cache is full.
+    If some other thread built the same program while we were
+    building ours, we use theirs instead.
+    @param key key for the program, which the cache takes ownership of.
+    @return entry for the program.
+*/
+static Entry *insertProgram( char *key, int keyLen, unsigned hash,
+                             Expr *expr )
+{
+  pthread_mutex_lock( &cacheLock );
+
+  Entry *entry = findEntry( key, keyLen, hash );
+  if ( entry ) {
+    pthread_mutex_unlock( &cacheLock );
+    expr->destroy( expr );
+    free( key );
+    return entry;
+  }
+
+  entry = (Entry *) malloc( sizeof( Entry ) );
+  entry->key = key;
+  entry->keyLen = keyLen;
+  entry->hash = hash;
+  entry->expr = expr;
+  entry->refs = 1;
+  entry->cached = true;
+  entry->chain = buckets[ hash % CACHE_BUCKETS ];
+  buckets[ hash % CACHE_BUCKETS ] = entry;
+  pushNewest( entry );
+  cacheCount++;
+
+  // Evict the programs nobody's using now, and save them to free once
+  // we let go of the lock.
+  Entry *evicted = NULL;
+  while ( cacheCount > CACHE_SIZE ) {
+    Entry *victim = oldest;
+    removeEntry( victim );
+    if ( victim->refs == 0 ) {
+      victim->chain = evicted;
+      evicted = victim;
+    }
+  }
+
+  pthread_mutex_unlock( &cacheLock );
+
+  while ( evicted ) {
+    Entry *next = evicted->chain;
+    freeEntry( evicted );
+    evicted = next;
+  }
+
+  return entry;
+}
+
+/** Let the cache know we're done with a program, freeing it if it was
+    evicted while we were running it. */
+static void releaseProgram( Entry *entry )
+{
+  pthread_mutex_lock( &cacheLock );
+  bool last = --entry->refs == 0 && !entry->cached;
+  pthread_mutex_unlock( &cacheLock );
+
+  if ( last )
+    freeEntry( entry );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Requests
+
+/** Write function for a program's output and error streams, sending
+    whatever the stream has buffered to the client in a frame. */
+static ssize_t writeStream( void *cookie, char const *data, size_t size )
+{
+  Stream *stream = cookie;
+  if ( !writeFrame( stream->fd, stream->type, data, size ) )
+    return -1;
+  return size;
+}
+
+/** Make a stream that sends everything written to it to the client
+    in frames of the given type. */
+static FILE *openStream( Stream *stream, int fd, char type, int mode )
+{
+  stream->fd = fd;
+  stream->type = type;
+  cookie_io_functions_t io = { NULL, writeStream, NULL, NULL };
+  FILE *fp = fopencookie( stream, "w", io );
+  if ( fp )
+    setvbuf( fp, NULL, mode, OUTPUT_BUFFER );
+  return fp;
+}
+
+/** Free the memory for a request. */
+static void freeRequest( Request *req )
+{
+  for ( int i = 0; i < req->count; i++ )
+    free( req->vars[ i ] );
+  free( req->vars );
+  free( req->source );
+}
+
+/** Read a request from a client, up to its source or path frame.
+    @return true if we got a whole request.
+*/
+static bool readRequest( int fd, Request *req )
+{
+  *req = (Request) { NULL, 0, 0, NULL, 0, false };
+
+  char type;
+  char *data;
+  int len;
+  while ( readFrame( fd, &type, &data, &len ) ) {
+    if ( type == FRAME_SOURCE || type == FRAME_PATH ) {
+      req->source = data;
+      req->len = len;
+      req->path = type == FRAME_PATH;
+      return true;
+    }
+
+    if ( type != FRAME_VARIABLE ) {
+      free( data );
+      break;
+    }
+
+    if ( req->count >= req->cap ) {
+      req->cap = req->cap ? req->cap * 2 : INITIAL_CAPACITY;
+      req->vars = (char **) realloc( req->vars, req->cap * sizeof( char * ) );
+    }
+    req->vars[ req->count++ ] = data;
+  }
+
+  freeRequest( req );
+  return false;
+}
+
+/** Split each variable in a request into a name and a value.
+    @return true if they were all name=value settings.
+*/
+static bool splitVariables( Request *req, FILE *err )
+{
+  for ( int i = 0; i < req->count; i++ ) {
+    char *eq = strchr( req->vars[ i ], '=' );
+    if ( !eq || eq == req->vars[ i ] ) {
+      fprintf( err, "Invalid parameter: %s\n", req->vars[ i ] );
+      return false;
+    }
+    *eq = '\0';
+  }
+  return true;
+}
+
+/** Replace the path in a request with the contents of that file.
+    @return true if we could read the file.
+*/
+static bool readSource( Request *req, FILE *err )
+{
+  FILE *fp = fopen( req->source, "r" );
+  if ( !fp ) {
+    fprintf( err, "Can't open file: %s\n", req->source );
+    return false;
+  }
+
+  int cap = INITIAL_SOURCE;
+  char *source = (char *) malloc( cap );
+  int len = 0;
+  size_t n;
+  while ( ( n = fread( source + len, 1, cap - len - 1, fp ) ) > 0 ) {
+    len += n;
+    if ( len + 1 == cap )
+      source = (char *) realloc( source, cap *= 2 );
+  }
+  source[ len ] = '\0';
+  fclose( fp );
+
+  free( req->source );
+  req->source = source;
+  req->len = len;
+  req->path = false;
+  return true;
+}
+
+/** Make the cache key for a request, the names of its variables each
+    followed by a null character, then another null and its source. */
+static char *makeKey( Request const *req, int *keyLen )
+{
+  int len = 1 + req->len;
+  for ( int i = 0; i < req->count; i++ )
+    len += strlen( req->vars[ i ] ) + 1;
+
+  char *key = (char *) malloc( len );
+  char *end = key;
+  for ( int i = 0; i < req->count; i++ ) {
+    int n = strlen( req->vars[ i ] ) + 1;
+    memcpy( end, req->vars[ i ], n );
+    end += n;
+  }
+  *end++ = '\0';
+  memcpy( end, req->source, req->len );
+
+  *keyLen = len;
+  return key;
+}
+
+/** Run a program in a new context with the variables from a request.
+    @return exit status for the program.
+*/
+static int runRequest( Expr *expr, Request const *req, FILE *out, FILE *err )
+{
+  Context *ctxt = makeContext();
+  setContextStreams( ctxt, out, err );
+  jmp_buf onRuntimeError;
+  setErrorHandler( ctxt, &onRuntimeError );
+
+  for ( int i = 0; i < req->count; i++ )
+    setVariable( ctxt, req->vars[ i ],
+                 req->vars[ i ] + strlen( req->vars[ i ] ) + 1 );
+
+  int status = EXIT_SUCCESS;
+  if ( setjmp( onRuntimeError ) == 0 )
+    expr->exec( expr, ctxt );
+  else
+    status = EXIT_FAILURE;
+
+  freeContext( ctxt );
+  return status;
+}
+
+/** Build a request's program, or find it in the cache, then run it.
+    @return exit status for the program.
+*/
+static int handleRequest( Client *client, Request *req, FILE *out, FILE *err )
+{
+  if ( !splitVariables( req, err ) )
+    return EXIT_FAILURE;
+  if ( req->path && !readSource( req, err ) )
+    return EXIT_FAILURE;
+
+  int keyLen;
+  char *key = makeKey( req, &keyLen );
+  unsigned hash = hashString( key, keyLen );
+
+  Entry *entry = acquireProgram( key, keyLen, hash );
+  if ( entry ) {
+    free( key );
+  } else {
+    char const **inputs = (char const **)
+      malloc( ( req->count + 1 ) * sizeof( char * ) );
+    for ( int i = 0; i < req->count; i++ )
+      inputs[ i ] = req->vars[ i ];
+
+    FILE *fp = fmemopen( req->source, req->len, "r" );
+    Expr *expr = fp ? client->build( fp, err, inputs, req->count,
+                                     client->arg ) : NULL;
+    if ( fp )
+      fclose( fp );
+    free( inputs );
+
+    // Programs with syntax errors aren't worth keeping.
+    if ( !expr ) {
+      free( key );
+      return EXIT_FAILURE;
+    }
+    entry = insertProgram( key, keyLen, hash, expr );
+  }
+
+  int status = runRequest( entry->expr, req, out, err );
+  releaseProgram( entry );
+  return status;
+}
+
+/** Serve requests from one client until it hangs up. */
+static void *serveClient( void *arg )
+{
+  Client *client = arg;
+
+  Request req;
+  while ( readRequest( client->fd, &req ) ) {
+    Stream outStream, errStream;
+    FILE *out = openStream( &outStream, client->fd, FRAME_OUTPUT, _IOFBF );
+    FILE *err = openStream( &errStream, client->fd, FRAME_ERROR, _IOLBF );
+
+    int status = EXIT_FAILURE;
+    if ( out && err )
+      status = handleRequest( client, &req, out, err );
+
+    if ( out )
+      fclose( out );
+    if ( err )
+      fclose( err );
+    freeRequest( &req );
+
+    char text[ 12 ];
+    int len = sprintf( text, "%d", status );
+    if ( !out || !err || !writeFrame( client->fd, FRAME_STATUS, text, len ) )
+      break;
+  }
+
+  close( client->fd );
+  free( client );
+
+  // Give back this thread's pooled strings before it goes away.
+  freePool();
+  return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Server
+
+int serve( char const *path, BuildFunction build, void *arg )
+{
+  // A client that hangs up early shouldn't take the server with it.
+  signal( SIGPIPE, SIG_IGN );
+
+  struct sockaddr_un addr;
+  memset( &addr, 0, sizeof( addr ) );
+  addr.sun_family = AF_UNIX;
+
+  int sock = -1;
+  if ( strlen( path ) < sizeof( addr.sun_path ) ) {
+    strcpy( addr.sun_path, path );
+    unlink( path );
+    sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+  }
+
+  if ( sock < 0 ||
+       bind( sock, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ||
+       listen( sock, SOMAXCONN ) != 0 ) {
+    fprintf( stderr, "Can't serve on socket: %s\n", path );
+    if ( sock >= 0 )
+      close( sock );
+    return EXIT_FAILURE;
+  }
+
+  while ( true ) {
+    int fd = accept( sock, NULL, NULL );
+    if ( fd < 0 )
+      continue;
+
+    Client *client = (Client *) malloc( sizeof( Client ) );
+    *client = (Client) { fd, build, arg };
+
+    // If we can't start a thread for this client, we serve it here.
+    pthread_t thread;
+    if ( pthread_create( &thread, NULL, serveClient, client ) == 0 )
+      pthread_detach( thread );
+    else
+      serveClient( client );
+  }
+}
@@ -0,0 +1,45 @@
+/**
+  @file server.h
+
+  Server mode for the interpreter.  The server listens on a Unix
+  socket and runs programs for its clients, using the protocol in
+  frame.h, so a short program doesn't have to pay for starting a new
+  process.  Programs it has built recently are kept in a cache, keyed
+  by their source text and the variables set before they start, so a
+  program that's run again doesn't have to be parsed and optimized
+  again.  Every run gets a fresh context, and clients are served on
+  threads of their own, so cached programs are shared by threads
+  that may be running them at the same time.
+*/
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdio.h>
+
+#include "core.h"
+
+/** Function the server calls to parse and optimize a program.  The
+    program it returns must not change as it's evaluated, since it
+    may run on several threads at once.
+    @param fp stream to read the program's source from.
+    @param err stream for syntax errors.
+    @param inputs names of variables that will be set before the
+    program starts.
+    @param inputCount number of names in inputs.
+    @param arg value passed to serve().
+    @return the program, or NULL if it had a syntax error.
+*/
+typedef Expr *(*BuildFunction)( FILE *fp, FILE *err, char const **inputs,
+                                int inputCount, void *arg );
+
+/** Serve requests on a Unix socket, until the process is killed.
+    @param path name for the socket.  Anything already there is
+    removed first.
+    @param build function to build each program.
+    @param arg value passed to every call to build.
+    @return exit status, only if we couldn't start serving.
+*/
+int serve( char const *path, BuildFunction build, void *arg );
+
+#endif
@@ -9,14 +9,25 @@ if [ $? -ne 0 ]; then
   FAIL=1
 fi
 
+# check the number conversions against the library
+make numtest
+if [ $? -ne 0 ] || ! ./numtest; then
+  echo "**** Number conversion test FAILED"
+  FAIL=1
+fi
+
 # Function to run the program against a (successful) test case.
 runtest() {
   TEST_NO=$1
 
+  # Anything after the test number is passed as options.
+  shift
+  OPTS="${*:+$* }"
+
   rm -f output.txt stderr.txt
 
-  echo "Test $TEST_NO: ./interpreter prog_$TEST_NO.txt > output.txt 2> stderr.txt"
-  ./interpreter prog_$TEST_NO.txt > output.txt 2> stderr.txt
+  echo "Test $TEST_NO: ./interpreter ${OPTS}prog_$TEST_NO.txt > output.txt 2> stderr.txt"
+  ./interpreter ${OPTS}prog_$TEST_NO.txt > output.txt 2> stderr.txt
   STATUS=$?
 
   # Program should have succeeded.
@@ -99,6 +110,29 @@ runtest 11
 
 # There's a test_12.txt, but it's too slow to test with every time.
 
+runtest 13
+runtest 14
+runtest 15
+runtest 16
+runtest 17
+runtest 18
+runtest 19 --memo
+runtest 33
+runtest 34
+runtest 35
+runtest 36
+runtest 37
+runtest 38
+runtest 39
+runtest 40
+runtest 40 --async-output
+runtest 41 --sweep params_41.txt
+
+# The same programs run by the non-recursive evaluator.
+runtest 35 --iterative
+runtest 36 --iterative
+runtest 37 --iterative
+
 # Tests for error cases.
 rm -f output.txt stderr.txt
 echo "Test 20: ./interpreter prog_20.txt > output.txt 2> stderr.txt"
@@ -143,6 +177,166 @@ echo "Test 26: ./interpreter prog_26.txt > output.txt 2> stderr.txt"
 STATUS=$?
 checkerror 26 $STATUS
 
+# output written by the writer thread still has to come out before the error.
+rm -f output.txt stderr.txt
+echo "Test 26: ./interpreter --async-output prog_26.txt > output.txt 2> stderr.txt"
+./interpreter --async-output prog_26.txt > output.txt 2> stderr.txt
+STATUS=$?
+checkerror 26 $STATUS
+
+rm -f output.txt stderr.txt
+echo "Test 27: ./interpreter prog_27.txt > output.txt 2> stderr.txt"
+./interpreter prog_27.txt > output.txt 2> stderr.txt
+STATUS=$?
+checkerror 27 $STATUS
+
+# A runtime error has to get out of the non-recursive evaluator, too.
+rm -f output.txt stderr.txt
+echo "Test 27: ./interpreter --iterative prog_27.txt > output.txt 2> stderr.txt"
+./interpreter --iterative prog_27.txt > output.txt 2> stderr.txt
+STATUS=$?
+checkerror 27 $STATUS
+
+# A program nested far too deeply to parse or run recursively, made
+# on the fly: a print of 300001 nots around an empty string.
+rm -f output.txt deep.txt
+echo "Test deep: ./interpreter --iterative deep.txt > output.txt"
+{ echo "print"; yes "not" | head -n 300001; echo '""'; } > deep.txt
+./interpreter --iterative deep.txt > output.txt
+if [ $? -ne 0 ] || [ "$(cat output.txt)" != "true" ]; then
+  echo "**** Test deep FAILED"
+  FAIL=1
+else
+  echo "Test deep PASS"
+fi
+rm -f deep.txt
+
+# A program big enough to parse in parallel, with brackets, quotes
+# and comment characters where the pre-scan has to skip them, then
+# the same with a syntax error in the middle.
+STMTS='set s "{ \" # }" # } {
+set x add x 1'
+rm -f output.txt big.txt
+echo "Test big: ./interpreter --parse-threads 4 big.txt > output.txt"
+{ echo "{"; yes "$STMTS" | head -n 200000; echo "print x }"; } > big.txt
+./interpreter --parse-threads 4 big.txt > output.txt
+if [ $? -ne 0 ] || [ "$(cat output.txt)" != "100000" ]; then
+  echo "**** Test big FAILED"
+  FAIL=1
+else
+  echo "Test big PASS"
+fi
+echo "Test big error: ./interpreter --parse-threads 4 big.txt 2> stderr.txt"
+{ echo "{"; yes "$STMTS" | head -n 100000; echo "print 1x";
+  yes "$STMTS" | head -n 100000; echo "print x }"; } > big.txt
+./interpreter --parse-threads 4 big.txt > output.txt 2> stderr.txt
+if [ $? -eq 0 ] || [ "$(cat stderr.txt)" != 'line 100002: invalid token "1x"' ]; then
+  echo "**** Test big error FAILED"
+  FAIL=1
+else
+  echo "Test big error PASS"
+fi
+rm -f big.txt
+
+# Run a few of the tests at once in batch mode, checking each one's
+# output and error files and the exit status reported for it.  Then
+# do the same with the programs taking turns as green threads, with
+# turns short enough that they're all interleaved.
+BATCH="01 13 26 34 40"
+for MODE in "--batch" "--green --quantum 50"; do
+  echo "Batch: ./interpreter $MODE $(for t in $BATCH; do echo -n "prog_$t.txt "; done)> output.txt"
+  ./interpreter $MODE $(for t in $BATCH; do echo "prog_$t.txt"; done) > output.txt
+  STATUS=$?
+  for t in $BATCH; do
+    EXPECT=0
+    if [ -f expected_err_$t.txt ]; then
+      EXPECT=1
+      diff -q expected_err_$t.txt prog_$t.txt.err >/dev/null 2>&1 || {
+        echo "**** Batch test $t FAILED - incorrect error message"
+        FAIL=1
+      }
+    elif [ -s prog_$t.txt.err ]; then
+      echo "**** Batch test $t FAILED - shouldn't print anything to stderr"
+      FAIL=1
+    fi
+    diff -q expected_$t.txt prog_$t.txt.out >/dev/null 2>&1 || {
+      echo "**** Batch test $t FAILED - program output didn't match expected output."
+      FAIL=1
+    }
+    grep -q "^prog_$t.txt $EXPECT\( \|$\)" output.txt || {
+      echo "**** Batch test $t FAILED - wrong exit status reported."
+      FAIL=1
+    }
+    rm -f prog_$t.txt.out prog_$t.txt.err
+  done
+  if [ $STATUS -eq 0 ]; then
+    echo "**** Batch FAILED - should have exited unsuccessfully."
+    FAIL=1
+  fi
+done
+
+# Run a deeply nested program as a green thread next to a short one.
+# Each task needs as much stack as a program run on its own would get.
+rm -f output.txt deep.txt deep.txt.out deep.txt.err
+echo "Green deep: ./interpreter --green prog_05.txt deep.txt > output.txt"
+{ echo "{ print"; yes 'concat "a"' | head -n 20000; echo '"x" }'; } > deep.txt
+./interpreter --green prog_05.txt deep.txt > output.txt
+if [ $? -ne 0 ] || ! grep -q "^prog_05.txt 0 " output.txt ||
+   ! grep -q "^deep.txt 0 " output.txt ||
+   ! diff -q expected_05.txt prog_05.txt.out >/dev/null 2>&1 ||
+   [ "$(wc -c < deep.txt.out)" -ne 20001 ] ||
+   [ "$(tr -d a < deep.txt.out)" != "x" ]; then
+  echo "**** Green deep FAILED"
+  FAIL=1
+else
+  echo "Green deep PASS"
+fi
+rm -f deep.txt deep.txt.out deep.txt.err prog_05.txt.out prog_05.txt.err
+
+# Run some of the tests through server mode, with loadgen as the
+# client, then put the server under a little load.  Running the same
+# program with more sets of variables than the server caches makes it
+# evict programs along the way.
+make loadgen
+if [ $? -ne 0 ]; then
+  echo "**** Make (loadgen) FAILED"
+  FAIL=1
+fi
+rm -f test.sock
+echo "Server: ./interpreter --serve test.sock &"
+./interpreter --serve test.sock &
+SERVER=$!
+for i in $(seq 50); do
+  [ -S test.sock ] && break
+  sleep 0.1
+done
+for t in 01 13 34 40; do
+  ./loadgen test.sock prog_$t.txt > output.txt 2> stderr.txt
+  if [ $? -ne 0 ] || ! diff -q expected_$t.txt output.txt >/dev/null 2>&1 ||
+     [ -s stderr.txt ]; then
+    echo "**** Server test $t FAILED"
+    FAIL=1
+  fi
+done
+./loadgen test.sock prog_20.txt > output.txt 2> stderr.txt
+if [ $? -eq 0 ] || ! diff -q expected_err_20.txt stderr.txt >/dev/null 2>&1; then
+  echo "**** Server test 20 FAILED"
+  FAIL=1
+fi
+for i in $(seq 70); do
+  ./loadgen -D v$i=$i test.sock prog_01.txt 2 > /dev/null || {
+    echo "**** Server test with -D v$i FAILED"
+    FAIL=1
+  }
+done
+./loadgen test.sock prog_13.txt 500 4 || {
+  echo "**** Server load test FAILED"
+  FAIL=1
+}
+kill $SERVER
+wait $SERVER 2>/dev/null
+rm -f test.sock
+
 if [ $FAIL -ne 0 ]; then
   echo "FAILING TESTS!"
   exit 13
@@ -0,0 +1,940 @@
+#include "typed.h"
+#include "nodes.h"
+#include "pool.h"
+#include "number.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// For arithmetic operators, this is the maximum length of a long, printed
+// out as a decimal (with a sign).
+#define MAX_NUMBER 20
+
+/** Return a dynamically allocated string for the given long. */
+static char *formatLong( long val )
+{
+  char *result = allocString( MAX_NUMBER + 1 );
+  formatNumber( result, val );
+  return result;
+}
+
+/** Return a dynamically allocated string for the given bool. */
+static char *formatBool( bool val )
+{
+  char *result = allocString( MAX_NUMBER + 1 );
+  if ( val )
+    strcpy( result, "true" );
+  else
+    result[ 0 ] = '\0';
+  return result;
+}
+
+bool isIntExpr( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_INT_LITERAL:
+  case EXPR_INT_VARIABLE:
+  case EXPR_INT_SET:
+  case EXPR_INT_ADD:
+  case EXPR_INT_SUB:
+  case EXPR_INT_MUL:
+  case EXPR_INT_DIV:
+  case EXPR_INT_WHILE:
+  case EXPR_COUNTED_LOOP:
+  case EXPR_INT_ADD_CONST:
+  case EXPR_INT_MUL_CONST:
+  case EXPR_INT_SHIFT:
+  case EXPR_INT_DIV_CONST:
+  case EXPR_INCREMENT:
+  case EXPR_INT_SET_LITERAL:
+  case EXPR_INT_MEMO:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool isBoolExpr( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_INT_LESS:
+  case EXPR_INT_EQUAL:
+  case EXPR_BOOL_EQUAL:
+  case EXPR_BOOL_NOT:
+  case EXPR_BOOL_AND:
+  case EXPR_BOOL_OR:
+  case EXPR_BOOL_IF:
+  case EXPR_IF_LESS:
+    return true;
+  default:
+    return false;
+  }
+}
+
+long intValue( Expr *expr, Context *ctxt )
+{
+  if ( isIntExpr( expr ) )
+    return ( (IntExpr *)expr )->evalInt( expr, ctxt );
+
+  // Booleans are "true" or "", and neither of those parses.
+  if ( isBoolExpr( expr ) ) {
+    expr->evalCond( expr, ctxt );
+    return 0;
+  }
+
+  // Literals and variables can be parsed without copying them.
+  if ( expr->kind == EXPR_LITERAL )
+    return parseNumber( ( (LiteralExpr *)expr )->val );
+  if ( expr->kind == EXPR_VARIABLE ) {
+    VariableExpr *var = (VariableExpr *)expr;
+    return parseNumber( slotValue( cachedSlot( ctxt, var->op1, &var->cache ) ) );
+  }
+
+  // Anything else, we have to evaluate as a string.
+  Buffer *str = pushBuffer( ctxt );
+  expr->evalTo( expr, ctxt, str );
+  long val = parseNumber( str->data );
+  popBuffer( ctxt );
+  return val;
+}
+
+bool boolValue( Expr *expr, Context *ctxt )
+{
+  return expr->evalCond( expr, ctxt );
+}
+
+/** Shared eval for all the integer-valued nodes, computing the value
+    as a long and then printing it. */
+static char *evalIntExpr( Expr *expr, Context *ctxt )
+{
+  IntExpr *this = (IntExpr *)expr;
+  return formatLong( this->evalInt( expr, ctxt ) );
+}
+
+/** Shared evalTo for the integer-valued nodes, printing the value
+    straight into the destination. */
+static void evalToInt( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  IntExpr *this = (IntExpr *)expr;
+  char buffer[ MAX_NUMBER + 1 ];
+  appendBuffer( dest, buffer, formatNumber( buffer, this->evalInt( expr, ctxt ) ) );
+}
+
+/** Shared evalCond for the integer-valued nodes.  Integers always
+    print as at least one digit, so they're always true. */
+static bool evalIntCond( Expr *expr, Context *ctxt )
+{
+  IntExpr *this = (IntExpr *)expr;
+  this->evalInt( expr, ctxt );
+  return true;
+}
+
+/** Shared eval for all the boolean-valued nodes, which compute their
+    value in evalCond. */
+static char *evalBoolExpr( Expr *expr, Context *ctxt )
+{
+  return formatBool( expr->evalCond( expr, ctxt ) );
+}
+
+/** Shared evalTo for all the boolean-valued nodes. */
+static void evalToBool( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  if ( expr->evalCond( expr, ctxt ) )
+    appendString( dest, "true" );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer literals
+
+/** For integer literals, evalInt just returns the value we parsed at
+    construction time. */
+static long evalIntLiteral( Expr *expr, Context *ctxt )
+{
+  IntLiteralExpr *this = (IntLiteralExpr *)expr;
+  return this->num;
+}
+
+/** An integer literal is always true, with nothing to evaluate. */
+static bool condIntLiteral( Expr *expr, Context *ctxt )
+{
+  return true;
+}
+
+/** EvalTo for integer literals, appending the text we contain. */
+static void evalToIntLiteral( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  IntLiteralExpr *this = (IntLiteralExpr *)expr;
+  appendString( dest, this->val );
+}
+
+/** Exec for integer literals, which have nothing to do. */
+static void execIntLiteral( Expr *expr, Context *ctxt )
+{
+}
+
+/** Eval for integer literals, a copy of the text we contain. */
+static char *evalIntLiteralString( Expr *expr, Context *ctxt )
+{
+  IntLiteralExpr *this = (IntLiteralExpr *)expr;
+  return copyString( this->val );
+}
+
+/** Free memory for an integer literal. */
+static void destroyIntLiteral( Expr *expr )
+{
+  IntLiteralExpr *this = (IntLiteralExpr *)expr;
+  free( this->val );
+  free( this );
+}
+
+Expr *makeIntLiteral( char *val, long num )
+{
+  IntLiteralExpr *this = (IntLiteralExpr *) malloc( sizeof( IntLiteralExpr ) );
+  this->eval = evalIntLiteralString;
+  this->destroy = destroyIntLiteral;
+  this->kind = EXPR_INT_LITERAL;
+  this->evalCond = condIntLiteral;
+  this->exec = execIntLiteral;
+  this->evalTo = evalToIntLiteral;
+  this->evalInt = evalIntLiteral;
+
+  this->val = val;
+  this->num = num;
+
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer variables and assignment
+
+/** Free memory for an IntVariableExpr, read or assignment. */
+static void destroyIntVariable( Expr *expr )
+{
+  IntVariableExpr *this = (IntVariableExpr *)expr;
+  free( this->name );
+  if ( this->op )
+    this->op->destroy( this->op );
+  free( this );
+}
+
+/** Construct an IntVariableExpr and fill in the parts common to reads
+    and assignments. */
+static IntVariableExpr *buildIntVariableExpr( char const *name, Expr *op )
+{
+  IntVariableExpr *this = (IntVariableExpr *) malloc( sizeof( IntVariableExpr ) );
+  this->destroy = destroyIntVariable;
+  this->evalCond = evalIntCond;
+  this->exec = defaultExec;
+  this->evalTo = evalToInt;
+
+  this->name = (char *) malloc( strlen( name ) + 1 );
+  strcpy( this->name, name );
+  this->op = op;
+  initVarCache( &this->cache, this->name );
+
+  return this;
+}
+
+/** Read an integer variable as a long. */
+static long evalIntVariable( Expr *expr, Context *ctxt )
+{
+  IntVariableExpr *this = (IntVariableExpr *)expr;
+  return parseCanonical( slotValue( cachedSlot( ctxt, this->name, &this->cache ) ) );
+}
+
+/** Read an integer variable as a string, just a copy of its value. */
+static char *evalIntVariableString( Expr *expr, Context *ctxt )
+{
+  IntVariableExpr *this = (IntVariableExpr *)expr;
+  return copyString( slotValue( cachedSlot( ctxt, this->name, &this->cache ) ) );
+}
+
+/** Read an integer variable into a buffer, without parsing it. */
+static void evalToIntVariable( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  IntVariableExpr *this = (IntVariableExpr *)expr;
+  Str val = slotStr( cachedSlot( ctxt, this->name, &this->cache ) );
+  appendBuffer( dest, val.data, val.len );
+}
+
+Expr *makeIntVariable( char const *name )
+{
+  IntVariableExpr *this = buildIntVariableExpr( name, NULL );
+  this->eval = evalIntVariableString;
+  this->evalTo = evalToIntVariable;
+  this->kind = EXPR_INT_VARIABLE;
+  this->evalInt = evalIntVariable;
+  return (Expr *) this;
+}
+
+/** Assign an integer value, printing it to a local buffer rather than
+    a heap string. */
+static long evalIntSet( Expr *expr, Context *ctxt )
+{
+  IntVariableExpr *this = (IntVariableExpr *)expr;
+  long val = intValue( this->op, ctxt );
+
+  char buffer[ MAX_NUMBER + 1 ];
+  int len = formatNumber( buffer, val );
+  setSlotValue( cachedSlot( ctxt, this->name, &this->cache ), buffer, len );
+
+  return val;
+}
+
+Expr *makeIntSet( char const *name, Expr *expr )
+{
+  IntVariableExpr *this = buildIntVariableExpr( name, expr );
+  this->eval = evalIntExpr;
+  this->kind = EXPR_INT_SET;
+  this->evalInt = evalIntSet;
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Integer arithmetic
+
+/** Free memory for an IntBinaryExpr. */
+static void destroyIntBinary( Expr *expr )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *)expr;
+  this->op1->destroy( this->op1 );
+  this->op2->destroy( this->op2 );
+  free( this );
+}
+
+/** Construct an IntBinaryExpr and fill in the parts common to all of them. */
+static IntBinaryExpr *buildIntBinaryExpr( Expr *op1, Expr *op2 )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *) malloc( sizeof( IntBinaryExpr ) );
+  this->eval = evalIntExpr;
+  this->destroy = destroyIntBinary;
+  this->evalCond = evalIntCond;
+  this->exec = defaultExec;
+  this->evalTo = evalToInt;
+
+  this->op1 = op1;
+  this->op2 = op2;
+
+  return this;
+}
+
+/** evalInt for integer addition. */
+static long evalIntAdd( Expr *expr, Context *ctxt )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+  return a + b;
+}
+
+/** evalInt for integer subtraction. */
+static long evalIntSub( Expr *expr, Context *ctxt )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+  return a - b;
+}
+
+/** evalInt for integer multiplication. */
+static long evalIntMul( Expr *expr, Context *ctxt )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+  return a * b;
+}
+
+/** evalInt for integer division, with the same divide-by-zero check
+    as evalDiv(). */
+static long evalIntDiv( Expr *expr, Context *ctxt )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+
+  if ( b == 0 )
+    runtimeError( ctxt, "divide by zero" );
+
+  return a / b;
+}
+
+/** evalInt for while, the number of times the body runs. */
+static long evalIntWhile( Expr *expr, Context *ctxt )
+{
+  IntBinaryExpr *this = (IntBinaryExpr *)expr;
+
+  long count = 0;
+  bool counting = countingSteps( ctxt );
+  while ( boolValue( this->op1, ctxt ) ) {
+    this->op2->exec( this->op2, ctxt );
+    count++;
+    if ( counting )
+      countStep( ctxt );
+  }
+
+  return count;
+}
+
+/** Make an IntBinaryExpr with the given kind and evalInt function. */
+static Expr *makeIntBinary( ExprKind kind, long (*evalInt)( Expr *, Context * ),
+                            Expr *op1, Expr *op2 )
+{
+  IntBinaryExpr *this = buildIntBinaryExpr( op1, op2 );
+  this->kind = kind;
+  this->evalInt = evalInt;
+  return (Expr *) this;
+}
+
+Expr *makeIntAdd( Expr *op1, Expr *op2 )
+{
+  return makeIntBinary( EXPR_INT_ADD, evalIntAdd, op1, op2 );
+}
+
+Expr *makeIntSub( Expr *op1, Expr *op2 )
+{
+  return makeIntBinary( EXPR_INT_SUB, evalIntSub, op1, op2 );
+}
+
+Expr *makeIntMul( Expr *op1, Expr *op2 )
+{
+  return makeIntBinary( EXPR_INT_MUL, evalIntMul, op1, op2 );
+}
+
+Expr *makeIntDiv( Expr *op1, Expr *op2 )
+{
+  return makeIntBinary( EXPR_INT_DIV, evalIntDiv, op1, op2 );
+}
+
+Expr *makeIntWhile( Expr *cond, Expr *body )
+{
+  return makeIntBinary( EXPR_INT_WHILE, evalIntWhile, cond, body );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Arithmetic with a constant operand
+
+/* These do their arithmetic on unsigned longs, so overflow wraps
+   around the same way the general operators do on our platform. */
+
+/** Free memory for an IntConstExpr. */
+static void destroyIntConst( Expr *expr )
+{
+  IntConstExpr *this = (IntConstExpr *)expr;
+  this->op->destroy( this->op );
+  free( this );
+}
+
+/** Make an IntConstExpr with the given kind and evalInt function. */
+static IntConstExpr *buildIntConstExpr( ExprKind kind,
+                                        long (*evalInt)( Expr *, Context * ),
+                                        Expr *op, long c )
+{
+  IntConstExpr *this = (IntConstExpr *) malloc( sizeof( IntConstExpr ) );
+  this->eval = evalIntExpr;
+  this->destroy = destroyIntConst;
+  this->kind = kind;
+  this->evalCond = evalIntCond;
+  this->exec = defaultExec;
+  this->evalTo = evalToInt;
+  this->evalInt = evalInt;
+
+  this->op = op;
+  this->c = c;
+  this->magic = 0;
+  this->shift = 0;
+  this->negate = false;
+
+  return this;
+}
+
+/** evalInt for adding a constant. */
+static long evalIntAddConst( Expr *expr, Context *ctxt )
+{
+  IntConstExpr *this = (IntConstExpr *)expr;
+  unsigned long a = intValue( this->op, ctxt );
+  return (long) ( a + (unsigned long) this->c );
+}
+
+/** evalInt for multiplying by a constant. */
+static long evalIntMulConst( Expr *expr, Context *ctxt )
+{
+  IntConstExpr *this = (IntConstExpr *)expr;
+  unsigned long a = intValue( this->op, ctxt );
+  return (long) ( a * (unsigned long) this->c );
+}
+
+/** evalInt for multiplying by plus or minus a power of two. */
+static long evalIntShift( Expr *expr, Context *ctxt )
+{
+  IntConstExpr *this = (IntConstExpr *)expr;
+  unsigned long a = intValue( this->op, ctxt );
+  a <<= this->shift;
+  return (long) ( this->negate ? 0 - a : a );
+}
+
+/** Return the high 64 bits of the 128-bit product of two longs.  This
+    uses a 128-bit integer if the compiler has one, or else builds the
+    product from 32-bit halves, like mulhs in Hacker's Delight. */
+static long mulHigh( long a, long b )
+{
+#ifdef __SIZEOF_INT128__
+  return (long) __extension__ ( ( (__int128) a * b ) >> 64 );
+#else
+  unsigned long a0 = a & 0xFFFFFFFFUL, b0 = b & 0xFFFFFFFFUL;
+  long a1 = a >> 32, b1 = b >> 32;
+  unsigned long w0 = a0 * b0;
+  long t = a1 * b0 + ( w0 >> 32 );
+  long w1 = t & 0xFFFFFFFFL, w2 = t >> 32;
+  w1 = a0 * b1 + w1;
+  return a1 * b1 + w2 + ( w1 >> 32 );
+#endif
+}
+
+/** evalInt for dividing by a constant.  This is the signed division
+    by a constant from chapter 10 of Hacker's Delight: take the high
+    half of the product with a magic number, correct for its sign,
+    shift, then round toward zero like C division does. */
+static long evalIntDivConst( Expr *expr, Context *ctxt )
+{
+  IntConstExpr *this = (IntConstExpr *)expr;
+  long n = intValue( this->op, ctxt );
+
+  long q = mulHigh( this->magic, n );
+  if ( this->c > 0 && this->magic < 0 )
+    q += n;
+  else if ( this->c < 0 && this->magic > 0 )
+    q -= n;
+  q >>= this->shift;
+
+  // Add one to negative quotients, so they round toward zero.
+  return q + (long) ( (unsigned long) q >> 63 );
+}
+
+Expr *makeIntAddConst( Expr *op, long c )
+{
+  return (Expr *) buildIntConstExpr( EXPR_INT_ADD_CONST, evalIntAddConst, op, c );
+}
+
+Expr *makeIntMulConst( Expr *op, long c )
+{
+  return (Expr *) buildIntConstExpr( EXPR_INT_MUL_CONST, evalIntMulConst, op, c );
+}
+
+Expr *makeIntShift( Expr *op, int k, bool negate )
+{
+  unsigned long c = 1UL << k;
+  IntConstExpr *this = buildIntConstExpr( EXPR_INT_SHIFT, evalIntShift, op,
+                                          (long) ( negate ? 0 - c : c ) );
+  this->shift = k;
+  this->negate = negate;
+  return (Expr *) this;
+}
+
+Expr *makeIntDivConst( Expr *op, long c )
+{
+  IntConstExpr *this = buildIntConstExpr( EXPR_INT_DIV_CONST, evalIntDivConst, op, c );
+
+  // Find the smallest power of two, 2^p, for which some multiplier
+  // M = ceil( 2^p / |c| ) gives the right quotient for every long.
+  unsigned long two63 = 1UL << 63;
+  unsigned long ad = c < 0 ? 0 - (unsigned long) c : (unsigned long) c;
+  unsigned long t = two63 + ( (unsigned long) c >> 63 );
+  unsigned long anc = t - 1 - t % ad;
+  unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+  unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+  unsigned long delta;
+  int p = 63;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if ( r1 >= anc ) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if ( r2 >= ad ) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while ( q1 < delta || ( q1 == delta && r1 == 0 ) );
+
+  this->magic = (long) ( c < 0 ? 0 - ( q2 + 1 ) : q2 + 1 );
+  this->shift = p - 64;
+
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Counted loops
+
+/** Free memory for a counted loop. */
+static void destroyCountedLoop( Expr *expr )
+{
+  CountedLoopExpr *this = (CountedLoopExpr *)expr;
+  free( this->name );
+  this->limit->destroy( this->limit );
+  if ( this->body )
+    this->body->destroy( this->body );
+  free( this );
+}
+
+/** Store the counter in its variable, the way the increment at the end
+    of the original loop body would have. */
+static void storeCounter( VarSlot *slot, long val )
+{
+  char buffer[ MAX_NUMBER + 1 ];
+  int len = formatNumber( buffer, val );
+  setSlotValue( slot, buffer, len );
+}
+
+/** evalInt for a counted loop, the number of times the body runs. */
+static long evalCountedLoop( Expr *expr, Context *ctxt )
+{
+  CountedLoopExpr *this = (CountedLoopExpr *)expr;
+
+  // Nothing in the body changes the limit, and only we change the
+  // counter, so we can read them both just once.
+  VarSlot *slot = cachedSlot( ctxt, this->name, &this->cache );
+  long counter = parseNumber( slotValue( slot ) );
+  long limit = intValue( this->limit, ctxt );
+
+  long count = 0;
+  bool counting = countingSteps( ctxt );
+  while ( counter < limit ) {
+    if ( this->body )
+      this->body->exec( this->body, ctxt );
+
+    counter = counter + this->step;
+    count++;
+    if ( counting )
+      countStep( ctxt );
+
+    if ( this->publish )
+      storeCounter( slot, counter );
+  }
+
+  // If the body never looked at the counter, it only needs to be
+  // stored once.  If the loop didn't run, the variable is unchanged.
+  if ( !this->publish && count > 0 )
+    storeCounter( slot, counter );
+
+  return count;
+}
+
+Expr *makeCountedLoop( char const *name, Expr *limit, long step, Expr *body,
+                       bool publish )
+{
+  CountedLoopExpr *this = (CountedLoopExpr *) malloc( sizeof( CountedLoopExpr ) );
+  this->eval = evalIntExpr;
+  this->destroy = destroyCountedLoop;
+  this->kind = EXPR_COUNTED_LOOP;
+  this->evalCond = evalIntCond;
+  this->exec = defaultExec;
+  this->evalTo = evalToInt;
+  this->evalInt = evalCountedLoop;
+
+  this->name = (char *) malloc( strlen( name ) + 1 );
+  strcpy( this->name, name );
+  initVarCache( &this->cache, this->name );
+  this->limit = limit;
+  this->step = step;
+  this->body = body;
+  this->publish = publish;
+
+  return (Expr *) this;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Boolean operators
+
+/** Free memory for a BoolBinaryExpr. */
+static void destroyBoolBinary( Expr *expr )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  this->op1->destroy( this->op1 );
+  if ( this->op2 )
+    this->op2->destroy( this->op2 );
+  free( this );
+}
+
+/** evalCond for less, comparing operands as longs. */
+static bool evalIntLess( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+  return a < b;
+}
+
+/** evalCond for equal, when both operands print as longs.  Two such
+    strings are identical exactly when their values are. */
+static bool evalIntEqual( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+  return a == b;
+}
+
+/** evalCond for equal, when both operands are "true" or "". */
+static bool evalBoolEqual( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  bool a = boolValue( this->op1, ctxt );
+  bool b = boolValue( this->op2, ctxt );
+  return a == b;
+}
+
+/** evalCond for not. */
+static bool evalBoolNot( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  return !boolValue( this->op1, ctxt );
+}
+
+/** evalCond for and, short circuiting like evalAnd(). */
+static bool evalBoolAnd( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  return boolValue( this->op1, ctxt ) && boolValue( this->op2, ctxt );
+}
+
+/** evalCond for or, short circuiting like evalOr(). */
+static bool evalBoolOr( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  return boolValue( this->op1, ctxt ) || boolValue( this->op2, ctxt );
+}
+
+/** evalCond for if.  Since the condition is "true" or "", so is the
+    value of the whole if. */
+static bool evalBoolIf( Expr *expr, Context *ctxt )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *)expr;
+  bool cond = boolValue( this->op1, ctxt );
+  if ( cond )
+    this->op2->exec( this->op2, ctxt );
+  return cond;
+}
+
+/** Make a BoolBinaryExpr with the given kind and evalCond function. */
+static Expr *makeBoolBinary( ExprKind kind, bool (*evalCond)( Expr *, Context * ),
+                             Expr *op1, Expr *op2 )
+{
+  BoolBinaryExpr *this = (BoolBinaryExpr *) malloc( sizeof( BoolBinaryExpr ) );
+  this->eval = evalBoolExpr;
+  this->destroy = destroyBoolBinary;
+  this->kind = kind;
+  this->evalCond = evalCond;
+  this->exec = defaultExec;
+  this->evalTo = evalToBool;
+
+  this->op1 = op1;
+  this->op2 = op2;
+
+  return (Expr *) this;
+}
+
+Expr *makeIntLess( Expr *op1, Expr *op2 )
+{
+  return makeBoolBinary( EXPR_INT_LESS, evalIntLess, op1, op2 );
+}
+
+Expr *makeIntEqual( Expr *op1, Expr *op2 )
+{
+  return makeBoolBinary( EXPR_INT_EQUAL, evalIntEqual, op1, op2 );
+}
+
+Expr *makeBoolEqual( Expr *op1, Expr *op2 )
+{
+  return makeBoolBinary( EXPR_BOOL_EQUAL, evalBoolEqual, op1, op2 );
+}
+
+Expr *makeBoolNot( Expr *op )
+{
+  return makeBoolBinary( EXPR_BOOL_NOT, evalBoolNot, op, NULL );
+}
+
+Expr *makeBoolAnd( Expr *op1, Expr *op2 )
+{
+  return makeBoolBinary( EXPR_BOOL_AND, evalBoolAnd, op1, op2 );
+}
+
+Expr *makeBoolOr( Expr *op1, Expr *op2 )
+{
+  return makeBoolBinary( EXPR_BOOL_OR, evalBoolOr, op1, op2 );
+}
+
+Expr *makeBoolIf( Expr *cond, Expr *body )
+{
+  return makeBoolBinary( EXPR_BOOL_IF, evalBoolIf, cond, body );
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fused statements
+
+/** Free memory for an increment. */
+static void destroyIncrement( Expr *expr )
+{
+  IncrementExpr *this = (IncrementExpr *)expr;
+  free( this->name );
+  free( this );
+}
+
+/** evalInt for an increment: find the variable once, then read,
+    add and store. */
+static long evalIncrement( Expr *expr, Context *ctxt )
+{
+  IncrementExpr *this = (IncrementExpr *)expr;
+  VarSlot *slot = cachedSlot( ctxt, this->name, &this->cache );
+
+  // Add as unsigned, so overflow wraps like it does for add.
+  unsigned long val = parseCanonical( slotValue( slot ) );
+  long result = (long) ( val + (unsigned long) this->c );
+
+  char buffer[ MAX_NUMBER + 1 ];
+  int len = formatNumber( buffer, result );
+  setSlotValue( slot, buffer, len );
+  return result;
+}
+
+Expr *makeIncrement( char const *name, long c )
+{
+  IncrementExpr *this = (IncrementExpr *) malloc( sizeof( IncrementExpr ) );
+  this->eval = evalIntExpr;
+  this->destroy = destroyIncrement;
+  this->kind = EXPR_INCREMENT;
+  this->evalCond = evalIntCond;
+  this->exec = defaultExec;
+  this->evalTo = evalToInt;
+  this->evalInt = evalIncrement;
+
+  this->name = (char *) malloc( strlen( name ) + 1 );
+  strcpy( this->name, name );
+  initVarCache( &this->cache, this->name );
+  this->c = c;
+
+  return (Expr *) this;
+}
+
+/** Free memory for an assignment of a literal. */
+static void destroySetLiteral( Expr *expr )
+{
+  SetLiteralExpr *this = (SetLiteralExpr *)expr;
+  free( this->name );
+  free( this->val );
+  free( this );
+}
+
+/** Store the literal in the variable. */
+static void storeLiteral( SetLiteralExpr *this, Context *ctxt )
+{
+  setSlotValue( cachedSlot( ctxt, this->name, &this->cache ), this->val,
+                this->len );
+}
+
+/** Eval for an assignment of a literal, a copy of the literal. */
+static char *evalSetLiteral( Expr *expr, Context *ctxt )
+{
+  SetLiteralExpr *this = (SetLiteralExpr *)expr;
+  storeLiteral( this, ctxt );
+  return copyString( this->val );
+}
+
+/** evalCond for an assignment of a literal, which we can check
+    without copying it. */
+static bool condSetLiteral( Expr *expr, Context *ctxt )
+{
+  SetLiteralExpr *this = (SetLiteralExpr *)expr;
+  storeLiteral( this, ctxt );
+  return this->len != 0;
+}
+
+/** EvalTo for an assignment of a literal, appending the literal. */
+static void evalToSetLiteral( Expr *expr, Context *ctxt, Buffer *dest )
+{
+  SetLiteralExpr *this = (SetLiteralExpr *)expr;
+  storeLiteral( this, ctxt );
+  appendBuffer( dest, this->val, this->len );
+}
+
+/** Exec for an assignment of a literal, which just stores it. */
+static void execSetLiteral( Expr *expr, Context *ctxt )
+{
+  storeLiteral( (SetLiteralExpr *)expr, ctxt );
+}
+
+/** evalInt for an assignment of an integer literal. */
+static long evalIntSetLiteral( Expr *expr, Context *ctxt )
+{
+  SetLiteralExpr *this = (SetLiteralExpr *)expr;
+  storeLiteral( this, ctxt );
+  return this->num;
+}
+
+Expr *makeSetLiteral( char const *name, char *val, bool isInt, long num )
+{
+  SetLiteralExpr *this = (SetLiteralExpr *) malloc( sizeof( SetLiteralExpr ) );
+  this->eval = evalSetLiteral;
+  this->destroy = destroySetLiteral;
+  this->kind = isInt ? EXPR_INT_SET_LITERAL : EXPR_SET_LITERAL;
+  this->evalCond = condSetLiteral;
+  this->exec = execSetLiteral;
+  this->evalTo = evalToSetLiteral;
+  this->evalInt = isInt ? evalIntSetLiteral : NULL;
+
+  this->name = (char *) malloc( strlen( name ) + 1 );
+  strcpy( this->name, name );
+  initVarCache( &this->cache, this->name );
+  this->val = val;
+  this->len = strlen( val );
+  this->num = num;
+
+  return (Expr *) this;
+}
+
+/** Free memory for a fused if. */
+static void destroyIfLess( Expr *expr )
+{
+  IfLessExpr *this = (IfLessExpr *)expr;
+  this->op1->destroy( this->op1 );
+  this->op2->destroy( this->op2 );
+  this->body->destroy( this->body );
+  free( this );
+}
+
+/** evalCond for a fused if, comparing its operands directly and
+    running the body if the comparison comes out the right way. */
+static bool evalIfLess( Expr *expr, Context *ctxt )
+{
+  IfLessExpr *this = (IfLessExpr *)expr;
+  long a = intValue( this->op1, ctxt );
+  long b = intValue( this->op2, ctxt );
+  bool cond = ( a < b ) != this->negate;
+  if ( cond )
+    this->body->exec( this->body, ctxt );
+  return cond;
+}
+
+Expr *makeIfLess( Expr *op1, Expr *op2, Expr *body, bool negate )
+{
+  IfLessExpr *this = (IfLessExpr *) malloc( sizeof( IfLessExpr ) );
+  this->eval = evalBoolExpr;
+  this->destroy = destroyIfLess;
+  this->kind = EXPR_IF_LESS;
+  this->evalCond = evalIfLess;
+  this->exec = defaultExec;
+  this->evalTo = evalToBool;
+
+  this->op1 = op1;
+  this->op2 = op2;
+  this->body = body;
+  this->negate = negate;
+
+  return (Expr *) this;
+}
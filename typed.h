@@ -0,0 +1,212 @@
+/**
+  @file typed.h
+
+  Type-specialized expression nodes.  The optimizer substitutes these
+  for the general nodes in extra.c when it can tell a subexpression
+  always produces an integer or a boolean ("true" or "").  They
+  evaluate to exactly the same strings as the nodes they replace, but
+  they can also hand their value to each other as a long or a bool,
+  skipping the string round-trip.  This is also where the optimizer
+  gets the counted loop it substitutes for simple while loops.
+*/
+
+#ifndef _TYPED_H_
+#define _TYPED_H_
+
+#include "core.h"
+
+/** Evaluate any expression and interpret its value as a long, the
+    same way the arithmetic operators do (zero if it doesn't parse).
+    Integer-valued nodes compute this directly, and literals and
+    variables are parsed in place without making a copy.
+    @param expr expression to evaluate.
+    @param ctxt current values of all variables.
+    @return value of the expression as a long.
+*/
+long intValue( Expr *expr, Context *ctxt );
+
+/** Evaluate any expression and report whether it is true (anything
+    but the empty string).  This is just the expression's evalCond.
+    @param expr expression to evaluate.
+    @param ctxt current values of all variables.
+    @return true if the expression evaluates to a non-empty string.
+*/
+bool boolValue( Expr *expr, Context *ctxt );
+
+/** Return true if the given expression is one of the integer-valued
+    nodes from this file, so it always evaluates to a long printed in
+    decimal.
+    @param expr expression to check.
+    @return true if expr can be used as an IntExpr.
+*/
+bool isIntExpr( Expr *expr );
+
+/** Return true if the given expression is one of the boolean-valued
+    nodes from this file, so it always evaluates to "true" or "".
+    @param expr expression to check.
+    @return true if expr always evaluates to "true" or "".
+*/
+bool isBoolExpr( Expr *expr );
+
+/** Make a literal for a string that's already in the form sprintf
+    would print for a long.
+    @param val text of the literal.  The expression will be responsible
+    for freeing it.
+    @param num value of the literal.
+    @return a new literal expression.
+ */
+Expr *makeIntLiteral( char *val, long num );
+
+/** Make an expression that reads a variable known to always hold an integer.
+    @param name the variable's name.
+    @return a new expression that evaluates to the variable's value.
+ */
+Expr *makeIntVariable( char const *name );
+
+/** Make a set expression whose value is known to be an integer.
+    @param name the variable's name.
+    @param expr integer-valued expression for the value to assign.
+    @return a new expression that assigns and evaluates to the value of expr.
+ */
+Expr *makeIntSet( char const *name, Expr *expr );
+
+/** Integer versions of add, sub, mul and div.  These behave just like
+    the nodes made by makeAdd(), makeSub(), makeMul() and makeDiv().
+    @param op1 expression for the left-hand operand
+    @param op2 expression for the right-hand operand
+    @return a new expression object for the operation.
+ */
+Expr *makeIntAdd( Expr *op1, Expr *op2 );
+Expr *makeIntSub( Expr *op1, Expr *op2 );
+Expr *makeIntMul( Expr *op1, Expr *op2 );
+Expr *makeIntDiv( Expr *op1, Expr *op2 );
+
+/** Integer version of less, behaving just like the node made by makeLess().
+    @param op1 expression for the left-hand operand
+    @param op2 expression for the right-hand operand
+    @return a new expression object that is either "true" or an empty string
+ */
+Expr *makeIntLess( Expr *op1, Expr *op2 );
+
+/** Version of equal for operands that are both known to evaluate to
+    integers, so they can be compared as longs.
+    @param op1 expression for the left-hand operand
+    @param op2 expression for the right-hand operand
+    @return a new expression object that is either "true" or an empty string
+ */
+Expr *makeIntEqual( Expr *op1, Expr *op2 );
+
+/** Version of equal for operands that are both known to evaluate to
+    "true" or "", so they can be compared as bools.
+    @param op1 expression for the left-hand operand
+    @param op2 expression for the right-hand operand
+    @return a new expression object that is either "true" or an empty string
+ */
+Expr *makeBoolEqual( Expr *op1, Expr *op2 );
+
+/** Boolean versions of not, and and or.  These behave just like the
+    nodes made by makeNot(), makeAnd() and makeOr().
+    @param op1 expression for the left-hand operand
+    @param op2 expression for the right-hand operand
+    @return a new expression object that is either "true" or an empty string
+ */
+Expr *makeBoolNot( Expr *op );
+Expr *makeBoolAnd( Expr *op1, Expr *op2 );
+Expr *makeBoolOr( Expr *op1, Expr *op2 );
+
+/** Version of if for a condition known to evaluate to "true" or "".
+    @param cond the condition to be evaluated
+    @param body the body to be evaluated if condition evaluates to true
+    @return a new expression object that is either "true" or an empty string
+ */
+Expr *makeBoolIf( Expr *cond, Expr *body );
+
+/** Version of while that tests its condition as a bool and counts
+    iterations as a long.  It behaves just like the node made by
+    makeWhile().
+    @param cond the condition to be evaluated
+    @param body the body to be evaluated while condition evaluates to true
+    @return a new expression object that evaluates to the number of iterations.
+ */
+Expr *makeIntWhile( Expr *cond, Expr *body );
+
+/** Make an expression that adds a constant to an integer.  This
+    computes the same value as makeAdd() with a literal operand.
+    @param op expression for the other operand.
+    @param c value to add.
+    @return a new integer-valued expression.
+ */
+Expr *makeIntAddConst( Expr *op, long c );
+
+/** Make an expression that multiplies an integer by a constant.
+    @param op expression for the other operand.
+    @param c value to multiply by.
+    @return a new integer-valued expression.
+ */
+Expr *makeIntMulConst( Expr *op, long c );
+
+/** Make an expression that multiplies an integer by a power of two
+    using a shift.
+    @param op expression for the other operand.
+    @param k power of two to multiply by, at least 1.
+    @param negate true to multiply by -2^k rather than 2^k.
+    @return a new integer-valued expression.
+ */
+Expr *makeIntShift( Expr *op, int k, bool negate );
+
+/** Make an expression that divides an integer by a constant, giving
+    the same truncated quotient as makeDiv(), but using a multiply and
+    shifts rather than a division.
+    @param op expression for the dividend.
+    @param c constant divisor.  This can't be 0, 1, -1 or LONG_MIN.
+    @return a new integer-valued expression.
+ */
+Expr *makeIntDivConst( Expr *op, long c );
+
+/** Make a fused node for set name add name c, which finds the
+    variable once and updates it in place.
+    @param name the variable's name.
+    @param c value to add.
+    @return a new integer-valued expression for the new value.
+ */
+Expr *makeIncrement( char const *name, long c );
+
+/** Make a fused node for assigning a literal to a variable, so the
+    literal's text is stored directly.
+    @param name the variable's name.
+    @param val text of the literal.  The expression will be responsible
+    for freeing it.
+    @param isInt true if val is exactly how sprintf would print num,
+    so the expression can be used as an integer.
+    @param num value of the literal, if isInt is true.
+    @return a new expression that evaluates to the literal.
+ */
+Expr *makeSetLiteral( char const *name, char *val, bool isInt, long num );
+
+/** Make a fused node for if less op1 op2 body, or (if negate is true)
+    if not less op1 op2 body.
+    @param op1 expression for the left-hand operand of less.
+    @param op2 expression for the right-hand operand of less.
+    @param body the body to be evaluated if the condition is true.
+    @param negate true to negate the comparison.
+    @return a new expression that evaluates to the condition.
+ */
+Expr *makeIfLess( Expr *op1, Expr *op2, Expr *body, bool negate );
+
+/** Make a loop equivalent to:
+      while less name limit { body set name add name step }
+    for a body that doesn't otherwise assign the counter or the limit.
+    The counter is kept as a long while the loop runs.
+    @param name name of the counter variable.
+    @param limit literal or variable expression for the limit.
+    @param step value added to the counter on each iteration.
+    @param body the rest of the loop body, or NULL if there's nothing
+    else in the body.
+    @param publish true if body uses the counter, so it has to be
+    stored in the context on every iteration rather than just at the end.
+    @return a new expression that evaluates to the number of iterations.
+ */
+Expr *makeCountedLoop( char const *name, Expr *limit, long step, Expr *body,
+                       bool publish );
+
+#endif
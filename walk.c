@@ -0,0 +1,508 @@
+#include "walk.h"
+#include "nodes.h"
+#include "extra.h"
+#include "number.h"
+#include "output.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+// Initial capacity for the stack of frames, and for the stack of
+// nodes waiting to be freed.
+#define INITIAL_FRAMES 64
+
+// Initial capacity for the table of node sizes, a power of two.
+#define INITIAL_SIZES 256
+
+/** A node the walker is part way through evaluating. */
+typedef struct {
+  /** The node, and the buffer its value gets appended to. */
+  Expr *expr;
+  Buffer *dest;
+
+  /** How far along we are with this node, starting from zero.  For
+      most nodes, this is the number of operands evaluated so far. */
+  int state;
+
+  /** Length of dest when we started on this node, for nodes that need
+      to look at their own value. */
+  int start;
+
+  /** Scratch buffers for operand values, from pushBuffer(). */
+  Buffer *ops[ 3 ];
+
+  /** For a while loop, the number of times the body has run, and
+      whether we're counting steps for the step hook. */
+  long count;
+  bool counting;
+} Frame;
+
+/** Whether a node is small enough to evaluate itself, as decided by
+    isSmall(). */
+typedef struct {
+  Expr *expr;
+  bool small;
+} Size;
+
+/** State for a run of walkProgram(). */
+typedef struct {
+  /** Stack of frames for nodes we're in the middle of. */
+  Frame *frames;
+  int depth;
+  int cap;
+
+  /** Hash table of the nodes we've decided the size of, with open
+      addressing.  Nodes don't change while the program runs, so we
+      only have to decide each one once. */
+  Size *sizes;
+  int sizeCount;
+  int sizeCap;
+} Walk;
+
+/** Start evaluating a node, appending its value to dest.  This may
+    move the frames, so pointers to them aren't good after a call. */
+static void pushFrame( Walk *walk, Expr *expr, Buffer *dest )
+{
+  if ( walk->depth >= walk->cap ) {
+    walk->cap *= 2;
+    walk->frames = (Frame *) realloc( walk->frames,
+                                      walk->cap * sizeof( Frame ) );
+  }
+
+  Frame *frame = walk->frames + walk->depth++;
+  frame->expr = expr;
+  frame->dest = dest;
+  frame->state = 0;
+}
+
+/** Return the number of subexpressions of a node built by the parser,
+    or zero for any other kind of node. */
+static int childCount( Expr *expr )
+{
+  switch ( expr->kind ) {
+  case EXPR_PRINT:
+  case EXPR_SET:
+  case EXPR_NOT:
+    return 1;
+  case EXPR_COMPOUND:
+    return ((CompoundExpr *)expr)->len;
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIV:
+  case EXPR_EQUAL:
+  case EXPR_LESS:
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_IF:
+  case EXPR_WHILE:
+  case EXPR_CONCAT:
+    return 2;
+  case EXPR_SUBSTR:
+    return 3;
+  default:
+    return 0;
+  }
+}
+
+/** Return a pointer to the field holding the given subexpression of a
+    node built by the parser. */
+static Expr **childSlot( Expr *expr, int i )
+{
+  switch ( expr->kind ) {
+  case EXPR_PRINT:
+    return &((PrintExpr *)expr)->arg;
+  case EXPR_SET:
+    return &((SetExpr *)expr)->op2;
+  case EXPR_NOT:
+    return &((UnaryExpr *)expr)->op;
+  case EXPR_COMPOUND:
+    return ((CompoundExpr *)expr)->eList + i;
+  case EXPR_SUBSTR: {
+    TrinaryExpr *this = (TrinaryExpr *)expr;
+    return i == 0 ? &this->op1 : i == 1 ? &this->op2 : &this->op3;
+  }
+  default: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    return i == 0 ? &this->op1 : &this->op2;
+  }
+  }
+}
+
+/** Return true if this expression is a literal or a variable. */
+static bool isLeaf( Expr *expr )
+{
+  return expr->kind == EXPR_LITERAL || expr->kind == EXPR_VARIABLE;
+}
+
+// How deeply nested a subexpression can be for the walker to let it
+// evaluate itself the usual way, recursing a little on the C stack.
+// Most of the work in a typical program is in small expressions like
+// these, and their own eval functions are faster than the walker.
+#define SMALL_DEPTH 3
+
+/** Return true if this is a parser node with no more than the given
+    depth of subexpressions below it.  Compound nodes can have any
+    number of subexpressions, so they never count as small. */
+static bool isSmall( Expr *expr, int depth )
+{
+  if ( isLeaf( expr ) )
+    return true;
+
+  int count = childCount( expr );
+  if ( depth == 0 || count == 0 || expr->kind == EXPR_COMPOUND )
+    return false;
+
+  for ( int i = 0; i < count; i++ )
+    if ( !isSmall( *childSlot( expr, i ), depth - 1 ) )
+      return false;
+  return true;
+}
+
+/** Return the slot in the table of sizes for the given node, either
+    the one where it is or the empty one where it should go. */
+static Size *findSize( Size *sizes, int cap, Expr *expr )
+{
+  unsigned i = (unsigned) ( (uintptr_t) expr >> 4 ) * 2654435761u;
+  while ( sizes[ i & ( cap - 1 ) ].expr &&
+          sizes[ i & ( cap - 1 ) ].expr != expr )
+    i++;
+  return sizes + ( i & ( cap - 1 ) );
+}
+
+/** Report whether this node is small enough to evaluate itself,
+    remembering the answer for next time. */
+static bool checkSmall( Walk *walk, Expr *expr )
+{
+  if ( isLeaf( expr ) )
+    return true;
+
+  Size *size = findSize( walk->sizes, walk->sizeCap, expr );
+  if ( size->expr )
+    return size->small;
+  size->expr = expr;
+  size->small = isSmall( expr, SMALL_DEPTH );
+  bool small = size->small;
+
+  // Keep the table no more than half full.
+  if ( ++walk->sizeCount * 2 > walk->sizeCap ) {
+    Size *old = walk->sizes;
+    int oldCap = walk->sizeCap;
+    walk->sizeCap *= 2;
+    walk->sizes = (Size *) calloc( walk->sizeCap, sizeof( Size ) );
+    for ( int i = 0; i < oldCap; i++ )
+      if ( old[ i ].expr )
+        *findSize( walk->sizes, walk->sizeCap, old[ i ].expr ) = old[ i ];
+    free( old );
+  }
+
+  return small;
+}
+
+/** Evaluate an operand, appending its value to dest.  A small operand
+    is evaluated right away, and anything else gets a frame of its
+    own, to be evaluated before the current frame's next step. */
+static void visit( Walk *walk, Context *ctxt, Expr *expr, Buffer *dest )
+{
+  if ( checkSmall( walk, expr ) )
+    expr->evalTo( expr, ctxt, dest );
+  else
+    pushFrame( walk, expr, dest );
+}
+
+/** Like visit(), for an operand whose value isn't needed.  Anything
+    that isn't small has its value written to the scratch buffer. */
+static void visitStatement( Walk *walk, Context *ctxt, Expr *expr,
+                            Buffer *scratch )
+{
+  if ( checkSmall( walk, expr ) )
+    expr->exec( expr, ctxt );
+  else
+    pushFrame( walk, expr, scratch );
+}
+
+/** Append the given long to a buffer. */
+static void writeCount( Buffer *dest, long val )
+{
+  char buffer[ MAX_DIGITS + 1 ];
+  appendBuffer( dest, buffer, formatNumber( buffer, val ) );
+}
+
+/** Take the next step on the frame at the top of the stack.  Each
+    step either pushes a frame for an operand, returning so that gets
+    evaluated first, or finishes the node and pops its frame. */
+static void step( Walk *walk, Context *ctxt )
+{
+  Frame *frame = walk->frames + walk->depth - 1;
+  Expr *expr = frame->expr;
+  Buffer *dest = frame->dest;
+
+  switch ( expr->kind ) {
+  case EXPR_PRINT:
+    // Evaluate the argument right into dest, then print what it wrote.
+    if ( frame->state++ == 0 ) {
+      frame->start = dest->len;
+      visit( walk, ctxt, ((PrintExpr *)expr)->arg, dest );
+    } else {
+      writeOutput( contextOutput( ctxt ), dest->data + frame->start,
+                   dest->len - frame->start );
+      walk->depth--;
+    }
+    break;
+
+  case EXPR_COMPOUND: {
+    CompoundExpr *this = (CompoundExpr *)expr;
+
+    // Every statement but the last one goes to a scratch buffer.
+    if ( frame->state == 0 )
+      frame->ops[ 0 ] = pushBuffer( ctxt );
+    else
+      truncateBuffer( frame->ops[ 0 ], 0 );
+
+    if ( frame->state + 1 < this->len )
+      visitStatement( walk, ctxt, this->eList[ frame->state++ ],
+                      frame->ops[ 0 ] );
+    else if ( frame->state < this->len )
+      visit( walk, ctxt, this->eList[ frame->state++ ], dest );
+    else {
+      popBuffer( ctxt );
+      walk->depth--;
+    }
+    break;
+  }
+
+  case EXPR_SET: {
+    SetExpr *this = (SetExpr *)expr;
+    if ( frame->state++ == 0 ) {
+      frame->start = dest->len;
+      visit( walk, ctxt, this->op2, dest );
+    } else {
+      setSlotValue( cachedSlot( ctxt, this->op1, &this->cache ),
+                    dest->data + frame->start, dest->len - frame->start );
+      walk->depth--;
+    }
+    break;
+  }
+
+  case EXPR_CONCAT: {
+    // Our value is just the values of the operands, one after the
+    // other, so they can go right into dest.
+    BinaryExpr *this = (BinaryExpr *)expr;
+    if ( frame->state == 0 ) {
+      frame->state = 1;
+      visit( walk, ctxt, this->op1, dest );
+    } else if ( frame->state == 1 ) {
+      frame->state = 2;
+      visit( walk, ctxt, this->op2, dest );
+    } else
+      walk->depth--;
+    break;
+  }
+
+  case EXPR_ADD:
+  case EXPR_SUB:
+  case EXPR_MUL:
+  case EXPR_DIV:
+  case EXPR_EQUAL:
+  case EXPR_LESS:
+  case EXPR_SUBSTR: {
+    int count = expr->kind == EXPR_SUBSTR ? 3 : 2;
+    if ( frame->state < count ) {
+      int i = frame->state++;
+      frame->ops[ i ] = pushBuffer( ctxt );
+      visit( walk, ctxt, *childSlot( expr, i ), frame->ops[ i ] );
+    } else {
+      Str vals[ 3 ];
+      for ( int i = 0; i < count; i++ )
+        vals[ i ] = bufferStr( frame->ops[ i ] );
+      writeOperator( expr->kind, ctxt, vals, dest );
+      for ( int i = 0; i < count; i++ )
+        popBuffer( ctxt );
+      walk->depth--;
+    }
+    break;
+  }
+
+  case EXPR_NOT:
+    if ( frame->state++ == 0 ) {
+      frame->ops[ 0 ] = pushBuffer( ctxt );
+      visit( walk, ctxt, ((UnaryExpr *)expr)->op, frame->ops[ 0 ] );
+    } else {
+      bool val = frame->ops[ 0 ]->len == 0;
+      popBuffer( ctxt );
+      if ( val )
+        appendBuffer( dest, "true", 4 );
+      walk->depth--;
+    }
+    break;
+
+  case EXPR_AND:
+  case EXPR_OR: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+    bool isAnd = expr->kind == EXPR_AND;
+    if ( frame->state == 0 ) {
+      frame->state = 1;
+      frame->ops[ 0 ] = pushBuffer( ctxt );
+      visit( walk, ctxt, this->op1, frame->ops[ 0 ] );
+      break;
+    }
+
+    // Only evaluate the right operand if the left one didn't decide it.
+    bool val = frame->ops[ 0 ]->len > 0;
+    if ( frame->state == 1 && val == isAnd ) {
+      frame->state = 2;
+      truncateBuffer( frame->ops[ 0 ], 0 );
+      visit( walk, ctxt, this->op2, frame->ops[ 0 ] );
+      break;
+    }
+
+    popBuffer( ctxt );
+    if ( val )
+      appendBuffer( dest, "true", 4 );
+    walk->depth--;
+    break;
+  }
+
+  case EXPR_IF: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+
+    // The condition's value is our value, so it goes right into dest.
+    if ( frame->state == 0 ) {
+      frame->state = 1;
+      frame->start = dest->len;
+      visit( walk, ctxt, this->op1, dest );
+    } else if ( frame->state == 1 && dest->len > frame->start ) {
+      frame->state = 2;
+      frame->ops[ 0 ] = pushBuffer( ctxt );
+      visitStatement( walk, ctxt, this->op2, frame->ops[ 0 ] );
+    } else {
+      if ( frame->state == 2 )
+        popBuffer( ctxt );
+      walk->depth--;
+    }
+    break;
+  }
+
+  case EXPR_WHILE: {
+    BinaryExpr *this = (BinaryExpr *)expr;
+
+    // State 1 means we just evaluated the condition into the scratch
+    // buffer, and state 2 means we just ran the body.
+    if ( frame->state == 0 ) {
+      frame->ops[ 0 ] = pushBuffer( ctxt );
+      frame->count = 0;
+      frame->counting = countingSteps( ctxt );
+    } else if ( frame->state == 2 ) {
+      frame->count++;
+      if ( frame->counting )
+        countStep( ctxt );
+    }
+
+    // A small condition can just be tested.  Anything else has to be
+    // evaluated on the stack first.
+    bool cond;
+    if ( frame->state == 1 )
+      cond = frame->ops[ 0 ]->len > 0;
+    else if ( checkSmall( walk, this->op1 ) )
+      cond = this->op1->evalCond( this->op1, ctxt );
+    else {
+      truncateBuffer( frame->ops[ 0 ], 0 );
+      frame->state = 1;
+      pushFrame( walk, this->op1, frame->ops[ 0 ] );
+      break;
+    }
+
+    if ( cond ) {
+      truncateBuffer( frame->ops[ 0 ], 0 );
+      frame->state = 2;
+      visitStatement( walk, ctxt, this->op2, frame->ops[ 0 ] );
+    } else {
+      popBuffer( ctxt );
+      writeCount( dest, frame->count );
+      walk->depth--;
+    }
+    break;
+  }
+
+  default:
+    // Not one of the parser's nodes, so let it evaluate itself.
+    expr->evalTo( expr, ctxt, dest );
+    walk->depth--;
+    break;
+  }
+}
+
+void walkProgram( Expr *expr, Context *ctxt )
+{
+  // The stack lives on the heap, with just a pointer here, so it's
+  // still good if we have to come back here after a runtime error.
+  Walk *walk = (Walk *) malloc( sizeof( Walk ) );
+  walk->cap = INITIAL_FRAMES;
+  walk->frames = (Frame *) malloc( walk->cap * sizeof( Frame ) );
+  walk->depth = 0;
+  walk->sizeCap = INITIAL_SIZES;
+  walk->sizes = (Size *) calloc( walk->sizeCap, sizeof( Size ) );
+  walk->sizeCount = 0;
+
+  // On a runtime error, free the stack then go wherever the error
+  // would have gone without us.
+  jmp_buf *outer = contextErrorHandler( ctxt );
+  jmp_buf onError;
+  if ( setjmp( onError ) ) {
+    free( walk->frames );
+    free( walk->sizes );
+    free( walk );
+    setErrorHandler( ctxt, outer );
+    if ( !outer )
+      exit( EXIT_FAILURE );
+    longjmp( *outer, 1 );
+  }
+  setErrorHandler( ctxt, &onError );
+
+  pushFrame( walk, expr, pushBuffer( ctxt ) );
+  while ( walk->depth > 0 )
+    step( walk, ctxt );
+  popBuffer( ctxt );
+
+  setErrorHandler( ctxt, outer );
+  free( walk->frames );
+  free( walk->sizes );
+  free( walk );
+}
+
+/** Destroy function for the placeholder below, which isn't really
+    allocated. */
+static void destroyDetached( Expr *expr )
+{
+}
+
+// Placeholder for a subexpression that's been taken out of its parent,
+// so freeing the parent doesn't free the subexpression too.
+static Expr detached = { .destroy = destroyDetached, .kind = EXPR_LITERAL };
+
+void destroyProgram( Expr *expr )
+{
+  int cap = INITIAL_FRAMES;
+  Expr **pending = (Expr **) malloc( cap * sizeof( Expr * ) );
+  int len = 0;
+  pending[ len++ ] = expr;
+
+  // Take each node's subexpressions out and save them for later, so
+  // freeing the node itself doesn't recurse.
+  while ( len > 0 ) {
+    Expr *node = pending[ --len ];
+    int count = childCount( node );
+    for ( int i = 0; i < count; i++ ) {
+      if ( len >= cap )
+        pending = (Expr **) realloc( pending, ( cap *= 2 ) * sizeof( Expr * ) );
+      Expr **slot = childSlot( node, i );
+      pending[ len++ ] = *slot;
+      *slot = &detached;
+    }
+    node->destroy( node );
+  }
+
+  free( pending );
+}
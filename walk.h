@@ -0,0 +1,31 @@
+/**
+  @file walk.h
+
+  A non-recursive evaluator.  The usual way to run a program is to
+  call exec on its top-level expression, which evaluates each
+  subexpression with a C function call, so a deeply nested program can
+  run out of stack.  This walks the tree with a stack of frames on the
+  heap instead, so it can run programs nested as deeply as memory
+  allows.  It handles all the nodes built by the parser itself.  Small
+  subexpressions, and any other node (from the optimizer), are
+  evaluated the usual way, so this is meant for programs that haven't
+  been optimized.
+*/
+
+#ifndef _WALK_H_
+#define _WALK_H_
+
+#include "core.h"
+
+/** Run a program without recursing on its nested subexpressions.
+    @param expr the program to run.
+    @param ctxt context to run it in.
+*/
+void walkProgram( Expr *expr, Context *ctxt );
+
+/** Free a program without recursing on its nested subexpressions.
+    @param expr the program to free.
+*/
+void destroyProgram( Expr *expr );
+
+#endif
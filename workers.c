@@ -0,0 +1,149 @@
+// For threads and sysconf().
+#define _POSIX_C_SOURCE 200809L
+
+#include "workers.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Short name for the whole pool, so a share can point back to it.
+typedef struct WorkersTag Workers;
+
+/** One worker's share of the jobs, the ones numbered from next up to
+    end.  The worker takes jobs from the front and thieves take them
+    from the back, so they only meet at the last job. */
+typedef struct {
+  /** Lock for next and end. */
+  pthread_mutex_t lock;
+
+  /** Range of jobs not taken yet. */
+  int next;
+  int end;
+
+  /** Number of the worker this share belongs to. */
+  int id;
+
+  /** The pool this share is part of. */
+  Workers *pool;
+
+  /** Thread running this worker, if we were able to start one. */
+  pthread_t thread;
+  bool started;
+} Share;
+
+/** Everything the workers need to know about the batch. */
+struct WorkersTag {
+  /** Share of the jobs for each worker. */
+  Share *shares;
+  int workers;
+
+  /** Function to run each job, and its argument. */
+  void (*job)( int index, void *arg );
+  void *arg;
+};
+
+int coreCount()
+{
+  long n = sysconf( _SC_NPROCESSORS_ONLN );
+  return n < 1 ? 1 : (int) n;
+}
+
+/** Take the next job from the front of our own share.
+    @return number of the job, or -1 if there aren't any left.
+*/
+static int takeJob( Share *share )
+{
+  int index = -1;
+  pthread_mutex_lock( &share->lock );
+  if ( share->next < share->end )
+    index = share->next++;
+  pthread_mutex_unlock( &share->lock );
+  return index;
+}
+
+/** Take a job from the back of some other worker's share, trying the
+    others in turn starting with the next one after us.
+    @return number of the job, or -1 if every share is empty.
+*/
+static int stealJob( Share *share )
+{
+  Workers *pool = share->pool;
+  for ( int i = 1; i < pool->workers; i++ ) {
+    Share *victim = pool->shares + ( share->id + i ) % pool->workers;
+
+    int index = -1;
+    pthread_mutex_lock( &victim->lock );
+    if ( victim->next < victim->end )
+      index = --victim->end;
+    pthread_mutex_unlock( &victim->lock );
+
+    if ( index >= 0 )
+      return index;
+  }
+  return -1;
+}
+
+/** Body of each worker thread.  Jobs are never added once we start,
+    so once there's nothing left to steal, we're done. */
+static void *runWorker( void *arg )
+{
+  Share *share = arg;
+  Workers *pool = share->pool;
+
+  int index;
+  while ( ( index = takeJob( share ) ) >= 0 ||
+          ( index = stealJob( share ) ) >= 0 )
+    pool->job( index, pool->arg );
+
+  // Give back this thread's pooled strings before it goes away.
+  freePool();
+  return NULL;
+}
+
+void runJobs( int count, int workers, void (*job)( int index, void *arg ),
+              void *arg )
+{
+  // No point in having more workers than jobs.
+  if ( workers > count )
+    workers = count;
+  if ( workers < 1 )
+    return;
+
+  Workers pool = { (Share *) malloc( workers * sizeof( Share ) ),
+                   workers, job, arg };
+
+  // Split the jobs up as evenly as we can.
+  for ( int i = 0; i < workers; i++ ) {
+    Share *share = pool.shares + i;
+    pthread_mutex_init( &share->lock, NULL );
+    share->next = (long) count * i / workers;
+    share->end = (long) count * ( i + 1 ) / workers;
+    share->id = i;
+    share->pool = &pool;
+  }
+
+  // If we can't make a thread for a worker, its share just gets
+  // stolen by the others.  If we can't make any, we do the work here.
+  int started = 0;
+  for ( int i = 0; i < workers; i++ ) {
+    Share *share = pool.shares + i;
+    share->started = pthread_create( &share->thread, NULL, runWorker,
+                                     share ) == 0;
+    if ( share->started )
+      started++;
+  }
+
+  if ( started == 0 )
+    runWorker( pool.shares );
+
+  for ( int i = 0; i < workers; i++ )
+    if ( pool.shares[ i ].started )
+      pthread_join( pool.shares[ i ].thread, NULL );
+
+  for ( int i = 0; i < workers; i++ )
+    pthread_mutex_destroy( &pool.shares[ i ].lock );
+  free( pool.shares );
+}
@@ -0,0 +1,31 @@
+/**
+  @file workers.h
+
+  A pool of worker threads for running lots of independent jobs,
+  like a batch of programs.  Each worker starts out with an equal
+  share of the jobs and works through its own share first.  Once it
+  runs out, it steals jobs from the other end of some other worker's
+  share, so a few slow jobs don't leave the rest of the workers idle.
+*/
+
+#ifndef _WORKERS_H_
+#define _WORKERS_H_
+
+/** Return the number of cores available, the natural number of
+    workers to use.
+    @return number of cores, at least one.
+*/
+int coreCount();
+
+/** Run a batch of jobs on a pool of workers, returning once they're
+    all done.
+    @param count number of jobs, numbered from 0 to count - 1.
+    @param workers number of worker threads to use.
+    @param job function to run a job, called with the job's number and
+    arg.  Jobs may run in any order and on any worker.
+    @param arg value passed to every call to job.
+*/
+void runJobs( int count, int workers, void (*job)( int index, void *arg ),
+              void *arg );
+
+#endif